@@ -0,0 +1,358 @@
+// Microbenchmarks, built apart from the renderer:
+//
+//   g++ -std=c++17 -O2 -fopenmp bench/bench.cpp -o bench
+//   ./bench [name] [size]
+//
+// Runs every benchmark when no name is given.
+
+#include "../headers/common.h"
+#include "../headers/bvh.h"
+#include "../headers/constant_medium.h"
+#include "../headers/cuboid.h"
+#include "../headers/hittable_list.h"
+#include "../headers/quad.h"
+#include "../headers/sphere.h"
+#include "../camera/camera.h"
+#include "../material/material.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <omp.h>
+#include <streambuf>
+#include <string>
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Best of runs, to keep other work on the machine out of the number.
+static double best_time(int runs, const std::function<void()>& f) {
+    double best = infinity;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, seconds_since(start));
+    }
+    return best;
+}
+
+static hittable_list random_spheres(size_t count) {
+    seed_random(1);
+    hittable_list world;
+    world.objects.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        point3 center(random_double(-100, 100), random_double(-100, 100), random_double(-100, 100));
+        world.add(make_shared<sphere>(center, random_double(0.05, 0.5), 0));
+    }
+    return world;
+}
+
+// BVH construction time over size random spheres for 1, 2, 4, ... threads.
+static void bench_bvh_build(size_t size) {
+    auto world = random_spheres(size ? size : 1000000);
+    int max_threads = omp_get_num_procs();
+    std::printf("bvh_build: %zu spheres\n", world.objects.size());
+    double serial = 0;
+    for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+        omp_set_num_threads(threads);
+        double time = best_time(3, [&] { bvh_node bvh(world); });
+        if (threads == 1)
+            serial = time;
+        std::printf("  %3d threads  %8.3f s  %5.2fx\n", threads, time, serial / time);
+        if (threads == max_threads)
+            break;
+    }
+}
+
+// Rays from around the unit cube towards it; one in eight runs along an axis.
+static std::vector<ray> random_rays(size_t count) {
+    seed_random(2);
+    std::vector<ray> rays;
+    for (size_t i = 0; i < count; i++) {
+        point3 origin = 3 * random_unit_vector();
+        vec3 direction = point3(random_double(-1, 1), random_double(-1, 1), random_double(-1, 1)) - origin;
+        if (i % 8 == 0) {
+            int axis = random_int(0, 2);
+            direction = vec3(axis == 0, axis == 1, axis == 2) * -origin[axis];
+        }
+        rays.emplace_back(origin, direction);
+    }
+    return rays;
+}
+
+// Nanoseconds per call of test, looping over a batch of rays small enough to stay
+// in cache, and the fraction of rays hit.
+template <typename Test>
+static void time_kernel(const char* name, size_t size, Test test) {
+    auto rays = random_rays(size ? size : 4096);
+    const int repeats = 256;
+    size_t hits = 0;
+    double time = best_time(5, [&] {
+        hits = 0;
+        for (int i = 0; i < repeats; i++)
+            for (const auto& r : rays)
+                hits += test(r);
+    });
+    std::printf("%s: %6.2f ns per ray, %4.1f%% hit\n", name, 1e9 * time / (repeats * rays.size()),
+                100.0 * hits / (repeats * rays.size()));
+}
+
+static void bench_aabb_hit(size_t size) {
+    aabb box(point3(-0.5, -0.5, -0.5), point3(0.5, 0.5, 0.5));
+    time_kernel("aabb_hit", size, [&](const ray& r) { return box.hit(r, interval(0.001, infinity)); });
+}
+
+static void bench_sphere_hit(size_t size) {
+    sphere ball(point3(0, 0, 0), 0.7, 0);
+    hit_record rec;
+    time_kernel("sphere_hit", size, [&](const ray& r) { return ball.hit(r, interval(0.001, infinity), rec); });
+}
+
+static void bench_quad_hit(size_t size) {
+    quad face(point3(-0.7, -0.7, 0.1), vec3(1.4, 0, 0.2), vec3(0, 1.4, 0), 0);
+    hit_record rec;
+    time_kernel("quad_hit", size, [&](const ray& r) { return face.hit(r, interval(0.001, infinity), rec); });
+}
+
+// The native box against the six quads box() builds.
+static void bench_box_hit(size_t size) {
+    point3 a(-0.5, -0.5, -0.5), b(0.5, 0.5, 0.5);
+    auto quads = box(a, b, 0);
+    cuboid solid(a, b, 0);
+    cuboid turned(a, b, 0, vec3(10, 30, 0));
+    hit_record rec;
+    time_kernel("box_hit (six quads)", size, [&](const ray& r) { return quads->hit(r, interval(0.001, infinity), rec); });
+    time_kernel("box_hit (cuboid)", size, [&](const ray& r) { return solid.hit(r, interval(0.001, infinity), rec); });
+    time_kernel("box_hit (oriented cuboid)", size, [&](const ray& r) { return turned.hit(r, interval(0.001, infinity), rec); });
+}
+
+// Fog in a sphere against the bare sphere; the media cost two boundary hits plus
+// the free-flight sampling.
+static void bench_medium_hit(size_t size) {
+    auto ball = make_shared<sphere>(point3(0, 0, 0), 0.7, 0);
+    constant_medium fog(ball, 1.0, 0);
+    std::vector<double> densities(16 * 16 * 16);
+    for (size_t i = 0; i < densities.size(); i++)
+        densities[i] = (i % 7) / 6.0;
+    constant_medium smoke(ball, 1.0, 0, make_shared<density_grid>(16, 16, 16, densities));
+    hit_record rec;
+    time_kernel("medium_hit (sphere)", size, [&](const ray& r) { return ball->hit(r, interval(0.001, infinity), rec); });
+    time_kernel("medium_hit (uniform)", size, [&](const ray& r) { return fog.hit(r, interval(0.001, infinity), rec); });
+    time_kernel("medium_hit (grid)", size, [&](const ray& r) { return smoke.hit(r, interval(0.001, infinity), rec); });
+}
+
+// Nanoseconds per camera sample over a field of size diffuse spheres under a plain
+// sky. The kernel render_region picks for the scene skips emission lookups; the
+// general one does them at every bounce, as every render did before kernels were
+// specialized. Roulette ends dim paths from the third bounce, changing the image.
+static void bench_render_kernel(size_t size) {
+    seed_random(1);
+    material_table materials;
+    int ground = materials.add(lambertian(color(0.5, 0.5, 0.5)));
+    int paint = materials.add(lambertian(color(0.8, 0.6, 0.3)));
+    hittable_list world;
+    world.add(make_shared<quad>(point3(-50, 0, -50), vec3(100, 0, 0), vec3(0, 0, 100), ground));
+    for (size_t i = 0; i < (size ? size : 400); i++) {
+        auto radius = random_double(0.3, 1.5);
+        world.add(make_shared<sphere>(point3(random_double(-20, 20), radius, random_double(-20, 20)), radius, paint));
+    }
+    bvh_node bvh(world);
+
+    camera cam;
+    cam.image_width = 64;
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 10;
+    cam.background = color(0.7, 0.8, 1.0);
+    cam.lookfrom = point3(0, 8, -30);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+    cam.vfov = 50;
+    cam.initialize();
+    int width = cam.window_width(), height = cam.window_height();
+    std::vector<color> image(size_t(width) * height);
+
+    auto time_render = [&](const char* name, const std::function<void()>& render) {
+        double time = best_time(5, render);
+        std::printf("%s: %6.1f ns per sample\n", name, 1e9 * time / (double(width) * height * cam.samples_per_pixel));
+    };
+    time_render("render_kernel (general)", [&] {
+        cam.render_kernel<false, true, false, false>(bvh, materials, 0, 0, width, height, image.data(), width, nullptr);
+    });
+    time_render("render_kernel (specialized)", [&] {
+        cam.render_region(bvh, materials, 0, 0, width, height, image.data(), width);
+    });
+    cam.roulette_depth = 3;
+    time_render("render_kernel (roulette)", [&] {
+        cam.render_region(bvh, materials, 0, 0, width, height, image.data(), width);
+    });
+}
+
+// Writing an 8K frame of summed samples: write_color a pixel at a time, as
+// write_image did, against the tone_mapper with the same defaults and with the
+// full curve, sRGB and dither path. size is the image width.
+static void bench_output_stage(size_t size) {
+    int width = size ? int(size) : 7680, height = width * 9 / 16;
+    int samples = 16;
+    seed_random(1);
+    std::vector<color> image(size_t(width) * height);
+    for (auto& pixel : image)
+        pixel = color(random_double(0, 20), random_double(0, 20), random_double(0, 20));
+
+    // Counts the bytes and drops them, so the time is the output stage's own.
+    struct counting_buffer : std::streambuf {
+        size_t bytes = 0;
+        std::streamsize xsputn(const char*, std::streamsize n) override { bytes += n; return n; }
+        int overflow(int c) override { bytes++; return c; }
+    };
+    auto time_write = [&](const char* name, const std::function<void(std::ostream&)>& write) {
+        size_t bytes = 0;
+        double time = best_time(3, [&] {
+            counting_buffer sink;
+            std::ostream out(&sink);
+            write(out);
+            bytes = sink.bytes;
+        });
+        std::printf("%s: %7.1f ms (%.1f MB)\n", name, 1e3 * time, bytes / 1e6);
+    };
+    time_write("output_stage (write_color)", [&](std::ostream& out) {
+        for (const auto& pixel : image)
+            write_color(out, pixel, samples);
+    });
+    time_write("output_stage (tone_mapper)", [&](std::ostream& out) {
+        tone_mapper(output_settings(), 1.0 / samples).write_pixels(image, width, height, out);
+    });
+    output_settings graded;
+    graded.curve = tone_curve::aces;
+    graded.srgb = true;
+    graded.dither = true;
+    time_write("output_stage (aces, srgb, dither)", [&](std::ostream& out) {
+        tone_mapper(graded, 1.0 / samples).write_pixels(image, width, height, out);
+    });
+    graded.binary = true;
+    time_write("output_stage (aces, srgb, dither, P6)", [&](std::ostream& out) {
+        tone_mapper(graded, 1.0 / samples).write_pixels(image, width, height, out);
+    });
+}
+
+// Forwards to a world, counting the rays traced against it.
+class counting_world : public hittable {
+  public:
+    explicit counting_world(const hittable& _world) : world(_world) {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        rays.fetch_add(1, std::memory_order_relaxed);
+        return world.hit(r, ray_t, rec);
+    }
+
+    aabb bounding_box() const override { return world.bounding_box(); }
+
+    mutable std::atomic<size_t> rays{0};
+
+  private:
+    const hittable& world;
+};
+
+// Millions of rays per second rendering the tiles of a frame with every bounce
+// traced recursively, path by path, and with each bounce of a tile's paths
+// sorted by direction octant and origin and traced together.
+static void time_ray_sorting(const char* name, camera& cam, const hittable& world, const material_table& materials) {
+    cam.initialize();
+    std::vector<color> image(size_t(cam.window_width()) * cam.window_height());
+    for (bool sorted : {false, true}) {
+        cam.sort_rays = sorted;
+        counting_world counted(world);
+        double time = best_time(3, [&] {
+            counted.rays = 0;
+            for (int tile = 0; tile < camera::render_tile_count; tile++)
+                cam.render_tile(counted, materials, tile, image.data(), nullptr);
+        });
+        std::printf("%s (%s): %6.2f Mrays/s, %zu rays\n", name, sorted ? "sorted" : "recursive",
+                    counted.rays / time / 1e6, counted.rays.load());
+    }
+}
+
+static void bench_ray_sorting(size_t size) {
+    // The closing scene of the first book: a grid of small diffuse, metal and glass
+    // spheres around three large ones, over a huge ground sphere.
+    seed_random(1);
+    material_table materials;
+    hittable_list spheres;
+    spheres.add(make_shared<sphere>(point3(0, -1000, 0), 1000, materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+    int glass = materials.add(dielectric(1.5));
+    int half = size ? int(size) : 11;
+    for (int a = -half; a < half; a++) {
+        for (int b = -half; b < half; b++) {
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+            auto choice = random_double();
+            int mat = choice < 0.8 ? materials.add(lambertian(color::random() * color::random()))
+                    : choice < 0.95 ? materials.add(metal(color::random(0.5, 1), random_double(0, 0.5)))
+                    : glass;
+            spheres.add(make_shared<sphere>(center, 0.2, mat));
+        }
+    }
+    spheres.add(make_shared<sphere>(point3(0, 1, 0), 1.0, glass));
+    spheres.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, materials.add(lambertian(color(0.4, 0.2, 0.1)))));
+    spheres.add(make_shared<sphere>(point3(4, 1, 0), 1.0, materials.add(metal(color(0.7, 0.6, 0.5), 0.0))));
+    bvh_node spheres_bvh(spheres);
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 160;
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 10;
+    cam.background = color(0.7, 0.8, 1.0);
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+    time_ray_sorting("ray_sorting random spheres", cam, spheres_bvh, materials);
+
+    material_table box_materials;
+    int red = box_materials.add(lambertian(color(0.65, 0.05, 0.05)));
+    int white = box_materials.add(lambertian(color(0.73, 0.73, 0.73)));
+    int green = box_materials.add(lambertian(color(0.12, 0.45, 0.15)));
+    int light = box_materials.add(diffuse_light(color(15, 15, 15)));
+    hittable_list cornell;
+    cornell.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    cornell.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    cornell.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    cornell.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    cornell.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    cornell.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+    cornell.add(make_shared<cuboid>(point3(130, 0, 65), point3(295, 165, 230), white, vec3(0, -18, 0)));
+    cornell.add(make_shared<cuboid>(point3(265, 0, 295), point3(430, 330, 460), white, vec3(0, 15, 0)));
+    bvh_node cornell_bvh(cornell);
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 128;
+    cam.samples_per_pixel = 32;
+    cam.background = color(0, 0, 0);
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    time_ray_sorting("ray_sorting cornell", cam, cornell_bvh, box_materials);
+}
+
+int main(int argc, char* argv[]) {
+    std::map<std::string, std::function<void(size_t)>> benchmarks = {
+        {"aabb_hit", bench_aabb_hit},
+        {"box_hit", bench_box_hit},
+        {"bvh_build", bench_bvh_build},
+        {"medium_hit", bench_medium_hit},
+        {"output_stage", bench_output_stage},
+        {"quad_hit", bench_quad_hit},
+        {"ray_sorting", bench_ray_sorting},
+        {"render_kernel", bench_render_kernel},
+        {"sphere_hit", bench_sphere_hit},
+    };
+
+    std::string only = (argc > 1) ? argv[1] : "";
+    size_t size = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 0;
+    for (const auto& [name, run] : benchmarks)
+        if (only.empty() || only == name)
+            run(size);
+}
@@ -0,0 +1,152 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "camera.h"
+#include "./../headers/animated.h"
+#include "./../headers/bvh.h"
+#include "./../headers/hittable_list.h"
+#include "./../material/material.h"
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct camera_keyframe {
+    double time;
+    point3 lookfrom;
+    point3 lookat;
+    double vfov;
+};
+
+// Renders a range of frames in one process. The scene is parsed and the BVH built
+// once; between frames only the animated objects and the camera move, the BVH is
+// refit around them, and it is rebuilt only when refitting has made it noticeably
+// worse than it was when built. The camera's shutter interval is taken relative to
+// the start of each frame.
+class animation {
+  public:
+    bool   enabled = false;
+    double fps = 24;
+    int    frame_start = 0;
+    int    frame_end = 0;
+    std::string output = "frame_%04d.ppm";
+    double rebuild_threshold = 1.3;
+
+    std::vector<camera_keyframe> camera_keyframes;
+    std::vector<shared_ptr<animated>> objects;
+
+    // Poses objects over the shutter interval [time0, time1] and the camera at time0.
+    void pose(double time0, double time1, camera& cam) const {
+        for (const auto& object : objects)
+            object->set_time(time0, time1);
+
+        auto time = time0;
+        if (camera_keyframes.empty())
+            return;
+
+        auto key = camera_keyframes.front();
+        for (size_t k = 1; k < camera_keyframes.size(); k++) {
+            const auto& a = camera_keyframes[k - 1];
+            const auto& b = camera_keyframes[k];
+            if (time <= a.time)
+                break;
+            if (time >= b.time || b.time <= a.time) {
+                key = b;
+                continue;
+            }
+            auto f = (time - a.time) / (b.time - a.time);
+            key.lookfrom = (1 - f) * a.lookfrom + f * b.lookfrom;
+            key.lookat = (1 - f) * a.lookat + f * b.lookat;
+            key.vfov = (1 - f) * a.vfov + f * b.vfov;
+            break;
+        }
+
+        cam.lookfrom = key.lookfrom;
+        cam.lookat = key.lookat;
+        cam.vfov = key.vfov;
+    }
+
+    // output with its one integer conversion, %d or %0Nd, replaced by frame and %%
+    // by %. output comes from the scene, so it is never used as a printf format;
+    // any other conversion, or a count other than one, gives an empty name.
+    std::string frame_filename(int frame) const {
+        std::string name;
+        int conversions = 0;
+        for (size_t i = 0; i < output.size(); i++) {
+            if (output[i] != '%') {
+                name += output[i];
+                continue;
+            }
+            size_t j = i + 1;
+            if (j < output.size() && output[j] == '%') {
+                name += '%';
+                i = j;
+                continue;
+            }
+            bool zero = j < output.size() && output[j] == '0';
+            j += zero;
+            size_t digits = j;
+            while (j < output.size() && j - digits < 3 && std::isdigit(static_cast<unsigned char>(output[j])))
+                j++;
+            if (j >= output.size() || output[j] != 'd')
+                return "";
+
+            int width = j > digits ? std::stoi(output.substr(digits, j - digits)) : 0;
+            char number[128];
+            std::snprintf(number, sizeof(number), zero ? "%0*d" : "%*d", width, frame);
+            name += number;
+            conversions++;
+            i = j;
+        }
+        return conversions == 1 ? name : "";
+    }
+
+    void render(camera& cam, const hittable_list& world, const material_table& materials) const {
+        if (frame_filename(frame_start).empty()) {
+            std::cerr << "Error: Frame pattern '" << output << "' needs exactly one %d or %0Nd." << std::endl;
+            return;
+        }
+
+        auto shutter_open = cam.shutter_open;
+        auto shutter_close = cam.shutter_close;
+        auto set_frame = [&](int frame) {
+            cam.shutter_open = frame / fps + shutter_open;
+            cam.shutter_close = frame / fps + shutter_close;
+            pose(cam.shutter_open, cam.shutter_close, cam);
+        };
+
+        set_frame(frame_start);
+        auto bvh = make_shared<bvh_node>(world, cam.shutter_open, cam.shutter_close);
+        auto built_cost = bvh->sah_cost();
+
+        for (int frame = frame_start; frame <= frame_end; frame++) {
+            set_frame(frame);
+
+            const char* update = "built";
+            if (frame != frame_start) {
+                bvh->refit(cam.shutter_open, cam.shutter_close);
+                update = "refit";
+                if (bvh->sah_cost() > rebuild_threshold * built_cost) {
+                    bvh = make_shared<bvh_node>(world, cam.shutter_open, cam.shutter_close);
+                    built_cost = bvh->sah_cost();
+                    update = "rebuilt";
+                }
+            }
+
+            auto filename = frame_filename(frame);
+            std::clog << "Frame " << frame << ": BVH " << update << ", SAH cost " << bvh->sah_cost()
+                      << ", writing " << filename << std::endl;
+
+            std::ofstream out(filename);
+            cam.render(*bvh, materials, out);
+        }
+
+        cam.shutter_open = shutter_open;
+        cam.shutter_close = shutter_close;
+    }
+};
+
+#endif
@@ -1,173 +1,856 @@
-#ifndef CAMERA_H
-#define CAMERA_H
-
-#include "./../headers/common.h"
-
-#include "./../headers/color.h"
-#include "./../headers/hittable.h"
-#include "./../material/material.h"
-#include <iostream>
-#include <omp.h>
-#include <vector>
-#include <atomic>
-#include <sstream>
-
-class camera {
-  public:
-    double aspect_ratio = 1.0;  
-    int    image_width  = 100;  
-    int    samples_per_pixel = 50;
-    int    max_depth    = 10;   
-    color  background;
-    
-    double vfov = 90;
-    point3 lookfrom = point3(0,0,-1);  
-    point3 lookat   = point3(0,0,0);   
-    vec3   vup      = vec3(0,-1,0);     
-
-    double defocus_angle = 0;  
-    double focus_dist = 10;    
-
-    void render(const hittable& world) {
-        
-        initialize();
-
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-        std::vector<color> image(image_width * image_height);
-
-        const int NUM_TILES_X = 16;
-        const int NUM_TILES_Y = 16;
-        
-        const int TILE_SIZE_X = image_width / NUM_TILES_X;
-        const int TILE_SIZE_Y = image_height / NUM_TILES_Y;
-
-        std::atomic<int> processedTiles(0);
-        
-        #pragma omp parallel for schedule(dynamic) num_threads(16)
-        for (int tile_y = 0; tile_y < NUM_TILES_Y; tile_y++) {
-            for (int tile_x = 0; tile_x < NUM_TILES_X; tile_x++) {
-                
-                int x0 = tile_x * TILE_SIZE_X;
-                int y0 = tile_y * TILE_SIZE_Y;
-                
-                int x1 = x0 + TILE_SIZE_X;
-                int y1 = y0 + TILE_SIZE_Y;
-               
-                for (int j = y0; j < y1; j++) {
-                    for (int i = x0; i < x1; i++) {
-                        color pixel_color(0,0,0);
-                        for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                            ray r = get_ray(i, j);
-                            pixel_color += ray_color(r, max_depth, world, color(1,1,1));
-                        }                       
-                        image[j * image_width + i] = pixel_color;
-                    }
-                }
-                int processed = ++processedTiles;
-                std::stringstream ss;
-                ss << "\rProcessed " << processed << " out of " << (NUM_TILES_X * NUM_TILES_Y) << " tiles.";
-                std::clog << ss.str() << std::flush;            
-            }
-        }
-        std::clog << std::endl;
-        
-        for (int j = 0; j < image_height; ++j) {
-            for (int i = 0; i < image_width; ++i) {
-                write_color(image[j * image_width + i], samples_per_pixel);
-            }
-        }
-    }
-
-  private:
-    int    image_height;   
-    point3 center;         
-    point3 pixel00_loc;    
-    vec3   pixel_delta_u;  
-    vec3   pixel_delta_v;  
-    vec3   u, v, w;        
-    vec3   defocus_disk_u;  
-    vec3   defocus_disk_v;  
-
-    void initialize() {
-
-        image_height = static_cast<int>(image_width / aspect_ratio);
-        image_height = (image_height < 1) ? 1 : image_height;
-
-        center = lookfrom;
-        
-        auto theta = degrees_to_radians(vfov);
-        auto h = tan(theta/2);
-        auto viewport_height = 2 * h * focus_dist;
-        auto viewport_width = viewport_height * (static_cast<double>(image_width)/image_height);
-        
-        w = unit_vector(lookfrom - lookat);
-        u = unit_vector(cross(vup, w));
-        v = cross(w, u);
-        
-        vec3 viewport_u = viewport_width * u;    
-        vec3 viewport_v = viewport_height * -v;  
-        
-        pixel_delta_u = viewport_u / image_width;
-        pixel_delta_v = viewport_v / image_height;
-        
-        auto viewport_upper_left = center - (focus_dist * w) - viewport_u/2 - viewport_v/2;
-        pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
-        
-        auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
-        defocus_disk_u = u * defocus_radius;
-        defocus_disk_v = v * defocus_radius;
-
-    }
-
-    ray get_ray(int i, int j) const {
-        
-        auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
-        auto pixel_sample = pixel_center + pixel_sample_square();
-
-        auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
-        auto ray_direction = pixel_sample - ray_origin;
-
-        return ray(ray_origin, ray_direction);
-    }
-
-    point3 defocus_disk_sample() const {
-        
-        auto p = random_in_unit_disk();
-        return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
-    }
-
-    vec3 pixel_sample_square() const {
-        
-        auto px = -0.5 + random_double();
-        auto py = -0.5 + random_double();
-        return (px * pixel_delta_u) + (py * pixel_delta_v);
-    }
-
-    color ray_color(const ray& r, int depth, const hittable& world, color current_attenuation) const {
-        
-        hit_record rec;
-        
-        if (depth <= 0)
-            return color(0,0,0);
-        
-        if (!world.hit(r, interval(0.001, infinity), rec))
-            return background;
-
-        ray scattered;
-        color attenuation;
-        color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
-
-        if (!rec.mat->scatter(r, rec, attenuation, scattered))
-            return color_from_emission;
-
-        
-        if (attenuation.length_squared() < 0.001)
-            return color_from_emission;
-
-        color color_from_scatter = attenuation * ray_color(scattered, depth-1, world, current_attenuation * attenuation);
-
-        return color_from_emission + color_from_scatter;
-    }
-};
-
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "./../headers/common.h"
+
+#include "./../headers/color.h"
+#include "./../headers/hittable.h"
+#include "./../headers/numa.h"
+#include "./../headers/spectrum.h"
+#include "./../headers/tonemap.h"
+#include "./../material/material.h"
+#include "./../texture/environment.h"
+#include "denoiser.h"
+#include "framebuffer.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <omp.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <atomic>
+#include <sstream>
+
+class camera {
+  public:
+    double aspect_ratio = 1.0;  
+    int    image_width  = 100;  
+    int    samples_per_pixel = 50;
+    int    max_depth    = 10;   
+    color  background;
+    shared_ptr<environment_map> environment;
+    
+    double vfov = 90;
+    point3 lookfrom = point3(0,0,-1);  
+    point3 lookat   = point3(0,0,0);   
+    vec3   vup      = vec3(0,-1,0);     
+
+    double defocus_angle = 0;  
+    double focus_dist = 10;    
+
+    // Rays are spread uniformly over [shutter_open, shutter_close]; equal values
+    // render a single instant.
+    double shutter_open = 0;
+    double shutter_close = 0;
+
+    // Traces four wavelengths per sample instead of RGB, so dispersive glass splits
+    // light into colors.
+    bool spectral = false;
+
+    // From this bounce on, RGB paths continue with probability given by their
+    // throughput, at most 0.95, and are reweighted to stay unbiased. 0 traces every
+    // path to max_depth.
+    int roulette_depth = 0;
+
+    // Traces the paths of each tile a bounce at a time, sorting every bounce's rays
+    // by direction octant and origin so consecutive rays visit the same BVH nodes.
+    // Paths draw the same random numbers as otherwise, so only rounding changes.
+    // Applies to RGB renders without feature buffers.
+    bool sort_rays = false;
+
+    // Filters the finished image with the denoiser, guided by first-hit features.
+    bool denoise = false;
+    // When set, also writes the feature buffers to <prefix>_albedo.ppm,
+    // <prefix>_normal.ppm and <prefix>_depth.ppm.
+    std::string aov_prefix;
+    // When set, also writes beauty and every feature channel to one OpenEXR file.
+    std::string exr_output;
+
+    // Exposure, tone curve, encoding and format of the image write_image() writes.
+    output_settings output;
+
+    // Threads render() spreads tiles over.
+    int threads = 16;
+
+    // When set, render() pins its threads to the nodes in equal blocks and gives each
+    // node a band of tiles, so the image pages are first written, and placed, there.
+    // With numa_replicate, each node also traces its own copy of the world.
+    shared_ptr<numa_topology> numa;
+    bool numa_replicate = false;
+
+    // Renders only pixels [crop_x0, crop_x1) x [crop_y0, crop_y1) of the frame; a
+    // negative end stands for the image edge.
+    int crop_x0 = 0, crop_y0 = 0, crop_x1 = -1, crop_y1 = -1;
+    // Renders only band tile_index of tile_count, splitting the frame's rows of
+    // tile_rows-pixel tiles as evenly as possible. Combines with the crop.
+    int tile_index = 0, tile_count = 1;
+    static constexpr int tile_rows = 32;
+
+    void render(const hittable& world, const material_table& materials, std::ostream& out = std::cout) {
+        
+        initialize();
+
+        size_t pixels = size_t(window_width()) * window_height();
+        std::vector<color> image;
+        std::vector<pixel_features> features;
+
+        std::atomic<int> processedTiles(0);
+
+        auto tile_done = [&] {
+            int processed = ++processedTiles;
+            std::stringstream ss;
+            ss << "\rProcessed " << processed << " out of " << render_tile_count << " tiles.";
+            std::clog << ss.str() << std::flush;
+        };
+
+        if (numa) {
+            first_touch_buffer<color> node_image(pixels);
+            first_touch_buffer<pixel_features> node_features(wants_features() ? pixels : 0);
+            render_on_nodes(world, render_tile_count, [&](int tile, const hittable& node_world) {
+                if (render_tile(node_world, materials, tile, node_image.data(), node_features.data()))
+                    tile_done();
+            });
+            image = node_image.to_vector();
+            features = node_features.to_vector();
+        } else {
+            image.resize(pixels);
+            if (wants_features())
+                features.resize(pixels);
+
+            #pragma omp parallel for schedule(dynamic) num_threads(threads)
+            for (int tile = 0; tile < render_tile_count; tile++)
+                if (render_tile(world, materials, tile, image.data(), features.empty() ? nullptr : features.data()))
+                    tile_done();
+        }
+        std::clog << std::endl;
+
+        finish(image, features, out);
+    }
+
+    // render() splits the window into tiles_per_side x tiles_per_side tiles.
+    static constexpr int tiles_per_side = 16;
+    static constexpr int render_tile_count = tiles_per_side * tiles_per_side;
+
+    // Pixels [x0,x1) x [y0,y1) of the window covered by tile, in row-major order;
+    // empty for tiles past the edge of a small window.
+    struct tile_rect {
+        int x0, y0, x1, y1;
+        bool empty() const { return x0 >= x1 || y0 >= y1; }
+    };
+
+    tile_rect tile_bounds(int tile) const {
+        int width = window_width(), height = window_height();
+        int tile_width = (width + tiles_per_side - 1) / tiles_per_side;
+        int tile_height = (height + tiles_per_side - 1) / tiles_per_side;
+        int x0 = std::min(tile % tiles_per_side * tile_width, width);
+        int y0 = std::min(tile / tiles_per_side * tile_height, height);
+        return {x0, y0, std::min(x0 + tile_width, width), std::min(y0 + tile_height, height)};
+    }
+
+    // Renders tile into image and, when given, features, both laid out like the
+    // window. Returns false for an empty tile.
+    bool render_tile(const hittable& world, const material_table& materials, int tile,
+                     color* image, pixel_features* features) const {
+        auto rect = tile_bounds(tile);
+        if (rect.empty())
+            return false;
+        size_t offset = size_t(rect.y0) * window_width() + rect.x0;
+        render_region(world, materials, window_x0 + rect.x0, window_y0 + rect.y0, window_x0 + rect.x1, window_y0 + rect.y1,
+                      image + offset, window_width(), features ? features + offset : nullptr);
+        return true;
+    }
+
+    // Whether finish() needs the feature buffers.
+    bool wants_features() const { return denoise || !aov_prefix.empty() || !exr_output.empty(); }
+
+    // Writes the feature images, denoises and writes the EXR as configured, then
+    // writes the image to out. image and features cover the window.
+    void finish(std::vector<color>& image, const std::vector<pixel_features>& features, std::ostream& out = std::cout) const {
+        if (!aov_prefix.empty())
+            write_features(features, aov_prefix);
+        if (denoise)
+            image = denoiser().apply(image, features, window_width(), window_height(), samples_per_pixel);
+        if (!exr_output.empty())
+            write_exr(image, features, exr_output);
+        
+        write_image(image, out);
+    }
+
+    // Computes image_height and the viewport; must run before render_region.
+    void initialize() {
+
+        image_height = static_cast<int>(image_width / aspect_ratio);
+        image_height = (image_height < 1) ? 1 : image_height;
+
+        center = lookfrom;
+        
+        auto theta = degrees_to_radians(vfov);
+        auto h = tan(theta/2);
+        auto viewport_height = 2 * h * focus_dist;
+        auto viewport_width = viewport_height * (static_cast<double>(image_width)/image_height);
+        
+        w = unit_vector(lookfrom - lookat);
+        u = unit_vector(cross(vup, w));
+        v = cross(w, u);
+        
+        vec3 viewport_u = viewport_width * u;    
+        vec3 viewport_v = viewport_height * -v;  
+        
+        pixel_delta_u = viewport_u / image_width;
+        pixel_delta_v = viewport_v / image_height;
+        pixel_spread = 2 * h / image_height;
+        
+        auto viewport_upper_left = center - (focus_dist * w) - viewport_u/2 - viewport_v/2;
+        pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
+        
+        auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
+        defocus_disk_u = u * defocus_radius;
+        defocus_disk_v = v * defocus_radius;
+
+        window_x0 = std::clamp(crop_x0, 0, image_width);
+        window_y0 = std::clamp(crop_y0, 0, image_height);
+        window_x1 = std::clamp(crop_x1 < 0 ? image_width : crop_x1, window_x0, image_width);
+        window_y1 = std::clamp(crop_y1 < 0 ? image_height : crop_y1, window_y0, image_height);
+        if (tile_count > 1) {
+            int rows = (image_height + tile_rows - 1) / tile_rows;
+            int first = tile_index * rows / tile_count;
+            int last = (tile_index + 1) * rows / tile_count;
+            window_y0 = std::clamp(first * tile_rows, window_y0, window_y1);
+            window_y1 = std::clamp(last * tile_rows, window_y0, window_y1);
+        }
+    }
+
+    int height() const { return image_height; }
+
+    // The part of the frame render() covers, set by initialize().
+    int window_x() const      { return window_x0; }
+    int window_y() const      { return window_y0; }
+    int window_width() const  { return window_x1 - window_x0; }
+    int window_height() const { return window_y1 - window_y0; }
+    bool full_frame() const   { return window_width() == image_width && window_height() == image_height; }
+
+    // Accumulates the summed samples of pixels [x0,x1) x [y0,y1) into out, whose rows
+    // are stride pixels apart. Every sample reseeds the random stream from its pixel
+    // and index, so any split of the image renders the same values. features, when
+    // given, is laid out like out and receives the first-hit feature buffers.
+    // The loop is compiled once per combination of scene features; this picks the one
+    // matching the camera, materials and features, so no sample tests for features
+    // the scene does not have.
+    void render_region(const hittable& world, const material_table& materials,
+                       int x0, int y0, int x1, int y1, color* out, int stride,
+                       pixel_features* features = nullptr) const {
+        if (sort_rays && !spectral && !features) {
+            render_sorted(world, materials, x0, y0, x1, y1, out, stride);
+            return;
+        }
+        auto kernel = kernel_table()[kernel_index(materials, features != nullptr)];
+        (this->*kernel)(world, materials, x0, y0, x1, y1, out, stride, features);
+    }
+
+    // Bits of the render_region kernel for these settings: defocus, emissive
+    // materials, Russian roulette and feature buffers.
+    unsigned kernel_index(const material_table& materials, bool features) const {
+        return (defocus_angle > 0 ? 1u : 0u) | (materials.emissive() ? 2u : 0u)
+             | (roulette_depth > 0 ? 4u : 0u) | (features ? 8u : 0u);
+    }
+
+    template <bool Defocus, bool Emissive, bool Roulette, bool Aov>
+    void render_kernel(const hittable& world, const material_table& materials,
+                       int x0, int y0, int x1, int y1, color* out, int stride,
+                       pixel_features* features) const {
+        #pragma omp parallel for schedule(dynamic)
+        for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i++) {
+                color pixel_color(0,0,0);
+                pixel_features pixel_aov;
+                double luminance_sum = 0, luminance_squares = 0;
+                for (int sample = 0; sample < samples_per_pixel; ++sample) {
+                    seed_sample(i, j, sample);
+                    ray r = get_ray<Defocus>(i, j);
+                    if constexpr (!Aov) {
+                        pixel_color += trace<Emissive, Roulette, false>(r, world, materials, nullptr);
+                        continue;
+                    }
+                    pixel_features sample_aov;
+                    auto sample_color = trace<Emissive, Roulette, true>(r, world, materials, &sample_aov);
+                    auto luminance = 0.2126 * sample_color.x() + 0.7152 * sample_color.y() + 0.0722 * sample_color.z();
+                    luminance_sum += luminance;
+                    luminance_squares += luminance * luminance;
+                    pixel_color += sample_color;
+
+                    pixel_aov.direct += sample_aov.direct;
+                    pixel_aov.albedo += sample_aov.albedo;
+                    pixel_aov.normal += sample_aov.normal;
+                    pixel_aov.depth += sample_aov.depth;
+                    pixel_aov.time += r.time();
+                    if (sample == 0)
+                        pixel_aov.material_id = sample_aov.material_id;
+                }
+                out[(j - y0) * stride + (i - x0)] = pixel_color;
+
+                if constexpr (Aov) {
+                    auto n = double(samples_per_pixel);
+                    auto mean = luminance_sum / n;
+                    pixel_aov.beauty = pixel_color / n;
+                    pixel_aov.direct /= n;
+                    pixel_aov.indirect = pixel_aov.beauty - pixel_aov.direct;
+                    pixel_aov.albedo /= n;
+                    pixel_aov.depth /= n;
+                    pixel_aov.time /= n;
+                    pixel_aov.sample_count = n;
+                    if (pixel_aov.normal.length_squared() > 0)
+                        pixel_aov.normal = unit_vector(pixel_aov.normal);
+                    pixel_aov.variance = (n > 1) ? std::max(0.0, luminance_squares / n - mean * mean) / (n - 1) : 0;
+                    features[(j - y0) * stride + (i - x0)] = pixel_aov;
+                }
+            }
+        }
+    }
+
+    // Adds samples [first_sample, first_sample + count) of every pixel in
+    // [x0,x1) x [y0,y1) to out. Sums built up over several calls match render_region
+    // over all of them.
+    void accumulate_region(const hittable& world, const material_table& materials,
+                           int x0, int y0, int x1, int y1, int first_sample, int count, color* out, int stride) const {
+        #pragma omp parallel for schedule(dynamic) num_threads(threads)
+        for (int j = y0; j < y1; j++)
+            for (int i = x0; i < x1; i++)
+                for (int sample = first_sample; sample < first_sample + count; ++sample)
+                    out[(j - y0) * stride + (i - x0)] += sample_pixel(world, materials, i, j, sample);
+    }
+
+    color sample_pixel(const hittable& world, const material_table& materials, int i, int j, int sample) const {
+        seed_sample(i, j, sample);
+        return trace(get_ray(i, j), world, materials);
+    }
+
+    // Partial images carry a "# offset x y full width height" comment placing them
+    // in the frame.
+    void write_header(std::ostream& out, const output_settings& format = output_settings()) const {
+        out << (format.binary ? "P6\n" : "P3\n");
+        if (!full_frame())
+            out << "# offset " << window_x0 << ' ' << window_y0 << " full " << image_width << ' ' << image_height << '\n';
+        out << window_width() << ' ' << window_height() << '\n' << format.max_value() << '\n';
+    }
+
+    // Writes plane as it is, clipped to 8 bits, ignoring the output settings.
+    void write_plane(const std::vector<color>& plane, std::ostream& out) const {
+        write_header(out);
+        tone_mapper(output_settings(), 1).write_pixels(plane, window_width(), window_height(), out);
+    }
+
+    // image covers the window, as returned by render_region over it.
+    void write_image(const std::vector<color>& image, std::ostream& out = std::cout) const {
+        write_header(out, output);
+        tone_mapper(output, 1.0 / samples_per_pixel).write_pixels(image, window_width(), window_height(), out,
+                                                                  window_x0, window_y0);
+    }
+
+    void write_exr(const std::vector<color>& image, const std::vector<pixel_features>& features, const std::string& filename) const {
+        framebuffer fb(window_width(), window_height());
+        fb.set_display_window(window_x0, window_y0, image_width, image_height);
+        fb.store(features);
+        if (denoise) {
+            float* planes[3] = {fb.channel(fb.add_channel("denoised.R")), fb.channel(fb.add_channel("denoised.G")),
+                                fb.channel(fb.add_channel("denoised.B"))};
+            for (int c = 0; c < 3; c++)
+                for (size_t i = 0; i < image.size(); i++)
+                    planes[c][i] = static_cast<float>(image[i][c] / samples_per_pixel);
+        }
+
+        std::ofstream out(filename, std::ios::binary);
+        fb.write_exr(out);
+    }
+
+    void write_features(const std::vector<pixel_features>& features, const std::string& prefix) const {
+        double max_depth_seen = 0;
+        for (const auto& f : features)
+            max_depth_seen = std::max(max_depth_seen, f.depth);
+
+        std::vector<color> albedo, normal, depth;
+        for (const auto& f : features) {
+            albedo.push_back(f.albedo);
+            normal.push_back(0.5 * (f.normal + vec3(1,1,1)));
+            auto d = (max_depth_seen > 0) ? f.depth / max_depth_seen : 0;
+            depth.push_back(color(d, d, d));
+        }
+
+        std::ofstream albedo_out(prefix + "_albedo.ppm"), normal_out(prefix + "_normal.ppm"), depth_out(prefix + "_depth.ppm");
+        write_plane(albedo, albedo_out);
+        write_plane(normal, normal_out);
+        write_plane(depth, depth_out);
+    }
+
+  private:
+    int    image_height;   
+    int    window_x0, window_y0, window_x1, window_y1;
+    point3 center;         
+    point3 pixel00_loc;    
+    vec3   pixel_delta_u;  
+    vec3   pixel_delta_v;  
+    vec3   u, v, w;        
+    vec3   defocus_disk_u;  
+    vec3   defocus_disk_v;  
+    double pixel_spread;
+
+    // Runs render_tile(tile, world) over tiles [0, tile_count), split in order into
+    // one band per node. Each thread is pinned to its node and takes tiles from its
+    // node's band, then from the other bands once its own runs out. The first
+    // thread of each node makes the node's replica before any tile starts.
+    template <typename F>
+    void render_on_nodes(const hittable& world, int tile_count, F render_tile) const {
+        int nodes = numa->nodes();
+        auto band_end = [&](int node) { return int(long(node + 1) * tile_count / nodes); };
+        std::vector<std::atomic<int>> next(nodes);
+        for (int node = 0; node < nodes; node++)
+            next[node] = node > 0 ? band_end(node - 1) : 0;
+        std::vector<shared_ptr<hittable>> replicas(nodes);
+
+        #pragma omp parallel num_threads(threads)
+        {
+            int thread = omp_get_thread_num(), team = omp_get_num_threads();
+            int node = numa->node_of(thread, team);
+            auto allowed = numa_topology::allowed_cpus();
+            numa->pin(node);
+            if (numa_replicate && (thread == 0 || numa->node_of(thread - 1, team) != node))
+                replicas[node] = world.replicate();
+            #pragma omp barrier
+
+            const hittable& node_world = replicas[node] ? *replicas[node] : world;
+            for (int k = 0; k < nodes; k++) {
+                int band = (node + k) % nodes;
+                for (int tile = next[band]++; tile < band_end(band); tile = next[band]++)
+                    render_tile(tile, node_world);
+            }
+            numa_topology::set_affinity(allowed);
+        }
+    }
+
+    using region_kernel = void (camera::*)(const hittable&, const material_table&, int, int, int, int,
+                                           color*, int, pixel_features*) const;
+
+    static const region_kernel* kernel_table() {
+        return kernel_table(std::make_integer_sequence<unsigned, 16>());
+    }
+
+    template <unsigned... Index>
+    static const region_kernel* kernel_table(std::integer_sequence<unsigned, Index...>) {
+        static const region_kernel table[] = {
+            &camera::render_kernel<(Index & 1) != 0, (Index & 2) != 0, (Index & 4) != 0, (Index & 8) != 0>...
+        };
+        return table;
+    }
+
+    // A path of render_sorted(): its next ray, the light it has gathered and the
+    // random stream it continues.
+    struct path_state {
+        ray r;
+        color throughput;
+        color radiance;
+        double cone_width;
+        double bsdf_pdf;
+        uint64_t random;
+        int id;             // Pixel and sample within the wave
+    };
+
+    // Paths traced together; their state and hits stay within a few megabytes.
+    static constexpr int paths_per_wave = 1 << 15;
+
+    // render_region() one wave of paths at a time. Each bounce finds the hits of all
+    // paths of the wave in sorted order, then continues them with ray_color()'s
+    // shading. Every path keeps its own random stream, swapped in around its hit and
+    // its shading, so it draws what the recursive kernel draws.
+    void render_sorted(const hittable& world, const material_table& materials,
+                       int x0, int y0, int x1, int y1, color* out, int stride) const {
+        int width = x1 - x0, pixels = width * (y1 - y0);
+        int samples = std::min(samples_per_pixel, paths_per_wave);
+        int pixels_per_wave = std::max(paths_per_wave / std::max(samples, 1), 1);
+        bool emissive = materials.emissive();
+
+        std::vector<path_state> paths, sorted;
+        std::vector<hit_record> hits;
+        std::vector<unsigned char> found, alive;
+        std::vector<uint32_t> order;
+        std::vector<color> results;
+
+        for (int p = 0; p < pixels; p++)
+            out[p / width * stride + p % width] = color(0,0,0);
+
+        for (int first_pixel = 0; first_pixel < pixels; first_pixel += pixels_per_wave) {
+            int wave_pixels = std::min(pixels_per_wave, pixels - first_pixel);
+            for (int first_sample = 0; first_sample < samples_per_pixel; first_sample += samples) {
+                int wave_samples = std::min(samples, samples_per_pixel - first_sample);
+                int count = wave_pixels * wave_samples;
+
+                paths.resize(count);
+                results.assign(count, color(0,0,0));
+                #pragma omp parallel for schedule(static)
+                for (int k = 0; k < count; k++) {
+                    int p = first_pixel + k / wave_samples;
+                    seed_sample(x0 + p % width, y0 + p / width, first_sample + k % wave_samples);
+                    auto& path = paths[k];
+                    path.r = get_ray(x0 + p % width, y0 + p / width);
+                    path.throughput = color(1,1,1);
+                    path.radiance = color(0,0,0);
+                    path.cone_width = 0;
+                    path.bsdf_pdf = 0;
+                    path.random = random_state();
+                    path.id = k;
+                }
+
+                // Camera rays are coherent in pixel order; later bounces are sorted.
+                for (int depth = max_depth; depth > 0 && !paths.empty(); depth--) {
+                    if (depth < max_depth)
+                        sort_paths(paths, order, sorted);
+
+                    int n = static_cast<int>(paths.size());
+                    hits.resize(n);
+                    found.resize(n);
+                    alive.resize(n);
+                    #pragma omp parallel for schedule(static)
+                    for (int k = 0; k < n; k++) {
+                        random_state() = paths[k].random;
+                        found[k] = world.hit(paths[k].r, interval(0.001, infinity), hits[k]);
+                        paths[k].random = random_state();
+                    }
+                    #pragma omp parallel for schedule(static)
+                    for (int k = 0; k < n; k++) {
+                        auto& path = paths[k];
+                        random_state() = path.random;
+                        if (found[k]) {
+                            alive[k] = extend_path(path, hits[k], depth, world, materials, emissive);
+                        } else {
+                            path.radiance += path.throughput * background_color(path.r, path.bsdf_pdf);
+                            alive[k] = false;
+                        }
+                        path.random = random_state();
+                    }
+
+                    int kept = 0;
+                    for (int k = 0; k < n; k++) {
+                        if (alive[k])
+                            paths[kept++] = paths[k];
+                        else
+                            results[paths[k].id] = paths[k].radiance;
+                    }
+                    paths.resize(kept);
+                }
+                for (const auto& path : paths)
+                    results[path.id] = path.radiance;
+
+                for (int k = 0; k < count; k++) {
+                    int p = first_pixel + k / wave_samples;
+                    out[p / width * stride + p % width] += results[k];
+                }
+            }
+        }
+    }
+
+    // ray_color() at a hit: adds what the path gathers there and scatters it on.
+    // Returns false when the path ends.
+    bool extend_path(path_state& path, hit_record& rec, int depth, const hittable& world,
+                     const material_table& materials, bool emissive) const {
+        path.cone_width += pixel_spread * rec.t * path.r.direction().length();
+        rec.footprint = path.cone_width * rec.uv_density;
+
+        ray scattered;
+        color attenuation;
+        color emission = emissive ? materials.emitted(rec.mat_id, rec.u, rec.v, rec.p) : color(0,0,0);
+        if (!materials.scatter(rec.mat_id, path.r, rec, attenuation, scattered) || attenuation.length_squared() < 0.001) {
+            path.radiance += path.throughput * emission;
+            return false;
+        }
+
+        color f;
+        double scattered_pdf = 0;
+        if (environment && materials.evaluate(rec.mat_id, rec, scattered.direction(), f, scattered_pdf))
+            emission += sample_environment(path.r, rec, world, materials);
+        path.radiance += path.throughput * emission;
+
+        if (roulette_depth > 0 && max_depth - depth >= roulette_depth) {
+            auto throughput = path.throughput * attenuation;
+            auto survival = fmin(fmax(throughput.x(), fmax(throughput.y(), throughput.z())), 0.95);
+            if (random_double() >= survival)
+                return false;
+            attenuation /= survival;
+        }
+
+        path.throughput = path.throughput * attenuation;
+        path.r = scattered;
+        path.bsdf_pdf = scattered_pdf;
+        return true;
+    }
+
+    // Orders paths by the octant of their direction, then by Morton cell of their
+    // origin, 16 cells a side over the bounds of all origins: a counting sort in
+    // two passes of eight bits over the bins.
+    static void sort_paths(std::vector<path_state>& paths, std::vector<uint32_t>& order, std::vector<path_state>& sorted) {
+        aabb origins;
+        for (const auto& path : paths)
+            origins = aabb(origins, aabb(path.r.origin(), path.r.origin()));
+
+        size_t n = paths.size();
+        std::vector<uint16_t> bins(n);
+        for (size_t k = 0; k < n; k++) {
+            const auto& r = paths[k].r;
+            unsigned octant = (r.direction().x() < 0) | (r.direction().y() < 0) << 1 | (r.direction().z() < 0) << 2;
+            bins[k] = static_cast<uint16_t>(octant << 12 | morton_code(r.origin(), origins) >> 18);
+        }
+
+        order.resize(2 * n);
+        uint32_t* from = order.data();
+        uint32_t* to = order.data() + n;
+        for (size_t k = 0; k < n; k++)
+            from[k] = static_cast<uint32_t>(k);
+        for (int shift : {0, 8}) {
+            size_t starts[257] = {};
+            for (size_t k = 0; k < n; k++)
+                starts[((bins[k] >> shift) & 0xff) + 1]++;
+            for (int b = 0; b < 256; b++)
+                starts[b + 1] += starts[b];
+            for (size_t k = 0; k < n; k++)
+                to[starts[(bins[from[k]] >> shift) & 0xff]++] = from[k];
+            std::swap(from, to);
+        }
+
+        sorted.resize(n);
+        for (size_t k = 0; k < n; k++)
+            sorted[k] = paths[from[k]];
+        paths.swap(sorted);
+    }
+
+    ray get_ray(int i, int j) const {
+        return (defocus_angle > 0) ? get_ray<true>(i, j) : get_ray<false>(i, j);
+    }
+
+    template <bool Defocus>
+    ray get_ray(int i, int j) const {
+        
+        auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
+        auto pixel_sample = pixel_center + pixel_sample_square();
+
+        auto ray_origin = Defocus ? defocus_disk_sample() : center;
+        auto ray_direction = pixel_sample - ray_origin;
+        auto ray_time = (shutter_close > shutter_open)
+                      ? random_double(shutter_open, shutter_close) : shutter_open;
+
+        return ray(ray_origin, ray_direction, ray_time);
+    }
+
+    point3 defocus_disk_sample() const {
+        
+        auto p = random_in_unit_disk();
+        return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
+    }
+
+    vec3 pixel_sample_square() const {
+        
+        auto px = -0.5 + random_double();
+        auto py = -0.5 + random_double();
+        return (px * pixel_delta_u) + (py * pixel_delta_v);
+    }
+
+    // One sample's radiance along r, in RGB or from a spectral path.
+    color trace(const ray& r, const hittable& world, const material_table& materials, pixel_features* aov = nullptr) const {
+        if (roulette_depth > 0)
+            return aov ? trace<true, true, true>(r, world, materials, aov) : trace<true, true, false>(r, world, materials, nullptr);
+        return aov ? trace<true, false, true>(r, world, materials, aov) : trace<true, false, false>(r, world, materials, nullptr);
+    }
+
+    // trace() for a scene without emissive materials unless Emissive, with Russian
+    // roulette if Roulette, and with aov given if Aov.
+    template <bool Emissive, bool Roulette, bool Aov>
+    color trace(const ray& r, const hittable& world, const material_table& materials, pixel_features* aov) const {
+        if (!spectral)
+            return ray_color<Emissive, Roulette, Aov>(r, max_depth, world, materials, color(1,1,1), 0, 0, aov);
+
+        auto lambda = sampled_wavelengths::sample_uniform(random_double());
+        return lambda.to_rgb(ray_spectrum(r, max_depth, world, materials, lambda, 0, 0, aov));
+    }
+
+    // bsdf_pdf is the density with which the previous bounce picked r, or 0 when that
+    // bounce was specular and r could not have been found by light sampling.
+    // aov, when given, receives the features of the ray's first hit and the part of
+    // its radiance that is direct light. vertex_emission, when given, receives the
+    // light emitted at or escaping past the ray's hit, which is direct light for the
+    // caller. Both are only looked at when Aov is set.
+    template <bool Emissive, bool Roulette, bool Aov>
+    color ray_color(const ray& r, int depth, const hittable& world, const material_table& materials, color current_attenuation, double cone_width, double bsdf_pdf, pixel_features* aov = nullptr, color* vertex_emission = nullptr) const {
+        
+        hit_record rec;
+        
+        if (depth <= 0)
+            return color(0,0,0);
+        
+        if (!world.hit(r, interval(0.001, infinity), rec)) {
+            auto escaped = background_color(r, bsdf_pdf);
+            if (Aov && aov) {
+                aov->albedo = color(fmin(escaped.x(), 1.0), fmin(escaped.y(), 1.0), fmin(escaped.z(), 1.0));
+                aov->direct = escaped;
+            }
+            if (Aov && vertex_emission)
+                *vertex_emission = escaped;
+            return escaped;
+        }
+
+        if (Aov && aov) {
+            aov->albedo = materials.albedo(rec.mat_id, rec);
+            aov->normal = rec.normal;
+            aov->depth = rec.t * r.direction().length();
+            aov->material_id = rec.mat_id;
+        }
+
+        // Grow the pixel's ray cone to the hit point so textures can pick a mip level.
+        cone_width += pixel_spread * rec.t * r.direction().length();
+        rec.footprint = cone_width * rec.uv_density;
+
+        ray scattered;
+        color attenuation;
+        color color_from_emission = Emissive ? materials.emitted(rec.mat_id, rec.u, rec.v, rec.p) : color(0,0,0);
+        if (Aov && vertex_emission)
+            *vertex_emission = color_from_emission;
+        if (Aov && aov)
+            aov->direct = color_from_emission;
+
+        if (!materials.scatter(rec.mat_id, r, rec, attenuation, scattered))
+            return color_from_emission;
+
+        
+        if (attenuation.length_squared() < 0.001)
+            return color_from_emission;
+
+        color f;
+        double scattered_pdf = 0;
+        if (environment && materials.evaluate(rec.mat_id, rec, scattered.direction(), f, scattered_pdf))
+            color_from_emission += sample_environment(r, rec, world, materials);
+
+        if constexpr (Roulette) {
+            if (max_depth - depth >= roulette_depth) {
+                auto throughput = current_attenuation * attenuation;
+                auto survival = fmin(fmax(throughput.x(), fmax(throughput.y(), throughput.z())), 0.95);
+                if (random_double() >= survival)
+                    return color_from_emission;
+                attenuation /= survival;
+            }
+        }
+
+        color next_emission(0,0,0);
+        color color_from_scatter = attenuation * ray_color<Emissive, Roulette, Aov>(scattered, depth-1, world, materials, current_attenuation * attenuation, cone_width, scattered_pdf,
+                                                                                    nullptr, (Aov && aov) ? &next_emission : nullptr);
+        if (Aov && aov)
+            aov->direct = color_from_emission + attenuation * next_emission;
+
+        return color_from_emission + color_from_scatter;
+    }
+
+    // ray_color at the wavelengths of lambda. RGB colors of materials and lights are
+    // upsampled to spectra; the first dispersive surface on the path refracts the hero
+    // wavelength and terminates the others. aov receives the first hit's features,
+    // with only the light emitted there counted as direct.
+    sampled_spectrum ray_spectrum(const ray& r, int depth, const hittable& world, const material_table& materials,
+                                  sampled_wavelengths& lambda, double cone_width, double bsdf_pdf, pixel_features* aov = nullptr) const {
+        hit_record rec;
+
+        if (depth <= 0)
+            return sampled_spectrum(0);
+
+        if (!world.hit(r, interval(0.001, infinity), rec)) {
+            auto escaped = background_color(r, bsdf_pdf);
+            if (aov) {
+                aov->albedo = color(fmin(escaped.x(), 1.0), fmin(escaped.y(), 1.0), fmin(escaped.z(), 1.0));
+                aov->direct = escaped;
+            }
+            return lambda.upsample(escaped);
+        }
+
+        if (aov) {
+            aov->albedo = materials.albedo(rec.mat_id, rec);
+            aov->normal = rec.normal;
+            aov->depth = rec.t * r.direction().length();
+            aov->material_id = rec.mat_id;
+        }
+
+        cone_width += pixel_spread * rec.t * r.direction().length();
+        rec.footprint = cone_width * rec.uv_density;
+
+        color emitted = materials.emitted(rec.mat_id, rec.u, rec.v, rec.p);
+        if (aov)
+            aov->direct = emitted;
+        auto spectrum_from_emission = lambda.upsample(emitted);
+
+        if (materials.dispersive(rec.mat_id))
+            lambda.terminate_secondary();
+
+        ray scattered;
+        color attenuation;
+        if (!materials.scatter(rec.mat_id, r, rec, lambda.hero(), attenuation, scattered))
+            return spectrum_from_emission;
+
+        if (attenuation.length_squared() < 0.001)
+            return spectrum_from_emission;
+
+        color f;
+        double scattered_pdf = 0;
+        if (environment && materials.evaluate(rec.mat_id, rec, scattered.direction(), f, scattered_pdf)) {
+            color light;
+            auto weight = environment_light(r, rec, world, materials, f, light);
+            if (weight > 0)
+                spectrum_from_emission += lambda.upsample(f) * lambda.upsample(light) * weight;
+        }
+
+        return spectrum_from_emission + lambda.upsample(attenuation)
+             * ray_spectrum(scattered, depth-1, world, materials, lambda, cone_width, scattered_pdf);
+    }
+
+    static double power_heuristic(double pdf, double other_pdf) {
+        auto a = pdf * pdf;
+        auto b = other_pdf * other_pdf;
+        return (a + b > 0) ? a / (a + b) : 0;
+    }
+
+    color background_color(const ray& r, double bsdf_pdf) const {
+        if (!environment)
+            return background;
+
+        color emitted = environment->value(r.direction());
+        if (bsdf_pdf <= 0)
+            return emitted;
+        return power_heuristic(bsdf_pdf, environment->pdf(r.direction())) * emitted;
+    }
+
+    // Next event estimation towards the environment, weighted against the BSDF
+    // sampled ray that may escape to the same direction.
+    color sample_environment(const ray& r, const hit_record& rec, const hittable& world, const material_table& materials) const {
+        color f, emitted;
+        auto weight = environment_light(r, rec, world, materials, f, emitted);
+        if (weight <= 0)
+            return color(0,0,0);
+        return f * emitted * weight;
+    }
+
+    // Samples a direction towards the environment, setting the BSDF and the light
+    // for it; the estimate is their product times the returned weight, which is
+    // zero when the light is not seen.
+    double environment_light(const ray& r, const hit_record& rec, const hittable& world, const material_table& materials,
+                             color& f, color& emitted) const {
+        vec3 direction;
+        double light_pdf;
+        emitted = environment->sample(random_double(), random_double(), direction, light_pdf);
+        if (light_pdf <= 0)
+            return 0;
+
+        double bsdf_pdf = 0;
+        materials.evaluate(rec.mat_id, rec, direction, f, bsdf_pdf);
+        if (bsdf_pdf <= 0)
+            return 0;
+
+        hit_record occluder;
+        if (world.hit(ray(rec.p, direction, r.time()), interval(0.001, infinity), occluder))
+            return 0;
+
+        return power_heuristic(light_pdf, bsdf_pdf) / light_pdf;
+    }
+};
+
 #endif
\ No newline at end of file
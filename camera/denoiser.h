@@ -0,0 +1,160 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "./../headers/color.h"
+#include "./../headers/common.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <vector>
+
+// Edge-avoiding a-trous wavelet filter in the style of SVGF. Illumination is
+// separated from albedo so texture detail survives, then smoothed by a few passes
+// of a 5x5 kernel with doubling step size. Each tap is weighted by how closely its
+// normal, depth and albedo match the center pixel and by how far its luminance is
+// from the center's relative to the estimated noise there.
+class denoiser {
+  public:
+    int    iterations = 5;
+    double sigma_luminance = 4.0;
+    double sigma_normal = 128.0;
+    double sigma_depth = 1.0;
+    double sigma_albedo = 0.1;
+
+    // image holds per-pixel sums of samples_per_pixel samples, as rendered; so does
+    // the returned image.
+    std::vector<color> apply(const std::vector<color>& image, const std::vector<pixel_features>& features,
+                             int width, int height, int samples_per_pixel) const {
+        size_t count = size_t(width) * height;
+        std::vector<color> illumination(count);
+        std::vector<double> variance(count);
+        std::vector<double> depth_gradient(count);
+
+        for (size_t i = 0; i < count; i++) {
+            auto albedo = demodulation(features[i].albedo);
+            auto mean = image[i] / samples_per_pixel;
+            illumination[i] = color(mean.x() / albedo.x(), mean.y() / albedo.y(), mean.z() / albedo.z());
+            auto scale = luminance(albedo);
+            variance[i] = features[i].variance / (scale * scale);
+        }
+
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                auto z = features[index(x, y, width)].depth;
+                auto dx = fabs(features[index(std::min(x + 1, width - 1), y, width)].depth - z);
+                auto dy = fabs(features[index(x, std::min(y + 1, height - 1), width)].depth - z);
+                depth_gradient[index(x, y, width)] = std::max(dx, dy);
+            }
+        }
+
+        std::vector<color> next_illumination(count);
+        std::vector<double> next_variance(count);
+        for (int level = 0; level < iterations; level++) {
+            int step = 1 << level;
+            auto filtered_variance = blur_variance(variance, width, height);
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    filter_pixel(x, y, step, width, height, illumination, variance, filtered_variance,
+                                 depth_gradient, features, next_illumination, next_variance);
+                }
+            }
+            std::swap(illumination, next_illumination);
+            std::swap(variance, next_variance);
+        }
+
+        std::vector<color> result(count);
+        for (size_t i = 0; i < count; i++)
+            result[i] = illumination[i] * demodulation(features[i].albedo) * samples_per_pixel;
+        return result;
+    }
+
+  private:
+    static constexpr double kernel[3] = {3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};
+
+    static size_t index(int x, int y, int width) { return size_t(y) * width + x; }
+
+    static double luminance(const color& c) {
+        return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+    }
+
+    // Black albedo would divide by zero and lose the lighting; treat it as grey.
+    static color demodulation(const color& albedo) {
+        const double floor = 0.01;
+        return color(std::max(albedo.x(), floor), std::max(albedo.y(), floor), std::max(albedo.z(), floor));
+    }
+
+    static std::vector<double> blur_variance(const std::vector<double>& variance, int width, int height) {
+        std::vector<double> blurred(variance.size());
+        const double weights[2] = {0.5, 0.25};
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                double sum = 0, total = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int qx = x + dx, qy = y + dy;
+                        if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                            continue;
+                        auto w = weights[abs(dx)] * weights[abs(dy)];
+                        sum += w * variance[index(qx, qy, width)];
+                        total += w;
+                    }
+                }
+                blurred[index(x, y, width)] = sum / total;
+            }
+        }
+        return blurred;
+    }
+
+    void filter_pixel(int x, int y, int step, int width, int height,
+                      const std::vector<color>& illumination, const std::vector<double>& variance,
+                      const std::vector<double>& filtered_variance, const std::vector<double>& depth_gradient,
+                      const std::vector<pixel_features>& features,
+                      std::vector<color>& out_illumination, std::vector<double>& out_variance) const {
+        auto p = index(x, y, width);
+        const auto& center = features[p];
+        auto center_luminance = luminance(illumination[p]);
+        auto luminance_scale = sigma_luminance * sqrt(std::max(filtered_variance[p], 0.0)) + 1e-6;
+        bool center_hit = center.normal.length_squared() > 0;
+
+        color sum(0,0,0);
+        double sum_variance = 0;
+        double total = 0;
+
+        for (int dy = -2; dy <= 2; dy++) {
+            for (int dx = -2; dx <= 2; dx++) {
+                int qx = x + dx * step, qy = y + dy * step;
+                if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                    continue;
+
+                auto q = index(qx, qy, width);
+                const auto& other = features[q];
+                double w = kernel[abs(dx)] * kernel[abs(dy)];
+
+                if (q != p) {
+                    bool other_hit = other.normal.length_squared() > 0;
+                    if (center_hit != other_hit)
+                        continue;
+
+                    if (center_hit) {
+                        w *= pow(std::max(0.0, dot(center.normal, other.normal)), sigma_normal);
+                        auto distance = step * sqrt(double(dx * dx + dy * dy));
+                        w *= exp(-fabs(center.depth - other.depth) / (sigma_depth * depth_gradient[p] * distance + 1e-6));
+                    }
+                    w *= exp(-(center.albedo - other.albedo).length_squared() / (sigma_albedo * sigma_albedo));
+                    w *= exp(-fabs(center_luminance - luminance(illumination[q])) / luminance_scale);
+                }
+
+                sum += w * illumination[q];
+                sum_variance += w * w * variance[q];
+                total += w;
+            }
+        }
+
+        out_illumination[p] = sum / total;
+        out_variance[p] = sum_variance / (total * total);
+    }
+};
+
+#endif
@@ -0,0 +1,425 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "camera.h"
+#include "./../headers/bvh.h"
+#include "./../headers/hittable_list.h"
+#include "./../material/material.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Coordinator/worker rendering over TCP. The coordinator sends each worker a job
+// payload describing the scene, hands out tiles and merges the returned pixels,
+// and their features when the camera wants them, into its framebuffer. Pixels seed their own random streams, so the merged image
+// is identical to a single process render however tiles end up distributed.
+//
+// Every message is a {type, length} header followed by length bytes of body.
+// Bodies are in host byte order, so all processes must share an architecture.
+
+enum render_message : uint32_t { job_message = 1, tile_message, result_message, done_message };
+
+struct render_tile_request {
+    int32_t id, x0, y0, x1, y1;
+};
+
+inline bool send_all(int fd, const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        auto sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void* data, size_t size) {
+    auto bytes = static_cast<char*>(data);
+    while (size > 0) {
+        auto received = recv(fd, bytes, size, 0);
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+inline bool send_message(int fd, uint32_t type, const void* body, uint32_t size) {
+    uint32_t header[2] = {type, size};
+    return send_all(fd, header, sizeof(header)) && send_all(fd, body, size);
+}
+
+inline bool recv_message(int fd, uint32_t& type, std::vector<char>& body) {
+    uint32_t header[2];
+    if (!recv_all(fd, header, sizeof(header)))
+        return false;
+    type = header[0];
+    body.resize(header[1]);
+    return recv_all(fd, body.data(), body.size());
+}
+
+inline std::string pack_strings(const std::vector<std::string>& strings) {
+    std::string packed;
+    for (const auto& s : strings) {
+        uint32_t size = static_cast<uint32_t>(s.size());
+        packed.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        packed.append(s);
+    }
+    return packed;
+}
+
+inline std::vector<std::string> unpack_strings(const std::string& packed) {
+    std::vector<std::string> strings;
+    size_t offset = 0;
+    while (offset + sizeof(uint32_t) <= packed.size()) {
+        uint32_t size;
+        std::memcpy(&size, &packed[offset], sizeof(size));
+        offset += sizeof(size);
+        strings.push_back(packed.substr(offset, size));
+        offset += size;
+    }
+    return strings;
+}
+
+class render_coordinator {
+  public:
+    // Rendering falls back to this process once no worker has been connected for
+    // this many seconds.
+    double fallback_seconds = 10;
+
+    // A worker that has not returned a tile this many seconds after it was sent is
+    // taken to be hung: it is dropped and its tiles are handed out again.
+    double tile_seconds = 300;
+
+    // Port 0 picks a free port, see port().
+    render_coordinator(int port) {
+        listen_fd = socket(AF_INET6, SOCK_STREAM, 0);
+        int off = 0, on = 1;
+        setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in6 address{};
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_any;
+        address.sin6_port = htons(static_cast<uint16_t>(port));
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listen_fd, 64) < 0) {
+            std::cerr << "Error: Cannot listen on port " << port << "." << std::endl;
+            close(listen_fd);
+            listen_fd = -1;
+        }
+    }
+
+    ~render_coordinator() {
+        if (listen_fd >= 0)
+            close(listen_fd);
+    }
+
+    bool listening() const { return listen_fd >= 0; }
+
+    int port() const {
+        sockaddr_in6 address{};
+        socklen_t size = sizeof(address);
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &size);
+        return ntohs(address.sin6_port);
+    }
+
+    // Renders the window of cam on whichever workers connect, sending each the
+    // payload first. Tiles held by a worker that disconnects are handed to another.
+    // When cam wants features the workers return them too, gathered into features.
+    std::vector<color> render(camera& cam, const hittable& world, const material_table& materials,
+                              const std::string& payload, int tile_size = 32,
+                              std::vector<pixel_features>* features = nullptr) {
+        cam.initialize();
+        int left = cam.window_x(), top = cam.window_y();
+        int width = cam.window_width();
+        int height = cam.window_height();
+        std::vector<color> image(size_t(width) * height);
+        std::vector<pixel_features> feature_image(cam.wants_features() ? image.size() : 0);
+        auto pixel = [&](int x, int y) { return &image[size_t(y - top) * width + (x - left)]; };
+        auto feature = [&](int x, int y) {
+            return feature_image.empty() ? nullptr : &feature_image[size_t(y - top) * width + (x - left)];
+        };
+        size_t pixel_bytes = sizeof(color) + (feature_image.empty() ? 0 : sizeof(pixel_features));
+
+        std::vector<render_tile_request> tiles;
+        std::deque<int> pending;
+        for (int y = top; y < top + height; y += tile_size) {
+            for (int x = left; x < left + width; x += tile_size) {
+                int id = static_cast<int>(tiles.size());
+                tiles.push_back({id, x, y, std::min(x + tile_size, left + width), std::min(y + tile_size, top + height)});
+                pending.push_back(id);
+            }
+        }
+
+        using clock = std::chrono::steady_clock;
+        struct in_flight {
+            int id;
+            clock::time_point deadline;
+        };
+        struct worker {
+            int fd;
+            std::vector<in_flight> outstanding;
+            std::vector<char> inbox;    // Bytes of replies not yet complete
+        };
+        std::vector<worker> workers;
+
+        auto drop = [&](size_t index, const char* reason) {
+            for (const auto& tile : workers[index].outstanding)
+                pending.push_front(tile.id);
+            close(workers[index].fd);
+            workers.erase(workers.begin() + index);
+            std::clog << "\nWorker " << reason << ", " << pending.size() << " tiles requeued." << std::endl;
+        };
+
+        size_t remaining = tiles.size();
+        auto idle_since = clock::now();
+        size_t largest_reply = sizeof(int32_t) + size_t(tile_size) * tile_size * pixel_bytes;
+        std::vector<char> chunk(1 << 16);
+
+        while (remaining > 0) {
+            // Keep two tiles in flight per worker so none waits on a round trip.
+            for (size_t w = 0; w < workers.size(); w++) {
+                while (workers[w].outstanding.size() < 2 && !pending.empty()) {
+                    int id = pending.front();
+                    if (!send_message(workers[w].fd, tile_message, &tiles[id], sizeof(render_tile_request))) {
+                        drop(w--, "lost");
+                        break;
+                    }
+                    pending.pop_front();
+                    auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(tile_seconds));
+                    workers[w].outstanding.push_back({id, deadline});
+                }
+            }
+
+            if (workers.empty()) {
+                auto idle = std::chrono::duration<double>(clock::now() - idle_since).count();
+                if (listen_fd < 0 || idle >= fallback_seconds) {
+                    std::clog << "\nNo workers available, rendering " << pending.size() << " tiles locally." << std::endl;
+                    for (int id : pending) {
+                        const auto& t = tiles[id];
+                        cam.render_region(world, materials, t.x0, t.y0, t.x1, t.y1, pixel(t.x0, t.y0), width, feature(t.x0, t.y0));
+                    }
+                    pending.clear();
+                    break;
+                }
+            }
+
+            std::vector<pollfd> fds;
+            fds.push_back({listen_fd, POLLIN, 0});
+            for (const auto& w : workers)
+                fds.push_back({w.fd, POLLIN, 0});
+            int ready = poll(fds.data(), fds.size(), 100);
+
+            auto now = clock::now();
+            for (size_t w = workers.size(); w-- > 0;) {
+                const auto& outstanding = workers[w].outstanding;
+                bool late = std::any_of(outstanding.begin(), outstanding.end(),
+                                        [&](const in_flight& tile) { return tile.deadline < now; });
+                if (late) {
+                    drop(w, "timed out");
+                    fds.erase(fds.begin() + w + 1);
+                }
+            }
+            if (ready <= 0)
+                continue;
+
+            // Replies are read as they arrive, without blocking, so a worker stalling
+            // halfway through one still runs into its deadline.
+            for (size_t w = workers.size(); w-- > 0;) {
+                if (!(fds[w + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+                    continue;
+                auto& inbox = workers[w].inbox;
+                auto received = recv(workers[w].fd, chunk.data(), chunk.size(), MSG_DONTWAIT);
+                if (received <= 0 && !(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+                    drop(w, "lost");
+                    continue;
+                }
+                if (received > 0)
+                    inbox.insert(inbox.end(), chunk.data(), chunk.data() + received);
+
+                bool malformed = false;
+                size_t used = 0;
+                while (inbox.size() - used >= 2 * sizeof(uint32_t)) {
+                    uint32_t header[2];
+                    std::memcpy(header, inbox.data() + used, sizeof(header));
+                    if (header[0] != result_message || header[1] > largest_reply) {
+                        malformed = true;
+                        break;
+                    }
+                    if (inbox.size() - used < sizeof(header) + header[1])
+                        break;
+                    const char* body = inbox.data() + used + sizeof(header);
+                    used += sizeof(header) + header[1];
+
+                    // A reply must name a tile and hold exactly its pixels.
+                    int32_t id = -1;
+                    if (header[1] >= sizeof(id))
+                        std::memcpy(&id, body, sizeof(id));
+                    if (id < 0 || id >= static_cast<int32_t>(tiles.size())
+                        || header[1] != sizeof(id) + tile_pixels(tiles[id]) * pixel_bytes) {
+                        malformed = true;
+                        break;
+                    }
+
+                    auto& outstanding = workers[w].outstanding;
+                    auto it = std::find_if(outstanding.begin(), outstanding.end(), [&](const in_flight& tile) { return tile.id == id; });
+                    if (it == outstanding.end())
+                        continue;
+                    outstanding.erase(it);
+
+                    const auto& t = tiles[id];
+                    const char* pixels = body + sizeof(id);
+                    size_t row = size_t(t.x1 - t.x0);
+                    for (int y = t.y0; y < t.y1; y++)
+                        std::memcpy(pixel(t.x0, y), pixels + (y - t.y0) * row * sizeof(color), row * sizeof(color));
+                    if (!feature_image.empty()) {
+                        const char* tile_features = pixels + tile_pixels(t) * sizeof(color);
+                        for (int y = t.y0; y < t.y1; y++)
+                            std::memcpy(feature(t.x0, y), tile_features + (y - t.y0) * row * sizeof(pixel_features),
+                                        row * sizeof(pixel_features));
+                    }
+
+                    remaining--;
+                    std::stringstream ss;
+                    ss << "\rReceived " << (tiles.size() - remaining) << " out of " << tiles.size() << " tiles.";
+                    std::clog << ss.str() << std::flush;
+                }
+                if (malformed)
+                    drop(w, "lost");
+                else
+                    inbox.erase(inbox.begin(), inbox.begin() + used);
+            }
+
+            if (fds[0].revents & POLLIN) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if (fd >= 0 && send_message(fd, job_message, payload.data(), static_cast<uint32_t>(payload.size())))
+                    workers.push_back({fd, {}, {}});
+                else if (fd >= 0)
+                    close(fd);
+            }
+
+            if (!workers.empty())
+                idle_since = clock::now();
+        }
+        std::clog << std::endl;
+
+        for (const auto& w : workers) {
+            send_message(w.fd, done_message, nullptr, 0);
+            close(w.fd);
+        }
+        if (features)
+            *features = std::move(feature_image);
+        return image;
+    }
+
+  private:
+    int listen_fd;
+
+    static size_t tile_pixels(const render_tile_request& t) { return size_t(t.x1 - t.x0) * (t.y1 - t.y0); }
+};
+
+using render_scene_loader = std::function<bool(const std::string& payload, camera& cam, hittable_list& world, material_table& materials)>;
+
+// Connects to a coordinator, builds the scene from its payload with load_scene and
+// renders tiles until told to stop. Returns a process exit status.
+inline int run_render_worker(const std::string& host, int port, const render_scene_loader& load_scene) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+        std::cerr << "Error: Cannot resolve coordinator '" << host << "'." << std::endl;
+        return 1;
+    }
+
+    // The coordinator may still be loading its scene, so retry for a few seconds.
+    int fd = -1;
+    for (int attempt = 0; attempt < 50 && fd < 0; attempt++) {
+        for (auto a = addresses; a && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (fd < 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        std::cerr << "Error: Cannot connect to coordinator " << host << ":" << port << "." << std::endl;
+        return 1;
+    }
+
+    uint32_t type;
+    std::vector<char> body;
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    if (!recv_message(fd, type, body) || type != job_message
+        || !load_scene(std::string(body.begin(), body.end()), cam, world, materials)) {
+        close(fd);
+        return 1;
+    }
+    cam.initialize();
+
+    shared_ptr<hittable> scene = make_shared<hittable_list>(world);
+    if (!world.objects.empty())
+        scene = make_shared<bvh_node>(world, cam.shutter_open, cam.shutter_close);
+
+    int status = 0;
+    std::vector<color> pixels;
+    std::vector<pixel_features> features;
+    std::vector<char> result;
+    while (recv_message(fd, type, body) && type == tile_message) {
+        render_tile_request t{};
+        if (body.size() == sizeof(t))
+            std::memcpy(&t, body.data(), sizeof(t));
+        if (body.size() != sizeof(t) || t.x0 < cam.window_x() || t.y0 < cam.window_y() || t.x0 >= t.x1 || t.y0 >= t.y1
+            || t.x1 > cam.window_x() + cam.window_width() || t.y1 > cam.window_y() + cam.window_height()) {
+            std::cerr << "Error: Malformed tile request from coordinator." << std::endl;
+            status = 1;
+            break;
+        }
+
+        int w = t.x1 - t.x0;
+        int h = t.y1 - t.y0;
+        pixels.resize(size_t(w) * h);
+        features.resize(cam.wants_features() ? pixels.size() : 0);
+        cam.render_region(*scene, materials, t.x0, t.y0, t.x1, t.y1, pixels.data(), w,
+                          features.empty() ? nullptr : features.data());
+
+        size_t color_bytes = pixels.size() * sizeof(color);
+        result.resize(sizeof(int32_t) + color_bytes + features.size() * sizeof(pixel_features));
+        std::memcpy(result.data(), &t.id, sizeof(t.id));
+        std::memcpy(result.data() + sizeof(int32_t), pixels.data(), color_bytes);
+        if (!features.empty())
+            std::memcpy(result.data() + sizeof(int32_t) + color_bytes, features.data(), features.size() * sizeof(pixel_features));
+
+        if (!send_message(fd, result_message, result.data(), static_cast<uint32_t>(result.size())))
+            break;
+    }
+
+    close(fd);
+    return status;
+}
+
+#endif
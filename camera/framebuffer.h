@@ -0,0 +1,222 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "./../headers/color.h"
+#include "./../headers/common.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+// Per-pixel values gathered alongside the beauty image, averaged over the pixel's
+// samples unless noted. Only doubles, so every channel sits at a fixed offset.
+struct pixel_features {
+    color  beauty;
+    color  direct;          // Emission and light reaching the camera after one bounce
+    color  indirect;        // beauty - direct
+    color  albedo;          // At the first hit
+    vec3   normal;          // At the first hit, zero when every sample escaped
+    double depth = 0;       // Distance to the first hit
+    double variance = 0;    // Variance of the mean luminance
+    double material_id = -1;// Seen by the pixel's first sample, -1 when it escaped
+    double sample_count = 0;
+    double time = 0;        // Mean ray time
+};
+
+// Framebuffer channel names and where each one is read from in pixel_features.
+struct feature_channel {
+    const char* name;
+    size_t      offset;
+};
+
+inline const std::vector<feature_channel>& feature_channels() {
+    static const std::vector<feature_channel> channels = {
+        {"R", offsetof(pixel_features, beauty)},
+        {"G", offsetof(pixel_features, beauty) + sizeof(double)},
+        {"B", offsetof(pixel_features, beauty) + 2 * sizeof(double)},
+        {"direct.R", offsetof(pixel_features, direct)},
+        {"direct.G", offsetof(pixel_features, direct) + sizeof(double)},
+        {"direct.B", offsetof(pixel_features, direct) + 2 * sizeof(double)},
+        {"indirect.R", offsetof(pixel_features, indirect)},
+        {"indirect.G", offsetof(pixel_features, indirect) + sizeof(double)},
+        {"indirect.B", offsetof(pixel_features, indirect) + 2 * sizeof(double)},
+        {"albedo.R", offsetof(pixel_features, albedo)},
+        {"albedo.G", offsetof(pixel_features, albedo) + sizeof(double)},
+        {"albedo.B", offsetof(pixel_features, albedo) + 2 * sizeof(double)},
+        {"N.X", offsetof(pixel_features, normal)},
+        {"N.Y", offsetof(pixel_features, normal) + sizeof(double)},
+        {"N.Z", offsetof(pixel_features, normal) + 2 * sizeof(double)},
+        {"Z", offsetof(pixel_features, depth)},
+        {"variance", offsetof(pixel_features, variance)},
+        {"material_id", offsetof(pixel_features, material_id)},
+        {"sample_count", offsetof(pixel_features, sample_count)},
+        {"time", offsetof(pixel_features, time)},
+    };
+    return channels;
+}
+
+// Named planes of floats, one per channel, each width*height values row by row.
+class framebuffer {
+  public:
+    framebuffer(int _width, int _height)
+      : image_width(_width), image_height(_height), display_width(_width), display_height(_height) {}
+
+    // Places the buffer at (x, y) within a larger frame, for partial renders.
+    void set_display_window(int x, int y, int width, int height) {
+        origin_x = x;
+        origin_y = y;
+        display_width = width;
+        display_height = height;
+    }
+
+    int width() const  { return image_width; }
+    int height() const { return image_height; }
+    int channel_count() const { return static_cast<int>(names.size()); }
+
+    // Returns the index of the named channel, adding a zeroed one if it is new.
+    int add_channel(const std::string& name) {
+        int index = find(name);
+        if (index >= 0)
+            return index;
+        names.push_back(name);
+        planes.emplace_back(size_t(image_width) * image_height, 0.0f);
+        return channel_count() - 1;
+    }
+
+    int find(const std::string& name) const {
+        auto it = std::find(names.begin(), names.end(), name);
+        return (it == names.end()) ? -1 : static_cast<int>(it - names.begin());
+    }
+
+    const std::string& name(int index) const { return names[index]; }
+    float* channel(int index)                { return planes[index].data(); }
+    const float* channel(int index) const    { return planes[index].data(); }
+
+    // Copies every feature channel out of a pixel_features image, one plane at a time.
+    void store(const std::vector<pixel_features>& features) {
+        for (const auto& source : feature_channels()) {
+            float* plane = channel(add_channel(source.name));
+            auto bytes = reinterpret_cast<const char*>(features.data()) + source.offset;
+            for (size_t i = 0; i < features.size(); i++)
+                plane[i] = static_cast<float>(*reinterpret_cast<const double*>(bytes + i * sizeof(pixel_features)));
+        }
+    }
+
+    // Writes all channels to an uncompressed scanline OpenEXR file with 32-bit
+    // float samples.
+    void write_exr(std::ostream& out) const {
+        std::vector<int> order(names.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return names[a] < names[b]; });
+
+        std::string header;
+        put_int(header, 20000630);
+        put_int(header, 2);
+
+        std::string channels;
+        for (int c : order) {
+            channels += names[c];
+            channels += '\0';
+            put_int(channels, 2);           // FLOAT
+            channels.append(4, '\0');       // pLinear and reserved
+            put_int(channels, 1);           // x sampling
+            put_int(channels, 1);           // y sampling
+        }
+        channels += '\0';
+        put_attribute(header, "channels", "chlist", channels);
+
+        put_attribute(header, "compression", "compression", std::string(1, '\0'));
+
+        std::string data_window;
+        put_int(data_window, origin_x);
+        put_int(data_window, origin_y);
+        put_int(data_window, origin_x + image_width - 1);
+        put_int(data_window, origin_y + image_height - 1);
+        put_attribute(header, "dataWindow", "box2i", data_window);
+
+        std::string display_window;
+        put_int(display_window, 0);
+        put_int(display_window, 0);
+        put_int(display_window, display_width - 1);
+        put_int(display_window, display_height - 1);
+        put_attribute(header, "displayWindow", "box2i", display_window);
+
+        put_attribute(header, "lineOrder", "lineOrder", std::string(1, '\0'));
+
+        std::string one;
+        put_float(one, 1.0f);
+        put_attribute(header, "pixelAspectRatio", "float", one);
+
+        std::string center;
+        put_float(center, 0.0f);
+        put_float(center, 0.0f);
+        put_attribute(header, "screenWindowCenter", "v2f", center);
+        put_attribute(header, "screenWindowWidth", "float", one);
+        header += '\0';
+
+        // One scanline per chunk; the offset table points at each from the file start.
+        uint64_t line_size = uint64_t(image_width) * names.size() * sizeof(float);
+        uint64_t first_line = header.size() + uint64_t(image_height) * sizeof(uint64_t);
+        for (int y = 0; y < image_height; y++)
+            put_uint64(header, first_line + uint64_t(y) * (line_size + 2 * sizeof(int32_t)));
+        out.write(header.data(), header.size());
+
+        std::string line;
+        for (int y = 0; y < image_height; y++) {
+            line.clear();
+            put_int(line, origin_y + y);
+            put_int(line, static_cast<int32_t>(line_size));
+            for (int c : order) {
+                const float* row = &planes[c][size_t(y) * image_width];
+                for (int x = 0; x < image_width; x++)
+                    put_float(line, row[x]);
+            }
+            out.write(line.data(), line.size());
+        }
+    }
+
+  private:
+    int image_width;
+    int image_height;
+    int origin_x = 0;
+    int origin_y = 0;
+    int display_width;
+    int display_height;
+    std::vector<std::string> names;
+    std::vector<std::vector<float>> planes;
+
+    // OpenEXR is little-endian regardless of the host.
+    static void put_uint32(std::string& out, uint32_t value) {
+        for (int i = 0; i < 4; i++)
+            out += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+
+    static void put_int(std::string& out, int32_t value) { put_uint32(out, static_cast<uint32_t>(value)); }
+
+    static void put_uint64(std::string& out, uint64_t value) {
+        put_uint32(out, static_cast<uint32_t>(value));
+        put_uint32(out, static_cast<uint32_t>(value >> 32));
+    }
+
+    static void put_float(std::string& out, float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put_uint32(out, bits);
+    }
+
+    static void put_attribute(std::string& out, const char* name, const char* type, const std::string& value) {
+        out += name;
+        out += '\0';
+        out += type;
+        out += '\0';
+        put_int(out, static_cast<int32_t>(value.size()));
+        out += value;
+    }
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include "camera.h"
+
+#include <algorithm>
+#include <vector>
+
+// Renders a camera's window in passes that are each quick to show. The first passes
+// take one sample per block of pixels, halving the block size from coarsest_block
+// down to 2; the rest add samples at full resolution, doubling the count each pass
+// until samples_per_pixel. step() renders a slice of roughly step_samples samples,
+// so callers can show the frame or drop the render between any two steps.
+class progressive_render {
+  public:
+    progressive_render(const camera& _cam, int coarsest_block = 8, int _step_samples = 1 << 16)
+      : cam(_cam), step_samples(std::max(1, _step_samples)) {
+        cam.initialize();
+        width = cam.window_width();
+        height = cam.window_height();
+        display.assign(size_t(width) * height, color(0,0,0));
+        sums.assign(display.size(), color(0,0,0));
+
+        for (int block = coarsest_block; block > 1; block /= 2)
+            passes.push_back({block, 0, 1});
+        for (int first = 0; first < cam.samples_per_pixel; ) {
+            int count = std::min(std::max(first, 1), cam.samples_per_pixel - first);
+            passes.push_back({1, first, count});
+            first += count;
+        }
+    }
+
+    bool done() const { return pass >= passes.size(); }
+
+    // Samples per pixel that every row has reached; 0 while blocks are still shown.
+    int samples() const {
+        if (done())
+            return cam.samples_per_pixel;
+        return (passes[pass].block > 1) ? 0 : passes[pass].first_sample;
+    }
+
+    const camera& view() const { return cam; }
+
+    // Mean colors of the window, the blocks of coarse passes filled with one sample.
+    const std::vector<color>& frame() const { return display; }
+
+    // Summed samples of the window, as render_region gives them once done().
+    const std::vector<color>& image() const { return sums; }
+
+    void step(const hittable& world, const material_table& materials) {
+        if (done())
+            return;
+
+        const auto& current = passes[pass];
+        int x0 = cam.window_x(), y0 = cam.window_y();
+        int blocks_x = (width + current.block - 1) / current.block;
+        long long row_cost = (long long)blocks_x * current.samples;
+        int rows = current.block * int(std::max(1LL, step_samples / std::max(1LL, row_cost)));
+        int end = std::min(height, row + rows);
+
+        if (current.block > 1) {
+            int blocks_y = (end - row + current.block - 1) / current.block;
+            #pragma omp parallel for schedule(dynamic) num_threads(cam.threads)
+            for (int b = 0; b < blocks_y * blocks_x; b++) {
+                int bx = (b % blocks_x) * current.block, by = row + (b / blocks_x) * current.block;
+                int cx = std::min(bx + current.block / 2, width - 1), cy = std::min(by + current.block / 2, height - 1);
+                auto c = cam.sample_pixel(world, materials, x0 + cx, y0 + cy, 0);
+                for (int j = by; j < std::min(by + current.block, height); j++)
+                    for (int i = bx; i < std::min(bx + current.block, width); i++)
+                        display[size_t(j) * width + i] = c;
+            }
+        } else {
+            cam.accumulate_region(world, materials, x0, y0 + row, x0 + width, y0 + end,
+                                  current.first_sample, current.samples, &sums[size_t(row) * width], width);
+            double n = current.first_sample + current.samples;
+            for (size_t i = size_t(row) * width; i < size_t(end) * width; i++)
+                display[i] = sums[i] / n;
+        }
+
+        row = end;
+        if (row >= height) {
+            row = 0;
+            pass++;
+        }
+    }
+
+  private:
+    struct render_pass {
+        int block;          // Side of the pixel blocks sharing one sample; 1 at full resolution
+        int first_sample;
+        int samples;
+    };
+
+    camera cam;
+    long long step_samples;
+    int width, height;
+    std::vector<render_pass> passes;
+    size_t pass = 0;
+    int row = 0;                   // Next row of the current pass
+    std::vector<color> display;
+    std::vector<color> sums;
+};
+
+#endif
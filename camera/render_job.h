@@ -0,0 +1,170 @@
+#ifndef RENDER_JOB_H
+#define RENDER_JOB_H
+
+#include "camera.h"
+#include "./../headers/thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// A render running in the background on a shared work_stealing_pool, so it can be
+// embedded, watched, cancelled and overlapped with other renders on the same pool.
+// The job renders the camera's tiles, as render() does, with every tile a pool
+// task: the tile range is halved recursively, leaving the halves to be stolen by
+// idle workers, so concurrent jobs share the threads. Callbacks run on pool
+// threads, one at a time per job, and must not throw.
+//
+//   work_stealing_pool pool;
+//   auto job = render_job::start(pool, cam, world, materials, callbacks);
+//   ...
+//   job->cancel();                       // optional; tiles not yet begun are skipped
+//   if (job->wait() == render_job::finished)
+//       job->write(out);
+
+// A finished tile, in window pixels, and how far the job has got.
+struct tile_event {
+    camera::tile_rect rect;
+    const color* pixels;        // Summed samples of the tile's top left pixel
+    int stride;                 // Pixels between rows
+    int completed, total;       // Tiles done, counting this one
+};
+
+struct render_callbacks {
+    std::function<void(const tile_event&)> on_tile;
+    std::function<void(int completed, int total)> on_progress;   // After every tile, skipped ones too
+};
+
+class render_job : public std::enable_shared_from_this<render_job> {
+  public:
+    enum state { running, finished, cancelled, failed };
+
+    // The job keeps world and materials alive until it is done. The camera is
+    // copied and initialized; its threads and numa settings are not used.
+    static shared_ptr<render_job> start(work_stealing_pool& pool, camera cam, shared_ptr<const hittable> world,
+                                        shared_ptr<const material_table> materials, render_callbacks callbacks = {}) {
+        auto job = shared_ptr<render_job>(new render_job(pool, std::move(cam), std::move(world), std::move(materials),
+                                                         std::move(callbacks)));
+        pool.post([job] { job->run_tiles(0, camera::render_tile_count); });
+        return job;
+    }
+
+    // Asks the job to stop; tiles already being rendered are finished.
+    void cancel() { stop_requested = true; }
+
+    // Blocks until every tile is done or skipped, and rethrows what a failed tile
+    // threw. Must not be called from a thread of the job's pool.
+    state wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return result != running; });
+        if (error)
+            std::rethrow_exception(error);
+        return result;
+    }
+
+    state status() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return result;
+    }
+
+    int tiles_done() const { return completed.load(); }
+    double progress() const { return double(completed.load()) / camera::render_tile_count; }
+
+    const camera& cam() const { return view; }
+
+    // Summed samples and features over the window; complete once wait() returns
+    // finished, and holding the finished tiles after a cancel.
+    const std::vector<color>& image() const { return pixels; }
+    const std::vector<pixel_features>& features() const { return feature_buffers; }
+
+    // Post-processes and writes the image as camera::render() does.
+    void write(std::ostream& out) {
+        view.finish(pixels, feature_buffers, out);
+    }
+
+  private:
+    work_stealing_pool& pool;
+    camera view;
+    shared_ptr<const hittable> world;
+    shared_ptr<const material_table> materials;
+    render_callbacks callbacks;
+
+    std::vector<color> pixels;
+    std::vector<pixel_features> feature_buffers;
+
+    std::atomic<bool> stop_requested{false};
+    std::atomic<int> completed{0};
+    std::atomic<int> skipped{0};
+    std::mutex callback_mutex;
+    mutable std::mutex mutex;
+    std::condition_variable done;
+    state result = running;
+    std::exception_ptr error;
+
+    render_job(work_stealing_pool& _pool, camera _view, shared_ptr<const hittable> _world,
+               shared_ptr<const material_table> _materials, render_callbacks _callbacks)
+      : pool(_pool), view(std::move(_view)), world(std::move(_world)), materials(std::move(_materials)),
+        callbacks(std::move(_callbacks)) {
+        view.initialize();
+        pixels.resize(size_t(view.window_width()) * view.window_height());
+        if (view.wants_features())
+            feature_buffers.resize(pixels.size());
+    }
+
+    // Posts the upper half of [first, last) for another worker to steal until one
+    // tile is left, then renders it.
+    void run_tiles(int first, int last) {
+        auto self = shared_from_this();
+        while (last - first > 1) {
+            int middle = first + (last - first) / 2;
+            pool.post([self, middle, last] { self->run_tiles(middle, last); });
+            last = middle;
+        }
+        run_tile(first);
+    }
+
+    void run_tile(int tile) {
+        bool rendered = false;
+        if (!stop_requested) {
+            try {
+                // Tiles are the unit of parallelism here; keep render_region on this thread.
+                omp_set_num_threads(1);
+                rendered = view.render_tile(*world, *materials, tile, pixels.data(),
+                                            feature_buffers.empty() ? nullptr : feature_buffers.data());
+            } catch (...) {
+                skipped++;
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                stop_requested = true;
+            }
+        } else {
+            skipped++;
+        }
+
+        int count;
+        {
+            std::lock_guard<std::mutex> lock(callback_mutex);
+            count = completed.load() + 1;
+            if (rendered && callbacks.on_tile) {
+                auto rect = view.tile_bounds(tile);
+                callbacks.on_tile({rect, &pixels[size_t(rect.y0) * view.window_width() + rect.x0],
+                                   view.window_width(), count, camera::render_tile_count});
+            }
+            if (callbacks.on_progress)
+                callbacks.on_progress(count, camera::render_tile_count);
+            completed = count;
+        }
+
+        if (count == camera::render_tile_count) {
+            std::lock_guard<std::mutex> lock(mutex);
+            result = error ? failed : skipped > 0 ? cancelled : finished;
+            done.notify_all();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef STITCH_H
+#define STITCH_H
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A plain text PPM as written by camera::write_image, kept as the integer values
+// so stitching reproduces the full render byte for byte.
+struct partial_image {
+    int x = 0, y = 0;                    // Offset within the frame
+    int width = 0, height = 0;
+    int full_width = 0, full_height = 0; // The frame; the image itself when not partial
+    int max_value = 255;                 // 255, or 65535 for 16 bits per channel
+    std::vector<int> values;             // width * height * 3
+};
+
+inline bool read_partial_image(std::istream& in, partial_image& image) {
+    std::string magic;
+    if (!(in >> magic) || magic != "P3")
+        return false;
+
+    // Header comments; "# offset x y full width height" places a partial image.
+    bool partial = false;
+    while (in >> std::ws && in.peek() == '#') {
+        std::string line, word;
+        std::getline(in, line);
+        std::istringstream comment(line.substr(1));
+        if (comment >> word && word == "offset"
+            && comment >> image.x >> image.y >> word >> image.full_width >> image.full_height && word == "full")
+            partial = true;
+    }
+
+    if (!(in >> image.width >> image.height >> image.max_value) || image.width < 0 || image.height < 0
+        || image.max_value < 1 || image.max_value > 65535)
+        return false;
+    if (!partial) {
+        image.x = image.y = 0;
+        image.full_width = image.width;
+        image.full_height = image.height;
+    }
+
+    image.values.resize(size_t(image.width) * image.height * 3);
+    for (auto& value : image.values)
+        if (!(in >> value))
+            return false;
+    return true;
+}
+
+// Pastes partial renders of one frame into a full image written to output.
+// Returns a process exit status; fails when the parts do not cover the frame or
+// differ in bit depth.
+inline int stitch_images(const std::string& output, const std::vector<std::string>& parts) {
+    int width = 0, height = 0, max_value = 255;
+    std::vector<int> frame;
+    std::vector<char> covered;
+
+    if (parts.empty()) {
+        std::cerr << "Error: No partial images to stitch." << std::endl;
+        return 1;
+    }
+
+    for (const auto& path : parts) {
+        std::ifstream in(path);
+        partial_image part;
+        if (!read_partial_image(in, part)) {
+            std::cerr << "Error: '" << path << "' is not a P3 image." << std::endl;
+            return 1;
+        }
+        if (frame.empty()) {
+            width = part.full_width;
+            height = part.full_height;
+            max_value = part.max_value;
+            frame.resize(size_t(width) * height * 3);
+            covered.resize(size_t(width) * height);
+        }
+        if (part.full_width != width || part.full_height != height || part.x < 0 || part.y < 0
+            || part.x + part.width > width || part.y + part.height > height) {
+            std::cerr << "Error: '" << path << "' does not belong to a " << width << "x" << height << " frame." << std::endl;
+            return 1;
+        }
+        if (part.max_value != max_value) {
+            std::cerr << "Error: '" << path << "' has maximum value " << part.max_value << ", not " << max_value << "." << std::endl;
+            return 1;
+        }
+
+        for (int j = 0; j < part.height; j++) {
+            for (int i = 0; i < part.width; i++) {
+                size_t to = size_t(part.y + j) * width + (part.x + i);
+                size_t from = size_t(j) * part.width + i;
+                for (int c = 0; c < 3; c++)
+                    frame[3 * to + c] = part.values[3 * from + c];
+                covered[to] = 1;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < covered.size(); i++) {
+        if (!covered[i]) {
+            std::cerr << "Error: Pixel (" << i % width << ", " << i / width << ") is missing from the parts." << std::endl;
+            return 1;
+        }
+    }
+
+    std::ofstream out(output);
+    out << "P3\n" << width << ' ' << height << '\n' << max_value << '\n';
+    for (size_t i = 0; i < covered.size(); i++)
+        out << frame[3 * i] << ' ' << frame[3 * i + 1] << ' ' << frame[3 * i + 2] << '\n';
+    return 0;
+}
+
+#endif
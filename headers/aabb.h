@@ -1,66 +1,118 @@
-#ifndef AABB_H
-#define AABB_H
-
-#include "common.h"
-
-class aabb {
-  public:
-    interval x, y, z;
-
+#ifndef AABB_H
+#define AABB_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "common.h"
+
+class aabb {
+  public:
+    interval x, y, z;
+
     aabb() {} 
-
-    aabb(const interval& ix, const interval& iy, const interval& iz)
-      : x(ix), y(iy), z(iz) { }
-
-    aabb(const point3& a, const point3& b) {
+
+    aabb(const interval& ix, const interval& iy, const interval& iz)
+      : x(ix), y(iy), z(iz) { }
+
+    aabb(const point3& a, const point3& b) {
         
         
-        x = interval(fmin(a[0],b[0]), fmax(a[0],b[0]));
-        y = interval(fmin(a[1],b[1]), fmax(a[1],b[1]));
-        z = interval(fmin(a[2],b[2]), fmax(a[2],b[2]));
-    }
-
-    aabb(const aabb& box0, const aabb& box1) {
-        x = interval(box0.x, box1.x);
-        y = interval(box0.y, box1.y);
-        z = interval(box0.z, box1.z);
-    }
-
-    aabb pad() {
+        x = interval(fmin(a[0],b[0]), fmax(a[0],b[0]));
+        y = interval(fmin(a[1],b[1]), fmax(a[1],b[1]));
+        z = interval(fmin(a[2],b[2]), fmax(a[2],b[2]));
+    }
+
+    aabb(const aabb& box0, const aabb& box1) {
+        x = interval(box0.x, box1.x);
+        y = interval(box0.y, box1.y);
+        z = interval(box0.z, box1.z);
+    }
+
+    aabb pad() {
         
-        double delta = 0.0001;
-        interval new_x = (x.size() >= delta) ? x : x.expand(delta);
-        interval new_y = (y.size() >= delta) ? y : y.expand(delta);
-        interval new_z = (z.size() >= delta) ? z : z.expand(delta);
-
-        return aabb(new_x, new_y, new_z);
-    }
-
-    const interval& axis(int n) const {
-        if (n == 1) return y;
-        if (n == 2) return z;
-        return x;
-    }
-
-    bool hit(const ray& r, interval ray_t) const {
-        for (int a = 0; a < 3; a++) {
-            auto invD = 1 / r.direction()[a];
-            auto orig = r.origin()[a];
-
-            auto t0 = (axis(a).min - orig) * invD;
-            auto t1 = (axis(a).max - orig) * invD;
-
-            if (invD < 0)
-                std::swap(t0, t1);
-
-            if (t0 > ray_t.min) ray_t.min = t0;
-            if (t1 < ray_t.max) ray_t.max = t1;
-
-            if (ray_t.max <= ray_t.min)
-                return false;
-        }
-        return true;
-    }
-};
-
+        double delta = 0.0001;
+        interval new_x = (x.size() >= delta) ? x : x.expand(delta);
+        interval new_y = (y.size() >= delta) ? y : y.expand(delta);
+        interval new_z = (z.size() >= delta) ? z : z.expand(delta);
+
+        return aabb(new_x, new_y, new_z);
+    }
+
+    double surface_area() const {
+        auto dx = x.size(), dy = y.size(), dz = z.size();
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    const interval& axis(int n) const {
+        if (n == 1) return y;
+        if (n == 2) return z;
+        return x;
+    }
+
+    int longest_axis() const {
+        if (x.size() > y.size())
+            return (x.size() > z.size()) ? 0 : 2;
+        return (y.size() > z.size()) ? 1 : 2;
+    }
+
+    // Slab test with the ray's precomputed reciprocals. A ray parallel to a slab
+    // gets infinite distances to it, or NaN when it starts on the slab's plane;
+    // comparisons with NaN fail, so such a slab never narrows the interval. The far
+    // distances are widened by the worst rounding error of the product so rays
+    // grazing an edge are not missed.
+    bool hit(const ray& r, interval ray_t) const {
+        const auto& orig = r.origin();
+        const auto& inv = r.inv_direction();
+        for (int a = 0; a < 3; a++) {
+            const auto& slab = axis(a);
+            bool flip = r.is_negative(a);
+
+            auto t0 = ((flip ? slab.max : slab.min) - orig[a]) * inv[a];
+            auto t1 = ((flip ? slab.min : slab.max) - orig[a]) * inv[a] * robust_scale;
+
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 < ray_t.max) ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min)
+                return false;
+        }
+        return true;
+    }
+
+  private:
+    // 1 + 2 gamma(3), with gamma(n) = n u / (1 - n u) for unit roundoff u, as in
+    // Ize's robust BVH traversal.
+    static constexpr double unit_roundoff = std::numeric_limits<double>::epsilon() / 2;
+    static constexpr double robust_scale = 1 + 2 * (3 * unit_roundoff) / (1 - 3 * unit_roundoff);
+};
+
+// Bounds of linearly moving contents at fraction f of the way from a to b.
+inline aabb interpolate(const aabb& a, const aabb& b, double f) {
+    return aabb(interval(a.x.min + f*(b.x.min - a.x.min), a.x.max + f*(b.x.max - a.x.max)),
+                interval(a.y.min + f*(b.y.min - a.y.min), a.y.max + f*(b.y.max - a.y.max)),
+                interval(a.z.min + f*(b.z.min - a.z.min), a.z.max + f*(b.z.max - a.z.max)));
+}
+
+// Interleaves ten bits of each coordinate of p, scaled to bounds, so points close
+// in the order of their codes are close in space.
+inline uint64_t morton_code(const point3& p, const aabb& bounds) {
+    auto spread = [](uint64_t x) {
+        x = (x | (x << 16)) & 0x030000FF;
+        x = (x | (x << 8)) & 0x0300F00F;
+        x = (x | (x << 4)) & 0x030C30C3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    };
+    uint64_t code = 0;
+    for (int a = 0; a < 3; a++) {
+        auto extent = bounds.axis(a);
+        auto f = (extent.size() > 0) ? (p[a] - extent.min) / extent.size() : 0.0;
+        auto cell = static_cast<uint64_t>(std::clamp(f * 1024, 0.0, 1023.0));
+        code |= spread(cell) << (2 - a);
+    }
+    return code;
+}
+
 #endif
\ No newline at end of file
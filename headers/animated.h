@@ -0,0 +1,144 @@
+#ifndef ANIMATED_H
+#define ANIMATED_H
+
+#include "common.h"
+#include "hittable.h"
+
+#include <vector>
+
+struct transform_keyframe {
+    double time;
+    vec3   translate;
+    double rotate_y;   // degrees
+};
+
+// Places an object with a keyframed rotation about +Y followed by a translation.
+// set_time() moves it to the pose at a given time, interpolating linearly between
+// keyframes and holding the first and last pose outside their range. Given a
+// shutter interval instead, each ray is posed at its own time for motion blur.
+class animated : public hittable {
+  public:
+    animated(shared_ptr<hittable> _object, const std::vector<transform_keyframe>& _keyframes)
+      : object(_object), keyframes(_keyframes) {
+        set_time(keyframes.empty() ? 0 : keyframes.front().time);
+    }
+
+    void set_time(double time) { set_time(time, time); }
+
+    void set_time(double time0, double time1) {
+        current = pose_at(time0);
+        moving = time1 > time0;
+
+        auto local = object->bounding_box();
+        if (!moving) {
+            bbox = posed_bounds(current, local);
+            return;
+        }
+
+        // Translation is linear between keyframes, so bounds at the interval ends
+        // and at every keyframe inside it cover the sweep. While rotating, corners
+        // stay within the cylinder around +Y that holds the whole local box.
+        bool rotating = false;
+        std::vector<transform> poses = {current, pose_at(time1)};
+        for (const auto& key : keyframes)
+            if (key.time > time0 && key.time < time1)
+                poses.push_back(pose_at(key.time));
+        for (const auto& p : poses)
+            rotating |= p.rotate_y != current.rotate_y;
+
+        auto radius = 0.0;
+        for (double x : {local.x.min, local.x.max})
+            for (double z : {local.z.min, local.z.max})
+                radius = fmax(radius, sqrt(x*x + z*z));
+
+        bbox = aabb();
+        for (const auto& p : poses) {
+            if (rotating)
+                bbox = aabb(bbox, aabb(interval(p.offset.x() - radius, p.offset.x() + radius),
+                                       interval(local.y.min + p.offset.y(), local.y.max + p.offset.y()),
+                                       interval(p.offset.z() - radius, p.offset.z() + radius)));
+            else
+                bbox = aabb(bbox, posed_bounds(p, local));
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        const auto& p = moving ? pose_at(r.time()) : current;
+        ray local(p.to_object(r.origin() - p.offset), p.to_object(r.direction()), r.time());
+
+        if (!object->hit(local, ray_t, rec))
+            return false;
+
+        rec.p = p.to_world(rec.p);
+        rec.normal = p.rotate(rec.normal);
+        return true;
+    }
+
+  private:
+    struct transform {
+        vec3   offset;
+        double rotate_y = 0;
+        double sin_theta = 0;
+        double cos_theta = 1;
+
+        vec3 rotate(const vec3& v) const {
+            return vec3(cos_theta*v.x() + sin_theta*v.z(), v.y(), -sin_theta*v.x() + cos_theta*v.z());
+        }
+
+        vec3 to_object(const vec3& v) const {
+            return vec3(cos_theta*v.x() - sin_theta*v.z(), v.y(), sin_theta*v.x() + cos_theta*v.z());
+        }
+
+        point3 to_world(const point3& p) const {
+            return rotate(p) + offset;
+        }
+    };
+
+    shared_ptr<hittable> object;
+    std::vector<transform_keyframe> keyframes;
+    transform current;
+    bool moving = false;
+    aabb bbox;
+
+    transform pose_at(double time) const {
+        auto pose = keyframes.empty() ? transform_keyframe{time, vec3(0,0,0), 0} : keyframes.front();
+        for (size_t k = 1; k < keyframes.size(); k++) {
+            const auto& a = keyframes[k - 1];
+            const auto& b = keyframes[k];
+            if (time <= a.time)
+                break;
+            if (time >= b.time || b.time <= a.time) {
+                pose = b;
+                continue;
+            }
+            auto f = (time - a.time) / (b.time - a.time);
+            pose.translate = (1 - f) * a.translate + f * b.translate;
+            pose.rotate_y = (1 - f) * a.rotate_y + f * b.rotate_y;
+            break;
+        }
+
+        transform t;
+        t.offset = pose.translate;
+        t.rotate_y = pose.rotate_y;
+        auto radians = degrees_to_radians(pose.rotate_y);
+        t.sin_theta = sin(radians);
+        t.cos_theta = cos(radians);
+        return t;
+    }
+
+    static aabb posed_bounds(const transform& p, const aabb& local) {
+        aabb box;
+        for (int i = 0; i < 8; i++) {
+            point3 corner((i & 1) ? local.x.max : local.x.min,
+                          (i & 2) ? local.y.max : local.y.min,
+                          (i & 4) ? local.z.max : local.z.min);
+            auto q = p.to_world(corner);
+            box = aabb(box, aabb(q, q));
+        }
+        return box;
+    }
+};
+
+#endif
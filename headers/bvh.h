@@ -1,81 +1,340 @@
-#ifndef BVH_H
-#define BVH_H
-
-
-#include <algorithm>
-
-#include "common.h"
-#include "hittable.h"
-#include "hittable_list.h"
-
-
-class bvh_node : public hittable {
-  public:
-    bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
-
-    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
-        auto objects = src_objects; 
-
-        int axis = random_int(0,2);
-        auto comparator = (axis == 0) ? box_x_compare
-                        : (axis == 1) ? box_y_compare
-                                      : box_z_compare;
-
-        size_t object_span = end - start;
-
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            if (comparator(objects[start], objects[start+1])) {
-                left = objects[start];
-                right = objects[start+1];
-            } else {
-                left = objects[start+1];
-                right = objects[start];
-            }
-        } else {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
-
-            auto mid = start + object_span/2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
-        }
-
-        box = aabb(left->bounding_box(), right->bounding_box());
-    }
-
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        if (!box.hit(r, ray_t))
-            return false;
-
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
-
-        return hit_left || hit_right;
-    }
-
-    aabb bounding_box() const override { return box; }
-
-  private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb box;
-
-    static bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index) {
-        return a->bounding_box().axis(axis_index).min < b->bounding_box().axis(axis_index).min;
-    }
-
-    static bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 0);
-    }
-
-    static bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 1);
-    }
-
-    static bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 2);
-    }
-};
-
+#ifndef BVH_H
+#define BVH_H
+
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "common.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+
+// Shape of a built tree, as collected by bvh_node::statistics().
+struct bvh_stats {
+    double sah_cost = 0;
+    size_t nodes = 0;
+    size_t primitives = 0;                  // References to primitives from nodes
+    std::vector<size_t> depth_histogram;    // Primitive references by depth, the root's children at 1
+    size_t leaf_children[3] = {0, 0, 0};    // Nodes by how many of their children are primitives
+    double overlap = 0;                     // Mean over nodes of area(left and right) / area(node)
+
+    void print(std::ostream& out) const {
+        out << "BVH: " << nodes << " nodes, " << primitives << " primitives, SAH cost " << sah_cost
+            << ", mean child overlap " << std::setprecision(3) << 100 * overlap << "%" << std::setprecision(6) << '\n';
+        out << "  Nodes with 0/1/2 primitive children: " << leaf_children[0] << " / " << leaf_children[1]
+            << " / " << leaf_children[2] << '\n';
+        out << "  Primitives by depth:";
+        for (size_t depth = 0; depth < depth_histogram.size(); depth++)
+            if (depth_histogram[depth] > 0)
+                out << ' ' << depth << ':' << depth_histogram[depth];
+        out << std::endl;
+    }
+};
+
+// With a shutter interval [time0, time1] every node keeps its bounds at both ends
+// and rays test the bounds interpolated to their own time, which stays tight for
+// moving primitives where a box swept over the whole interval would not.
+class bvh_node : public hittable {
+  public:
+    bvh_node(const hittable_list& list, double time0 = 0, double time1 = 0)
+      : bvh_node(list.objects, 0, list.objects.size(), time0, time1) {}
+
+    // Subtrees of at least parallel_span objects are built as OpenMP tasks; the
+    // tree is the same for any number of threads.
+    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end,
+             double time0 = 0, double time1 = 0) {
+        std::vector<shared_ptr<hittable>> objects(src_objects.begin() + start, src_objects.begin() + end);
+
+        #pragma omp parallel
+        #pragma omp single
+        build(objects, 0, objects.size(), time0, time1);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!moving) {
+            if (!box.hit(r, ray_t))
+                return false;
+        } else {
+            auto f = std::clamp((r.time() - time0) * inv_shutter, 0.0, 1.0);
+            if (!interpolate(box0, box1, f).hit(r, ray_t))
+                return false;
+        }
+
+        bool hit_left = left->hit(r, ray_t, rec);
+        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+        return hit_left || hit_right;
+    }
+
+    aabb bounding_box() const override { return box; }
+
+    aabb bounding_box_at(double time) const override {
+        if (!moving)
+            return box;
+        return interpolate(box0, box1, std::clamp((time - time0) * inv_shutter, 0.0, 1.0));
+    }
+
+    // Recomputes every node's bounds from its children after objects have moved,
+    // keeping the tree topology. The shutter interval may change with the refit.
+    void refit(double time0, double time1) {
+        if (auto node = std::dynamic_pointer_cast<bvh_node>(left))
+            node->refit(time0, time1);
+        if (right != left)
+            if (auto node = std::dynamic_pointer_cast<bvh_node>(right))
+                node->refit(time0, time1);
+
+        set_bounds(time0, time1);
+    }
+
+    void refit() { refit(time0, time1); }
+
+    // Copies the nodes, and the primitives that replicate, in the calling thread,
+    // so first touch places the copy on that thread's NUMA node.
+    shared_ptr<hittable> replicate() const override {
+        auto copy = make_shared<bvh_node>(*this);
+        copy->left = replicate_child(left);
+        copy->right = (right == left) ? copy->left : replicate_child(right);
+        return copy;
+    }
+
+    // Expected cost of tracing a ray through the tree under the surface area
+    // heuristic, counting one unit per node visit and per primitive test.
+    double sah_cost() const {
+        auto area = box.surface_area();
+        auto child_cost = [area](const shared_ptr<hittable>& child) {
+            auto node = std::dynamic_pointer_cast<bvh_node>(child);
+            auto weight = (area > 0) ? child->bounding_box().surface_area() / area : 1.0;
+            return weight * (node ? node->sah_cost() : 1.0);
+        };
+
+        if (left == right)
+            return 1.0 + child_cost(left);
+        return 1.0 + child_cost(left) + child_cost(right);
+    }
+
+    bvh_stats statistics() const {
+        bvh_stats stats;
+        stats.sah_cost = sah_cost();
+        collect(stats, 0);
+        if (stats.nodes > 0)
+            stats.overlap /= stats.nodes;
+        return stats;
+    }
+
+    // Writes the tree in preorder, one line per entry, for offline analysis:
+    //   N <children> xmin ymin zmin xmax ymax zmax   a node, followed by its 1 or 2 children
+    //   P xmin ymin zmin xmax ymax zmax              a primitive
+    void dump(std::ostream& out) const {
+        out << std::setprecision(7);
+        write_entry(out);
+    }
+
+    // Improves the tree with tree rotations: each node may swap one child with a
+    // grandchild under its other child when that shrinks the other child's box.
+    // Repeats bottom-up passes until one changes nothing or passes run out, and
+    // returns the number of rotations made.
+    size_t optimize(int passes = 8) {
+        size_t total = 0;
+        for (int pass = 0; pass < passes; pass++) {
+            size_t rotations = rotate_below();
+            total += rotations;
+            if (rotations == 0)
+                break;
+        }
+        return total;
+    }
+
+    static constexpr size_t parallel_span = 4096;
+
+  private:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    aabb box;               // Encloses the node over the whole shutter interval
+    aabb box0, box1;        // Bounds at time0 and time1
+    double time0 = 0;
+    double time1 = 0;
+    double inv_shutter = 0;
+    bool moving = false;
+
+    void set_bounds(double t0, double t1) {
+        time0 = t0;
+        time1 = t1;
+        box0 = aabb(left->bounding_box_at(t0), right->bounding_box_at(t0));
+        if (t1 > t0) {
+            box1 = aabb(left->bounding_box_at(t1), right->bounding_box_at(t1));
+            inv_shutter = 1 / (t1 - t0);
+        } else {
+            box1 = box0;
+            inv_shutter = 0;
+        }
+        moving = !same_bounds(box0, box1);
+        box = aabb(box0, box1);
+    }
+
+    void collect(bvh_stats& stats, size_t depth) const {
+        stats.nodes++;
+        auto area = box.surface_area();
+        if (left != right && area > 0)
+            stats.overlap += overlap_area(left->bounding_box(), right->bounding_box()) / area;
+
+        int primitive_children = 0;
+        for (const auto& child : (left == right) ? std::vector<shared_ptr<hittable>>{left}
+                                                 : std::vector<shared_ptr<hittable>>{left, right}) {
+            if (auto node = std::dynamic_pointer_cast<bvh_node>(child)) {
+                node->collect(stats, depth + 1);
+            } else {
+                primitive_children++;
+                stats.primitives++;
+                if (stats.depth_histogram.size() <= depth + 1)
+                    stats.depth_histogram.resize(depth + 2);
+                stats.depth_histogram[depth + 1]++;
+            }
+        }
+        stats.leaf_children[primitive_children]++;
+    }
+
+    static double overlap_area(const aabb& a, const aabb& b) {
+        auto dx = std::min(a.x.max, b.x.max) - std::max(a.x.min, b.x.min);
+        auto dy = std::min(a.y.max, b.y.max) - std::max(a.y.min, b.y.min);
+        auto dz = std::min(a.z.max, b.z.max) - std::max(a.z.min, b.z.min);
+        if (dx < 0 || dy < 0 || dz < 0)
+            return 0;
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    static void write_box(std::ostream& out, const aabb& b) {
+        out << ' ' << b.x.min << ' ' << b.y.min << ' ' << b.z.min << ' ' << b.x.max << ' ' << b.y.max << ' ' << b.z.max << '\n';
+    }
+
+    void write_entry(std::ostream& out) const {
+        out << "N " << (left == right ? 1 : 2);
+        write_box(out, box);
+        for (const auto& child : {left, right}) {
+            if (auto node = std::dynamic_pointer_cast<bvh_node>(child))
+                node->write_entry(out);
+            else {
+                out << 'P';
+                write_box(out, child->bounding_box());
+            }
+            if (left == right)
+                break;
+        }
+    }
+
+    // A node with both children pointing at one primitive cannot take part in a
+    // rotation without duplicating it.
+    static shared_ptr<bvh_node> inner_node(const shared_ptr<hittable>& child) {
+        auto node = std::dynamic_pointer_cast<bvh_node>(child);
+        return (node && node->left != node->right) ? node : nullptr;
+    }
+
+    // One bottom-up pass of rotations; this node's own box never changes.
+    size_t rotate_below() {
+        size_t rotations = 0;
+        auto left_node = inner_node(left), right_node = inner_node(right);
+        if (left_node)
+            rotations += left_node->rotate_below();
+        if (right_node)
+            rotations += right_node->rotate_below();
+
+        // Swapping child with grandchild g of other leaves other enclosing
+        // its remaining grandchild and child.
+        double best_gain = 0;
+        shared_ptr<hittable>* best_child = nullptr;
+        shared_ptr<hittable>* best_grandchild = nullptr;
+        bvh_node* best_other = nullptr;
+        auto consider = [&](shared_ptr<hittable>& child, const shared_ptr<bvh_node>& other) {
+            if (!other)
+                return;
+            auto child_box = child->bounding_box();
+            auto current = other->box.surface_area();
+            auto swap_left = aabb(child_box, other->right->bounding_box()).surface_area();
+            auto swap_right = aabb(child_box, other->left->bounding_box()).surface_area();
+            if (current - swap_left > best_gain) {
+                best_gain = current - swap_left;
+                best_child = &child;
+                best_grandchild = &other->left;
+                best_other = other.get();
+            }
+            if (current - swap_right > best_gain) {
+                best_gain = current - swap_right;
+                best_child = &child;
+                best_grandchild = &other->right;
+                best_other = other.get();
+            }
+        };
+        consider(left, right_node);
+        consider(right, left_node);
+
+        if (!best_other || best_gain <= 1e-9 * box.surface_area())
+            return rotations;
+        std::swap(*best_child, *best_grandchild);
+        best_other->set_bounds(time0, time1);
+        set_bounds(time0, time1);
+        return rotations + 1;
+    }
+
+    static bool same_bounds(const aabb& a, const aabb& b) {
+        return a.x.min == b.x.min && a.x.max == b.x.max && a.y.min == b.y.min
+            && a.y.max == b.y.max && a.z.min == b.z.min && a.z.max == b.z.max;
+    }
+
+    bvh_node() {}
+
+    static shared_ptr<hittable> replicate_child(const shared_ptr<hittable>& child) {
+        auto copy = child->replicate();
+        return copy ? copy : child;
+    }
+
+    static double centroid(const shared_ptr<hittable>& object, int axis) {
+        auto extent = object->bounding_box().axis(axis);
+        return extent.min + extent.max;
+    }
+
+    // Builds this node over objects[start, end), reordering that range in place:
+    // it splits at the median centroid along the longest axis of the centroids.
+    void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, double t0, double t1) {
+        size_t object_span = end - start;
+
+        if (object_span == 1) {
+            left = right = objects[start];
+        } else if (object_span == 2) {
+            left = objects[start];
+            right = objects[start+1];
+        } else {
+            aabb centroids;
+            for (size_t i = start; i < end; i++) {
+                point3 c(centroid(objects[i], 0), centroid(objects[i], 1), centroid(objects[i], 2));
+                centroids = aabb(centroids, aabb(c, c));
+            }
+            int axis = centroids.longest_axis();
+
+            auto mid = start + object_span/2;
+            std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end,
+                             [axis](const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
+                                 return centroid(a, axis) < centroid(b, axis);
+                             });
+
+            auto left_node = shared_ptr<bvh_node>(new bvh_node());
+            auto right_node = shared_ptr<bvh_node>(new bvh_node());
+            if (object_span >= parallel_span) {
+                #pragma omp task shared(objects)
+                left_node->build(objects, start, mid, t0, t1);
+                right_node->build(objects, mid, end, t0, t1);
+                #pragma omp taskwait
+            } else {
+                left_node->build(objects, start, mid, t0, t1);
+                right_node->build(objects, mid, end, t0, t1);
+            }
+            left = left_node;
+            right = right_node;
+        }
+
+        set_bounds(t0, t1);
+    }
+};
+
 #endif
\ No newline at end of file
@@ -1,41 +1,67 @@
-#ifndef COMMON_H
-#define COMMON_H
-
-#include <cmath>
-#include <limits>
-#include <memory>
-#include <cstdlib>
-
-using std::shared_ptr;
-using std::make_shared;
-using std::sqrt;
-
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
-
-inline double degrees_to_radians(double degrees) {
-    return degrees * pi / 180.0;
-}
-
-inline double random_double() {
-    
-    return rand() / (RAND_MAX + 1.0);
-}
-
-inline double random_double(double min, double max) {
-    
-    return min + (max-min)*random_double();
-}
-
-inline int random_int(int min, int max) {
-    
-    return static_cast<int>(random_double(min, max+1));
-}
-
-
-#include "ray.h"
-#include "vec3.h"
-#include "interval.h"
-#include "color.h"
-
+#ifndef COMMON_H
+#define COMMON_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <cstdlib>
+
+using std::shared_ptr;
+using std::make_shared;
+using std::sqrt;
+
+const double infinity = std::numeric_limits<double>::infinity();
+const double pi = 3.1415926535897932385;
+
+inline double degrees_to_radians(double degrees) {
+    return degrees * pi / 180.0;
+}
+
+// Every thread draws from its own splitmix64 stream. The renderer reseeds it for
+// each camera sample, so an image does not depend on how pixels are spread over
+// threads, processes or partial renders.
+inline uint64_t& random_state() {
+    static thread_local uint64_t state = 0x853c49e6748fea9bULL;
+    return state;
+}
+
+inline uint64_t mix_bits(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline void seed_random(uint64_t seed) {
+    random_state() = mix_bits(seed);
+}
+
+// Seeds the stream for one sample of pixel (x, y) from those three values alone.
+inline void seed_sample(int x, int y, int sample) {
+    seed_random(mix_bits((uint64_t(uint32_t(y)) << 32) | uint32_t(x)) + uint64_t(sample));
+}
+
+inline double random_double() {
+    
+    uint64_t& state = random_state();
+    state += 0x9e3779b97f4a7c15ULL;
+    return (mix_bits(state) >> 11) * 0x1.0p-53;
+}
+
+inline double random_double(double min, double max) {
+    
+    return min + (max-min)*random_double();
+}
+
+inline int random_int(int min, int max) {
+    
+    return static_cast<int>(random_double(min, max+1));
+}
+
+
+#include "ray.h"
+#include "vec3.h"
+#include "interval.h"
+#include "color.h"
+
 #endif
\ No newline at end of file
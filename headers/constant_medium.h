@@ -0,0 +1,135 @@
+#ifndef CONSTANT_MEDIUM_H
+#define CONSTANT_MEDIUM_H
+
+#include "common.h"
+#include "hittable.h"
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Density samples on a regular grid spanning a box, corner to corner, read
+// trilinearly. Points outside the box have no density.
+class density_grid {
+  public:
+    density_grid(int _nx, int _ny, int _nz, std::vector<double> _values)
+      : nx(_nx), ny(_ny), nz(_nz), values(std::move(_values)) {
+        for (auto d : values)
+            largest = fmax(largest, d);
+    }
+
+    // A text file holding nx ny nz and then nx*ny*nz densities, x varying fastest.
+    static shared_ptr<density_grid> load(const std::string& path) {
+        std::ifstream in(path);
+        int x = 0, y = 0, z = 0;
+        if (!(in >> x >> y >> z) || x < 2 || y < 2 || z < 2) {
+            std::cerr << "Error: File '" << path << "' is not a density grid." << std::endl;
+            return nullptr;
+        }
+        std::vector<double> densities(size_t(x) * y * z);
+        for (auto& d : densities) {
+            if (!(in >> d)) {
+                std::cerr << "Error: Density grid '" << path << "' ends early." << std::endl;
+                return nullptr;
+            }
+            d = fmax(d, 0.0);
+        }
+        return make_shared<density_grid>(x, y, z, std::move(densities));
+    }
+
+    double max_value() const { return largest; }
+
+    double value(const point3& p, const aabb& box) const {
+        double f[3];
+        int cell[3];
+        const int counts[3] = {nx, ny, nz};
+        for (int a = 0; a < 3; a++) {
+            auto extent = box.axis(a);
+            auto x = (p[a] - extent.min) / extent.size() * (counts[a] - 1);
+            if (!(x >= 0 && x <= counts[a] - 1))
+                return 0;
+            cell[a] = std::min(int(x), counts[a] - 2);
+            f[a] = x - cell[a];
+        }
+
+        double sum = 0;
+        for (int corner = 0; corner < 8; corner++) {
+            int dx = corner & 1, dy = (corner >> 1) & 1, dz = (corner >> 2) & 1;
+            auto weight = (dx ? f[0] : 1 - f[0]) * (dy ? f[1] : 1 - f[1]) * (dz ? f[2] : 1 - f[2]);
+            sum += weight * at(cell[0] + dx, cell[1] + dy, cell[2] + dz);
+        }
+        return sum;
+    }
+
+  private:
+    int nx, ny, nz;
+    std::vector<double> values;
+    double largest = 0;
+
+    double at(int x, int y, int z) const { return values[(size_t(z) * ny + y) * nx + x]; }
+};
+
+// Fog or smoke filling a closed boundary shape. A ray passing through scatters at
+// a distance drawn from the exponential free-flight distribution, found in closed
+// form for a uniform density. With a density grid, scaled by density, the
+// distance is found by delta tracking against the grid's largest density: steps
+// drawn as if the medium were that dense everywhere, each accepted with the
+// ratio of the real density to it.
+class constant_medium : public hittable {
+  public:
+    constant_medium(shared_ptr<hittable> _boundary, double _density, int _phase_material,
+                    shared_ptr<density_grid> _grid = nullptr)
+      : boundary(_boundary), density(_density), phase_material(_phase_material), grid(_grid) {
+        grid_box = boundary->bounding_box();
+        majorant = grid ? density * grid->max_value() : density;
+    }
+
+    aabb bounding_box() const override { return boundary->bounding_box(); }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (majorant <= 0)
+            return false;
+
+        hit_record entry, exit;
+        if (!boundary->hit(r, universe, entry))
+            return false;
+        if (!boundary->hit(r, interval(entry.t + 0.0001, infinity), exit))
+            return false;
+
+        auto t_min = fmax(fmax(entry.t, ray_t.min), 0.0);
+        auto t_max = fmin(exit.t, ray_t.max);
+        if (t_min >= t_max)
+            return false;
+
+        auto ray_length = sqrt(r.length_squared());
+        double t = t_min;
+        for (;;) {
+            t -= log(1 - random_double()) / (majorant * ray_length);
+            if (t >= t_max)
+                return false;
+            if (!grid || random_double() * majorant < density * grid->value(r.at(t), grid_box))
+                break;
+        }
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.normal = vec3(1,0,0);   // Arbitrary; the phase function ignores it
+        rec.front_face = true;
+        rec.u = rec.v = 0;
+        rec.uv_density = 0;
+        rec.mat_id = phase_material;
+        return true;
+    }
+
+  private:
+    shared_ptr<hittable> boundary;
+    double density;
+    int phase_material;
+    shared_ptr<density_grid> grid;
+    aabb grid_box;
+    double majorant;
+};
+
+#endif
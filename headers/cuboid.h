@@ -0,0 +1,144 @@
+#ifndef CUBOID_H
+#define CUBOID_H
+
+#include "common.h"
+#include "hittable.h"
+
+#include <cmath>
+
+// Solid box intersected with one slab test. The face hit and its texture
+// coordinates follow from the axis of the entry or exit distance; the mapping
+// matches the six quads box() builds. An oriented cuboid is rotated about its
+// center, by rotation degrees around X, then Y, then Z.
+class cuboid : public hittable {
+  public:
+    cuboid(const point3& a, const point3& b, int _material, const vec3& rotation = vec3(0,0,0))
+      : mat(_material) {
+        center = 0.5 * (a + b);
+        for (int i = 0; i < 3; i++)
+            half[i] = 0.5 * fabs(b[i] - a[i]);
+
+        oriented = rotation.length_squared() > 0;
+        if (oriented) {
+            axes[0] = rotate(vec3(1,0,0), rotation);
+            axes[1] = rotate(vec3(0,1,0), rotation);
+            axes[2] = rotate(vec3(0,0,1), rotation);
+        }
+
+        // The world bounds of the rotated corners.
+        point3 low(infinity, infinity, infinity), high(-infinity, -infinity, -infinity);
+        for (int corner = 0; corner < 8; corner++) {
+            vec3 local((corner & 1) ? half[0] : -half[0], (corner & 2) ? half[1] : -half[1], (corner & 4) ? half[2] : -half[2]);
+            point3 p = center + to_world(local);
+            for (int i = 0; i < 3; i++) {
+                low[i] = fmin(low[i], p[i]);
+                high[i] = fmax(high[i], p[i]);
+            }
+        }
+        bbox = aabb(low, high).pad();
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    shared_ptr<hittable> replicate() const override { return make_shared<cuboid>(*this); }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        vec3 origin = to_local(r.origin() - center);
+        vec3 direction = to_local(r.direction());
+
+        // A slab the ray runs parallel to either contains the whole ray or none of it.
+        double t_near = -infinity, t_far = infinity;
+        int near_axis = -1, far_axis = -1;
+        for (int a = 0; a < 3; a++) {
+            if (direction[a] == 0) {
+                if (fabs(origin[a]) > half[a])
+                    return false;
+                continue;
+            }
+            auto inv = oriented ? 1 / direction[a] : r.inv_direction()[a];
+            auto t0 = (-half[a] - origin[a]) * inv;
+            auto t1 = (half[a] - origin[a]) * inv;
+            if (t0 > t1)
+                std::swap(t0, t1);
+            if (t0 > t_near) {
+                t_near = t0;
+                near_axis = a;
+            }
+            if (t1 < t_far) {
+                t_far = t1;
+                far_axis = a;
+            }
+        }
+        if (t_near > t_far || near_axis < 0)
+            return false;
+
+        // Entering through the near face, or leaving through the far one from inside.
+        double t;
+        int axis;
+        double side;
+        if (ray_t.surrounds(t_near)) {
+            t = t_near;
+            axis = near_axis;
+            side = (direction[axis] < 0) ? 1 : -1;
+        } else if (ray_t.surrounds(t_far)) {
+            t = t_far;
+            axis = far_axis;
+            side = (direction[axis] < 0) ? -1 : 1;
+        } else {
+            return false;
+        }
+
+        point3 local = origin + t * direction;
+        face_uv(local, axis, side, rec.u, rec.v);
+
+        vec3 outward(0,0,0);
+        outward[axis] = side;
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat_id = mat;
+        rec.uv_density = 1 / (2 * fmin(half[(axis + 1) % 3], half[(axis + 2) % 3]));
+        rec.set_face_normal(r, to_world(outward));
+        return true;
+    }
+
+  private:
+    point3 center;
+    vec3 half;
+    vec3 axes[3];           // Local axes in world space, when oriented
+    bool oriented = false;
+    int mat;
+    aabb bbox;
+
+    static vec3 rotate(vec3 v, const vec3& degrees) {
+        auto x = degrees_to_radians(degrees.x()), y = degrees_to_radians(degrees.y()), z = degrees_to_radians(degrees.z());
+        v = vec3(v.x(), cos(x)*v.y() - sin(x)*v.z(), sin(x)*v.y() + cos(x)*v.z());
+        v = vec3(cos(y)*v.x() + sin(y)*v.z(), v.y(), -sin(y)*v.x() + cos(y)*v.z());
+        return vec3(cos(z)*v.x() - sin(z)*v.y(), sin(z)*v.x() + cos(z)*v.y(), v.z());
+    }
+
+    vec3 to_local(const vec3& v) const {
+        return oriented ? vec3(dot(v, axes[0]), dot(v, axes[1]), dot(v, axes[2])) : v;
+    }
+
+    vec3 to_world(const vec3& v) const {
+        return oriented ? v.x() * axes[0] + v.y() * axes[1] + v.z() * axes[2] : v;
+    }
+
+    // Coordinates across the face as the matching quad of box() has them.
+    void face_uv(const point3& p, int axis, double side, double& u, double& v) const {
+        auto fraction = [&](int a) { return (half[a] > 0) ? (p[a] + half[a]) / (2 * half[a]) : 0.0; };
+        auto fx = fraction(0), fy = fraction(1), fz = fraction(2);
+        if (axis == 0) {
+            u = (side > 0) ? 1 - fz : fz;
+            v = fy;
+        } else if (axis == 1) {
+            u = fx;
+            v = (side > 0) ? 1 - fz : fz;
+        } else {
+            u = (side > 0) ? fx : 1 - fx;
+            v = fy;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef DISTRIBUTION_H
+#define DISTRIBUTION_H
+
+#include "common.h"
+
+#include <algorithm>
+#include <vector>
+
+// Piecewise-constant density over [0,1) built from n non-negative function values.
+class distribution_1d {
+  public:
+    distribution_1d(const double* f, int n) : func(f, f + n), cdf(n + 1) {
+        cdf[0] = 0;
+        for (int i = 0; i < n; i++)
+            cdf[i + 1] = cdf[i] + fabs(func[i]) / n;
+
+        integral = cdf[n];
+        for (int i = 1; i <= n; i++)
+            cdf[i] = (integral > 0) ? cdf[i] / integral : double(i) / n;
+    }
+
+    int count() const { return static_cast<int>(func.size()); }
+
+    double sample(double u, double& pdf, int& offset) const {
+        offset = static_cast<int>(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+        offset = std::clamp(offset, 0, count() - 1);
+
+        auto du = u - cdf[offset];
+        auto width = cdf[offset + 1] - cdf[offset];
+        if (width > 0)
+            du /= width;
+
+        pdf = density(offset);
+        return (offset + du) / count();
+    }
+
+    double density(int offset) const {
+        return (integral > 0) ? fabs(func[offset]) / integral : 1.0;
+    }
+
+    double integral;
+
+  private:
+    std::vector<double> func;
+    std::vector<double> cdf;
+};
+
+// Piecewise-constant density over [0,1)^2 from an nu x nv grid stored row by row.
+// Rows are picked from the marginal distribution of row integrals, then a column is
+// picked from that row's conditional distribution.
+class distribution_2d {
+  public:
+    distribution_2d(const double* f, int nu, int nv) {
+        conditional.reserve(nv);
+        std::vector<double> row_integrals(nv);
+        for (int v = 0; v < nv; v++) {
+            conditional.emplace_back(&f[size_t(v) * nu], nu);
+            row_integrals[v] = conditional.back().integral;
+        }
+        marginal = std::make_unique<distribution_1d>(row_integrals.data(), nv);
+    }
+
+    void sample(double u0, double u1, double& u, double& v, double& pdf) const {
+        double pdf_u, pdf_v;
+        int row, column;
+        v = marginal->sample(u1, pdf_v, row);
+        u = conditional[row].sample(u0, pdf_u, column);
+        pdf = pdf_u * pdf_v;
+    }
+
+    double pdf(double u, double v) const {
+        int column = std::clamp(static_cast<int>(u * conditional[0].count()), 0, conditional[0].count() - 1);
+        int row = std::clamp(static_cast<int>(v * marginal->count()), 0, marginal->count() - 1);
+        return conditional[row].density(column) * marginal->density(row);
+    }
+
+    double integral() const { return marginal->integral; }
+
+  private:
+    std::vector<distribution_1d> conditional;
+    std::unique_ptr<distribution_1d> marginal;
+};
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef GEOMETRY_PAGES_H
+#define GEOMETRY_PAGES_H
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "primitive_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Out-of-core bulk geometry. The primitives of a primitive file are ordered along a
+// Morton curve through their centroids and split where their codes first differ,
+// as a linear BVH would, until each part holds at most page_size primitives. A
+// page is thus one subtree of that BVH, filling its own cell of space. Pages are
+// written back to back to one file of fixed size records and the scene keeps only
+// each page's bounds. The first ray to enter a page's bounds maps the page, decodes
+// it and builds its BVH; built pages live in a cache bounded by a byte budget
+// shared by every paged file, and the least recently used are dropped first.
+
+struct page_record {
+    double values[9];   // Center and radius, or Q, u and v
+    int32_t kind;       // 0 for a sphere, 1 for a quad
+    int32_t material;
+
+    aabb bounds() const {
+        if (kind == 0)
+            return sphere(point3(values[0], values[1], values[2]), values[3], material).bounding_box();
+        return quad(point3(values[0], values[1], values[2]), vec3(values[3], values[4], values[5]),
+                    vec3(values[6], values[7], values[8]), material).bounding_box();
+    }
+};
+
+struct geometry_page {
+    shared_ptr<primitive_arena> primitives;
+    shared_ptr<hittable> bvh;
+    size_t bytes = 0;
+    bool complete = true;   // False if the page could not be read; it is then not cached
+};
+
+// Built pages of every paged file, keyed by file and page.
+class geometry_cache {
+  public:
+    geometry_cache(size_t budget_bytes = size_t(1) << 30)
+      : budget(budget_bytes), serial(next_serial()) {}
+
+    static geometry_cache& global() {
+        static geometry_cache cache;
+        return cache;
+    }
+
+    void set_budget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    size_t resident_bytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return resident;
+    }
+
+    size_t page_loads() const { return loads; }
+
+    // The page for key, calling load() on a miss. Each thread keeps the last two
+    // pages it used, so rays staying in a page do not take the lock; those stay
+    // alive past eviction, outside the budget, until the thread moves on.
+    const geometry_page& fetch(uint64_t key, const std::function<shared_ptr<const geometry_page>()>& load) {
+        static thread_local thread_slot slots[thread_slots];
+
+        thread_slot& slot = slots[(key * 0x9E3779B97F4A7C15ull) >> 63];
+        if (slot.owner != serial || slot.key != key) {
+            slot.data = lookup(key, load);
+            slot.owner = slot.data->complete ? serial : 0;
+            slot.key = key;
+        }
+        return *slot.data;
+    }
+
+  private:
+    struct entry {
+        shared_ptr<const geometry_page> data;
+        std::list<uint64_t>::iterator position;
+    };
+
+    struct thread_slot {
+        uint64_t owner = 0;
+        uint64_t key = 0;
+        shared_ptr<const geometry_page> data;
+    };
+
+    static constexpr int thread_slots = 2;
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, entry> entries;
+    std::list<uint64_t> recency;
+    std::atomic<size_t> loads{0};
+    size_t resident = 0;
+    size_t budget;
+    uint64_t serial;
+
+    static uint64_t next_serial() {
+        static std::atomic<uint64_t> counter{1};
+        return counter++;
+    }
+
+    shared_ptr<const geometry_page> lookup(uint64_t key, const std::function<shared_ptr<const geometry_page>()>& load) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = entries.find(key);
+            if (found != entries.end()) {
+                recency.splice(recency.begin(), recency, found->second.position);
+                return found->second.data;
+            }
+        }
+
+        // Build outside the lock so other threads keep tracing while this page loads.
+        auto built = load();
+        loads++;
+        if (!built->complete)
+            return built;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = entries.find(key);
+        if (found != entries.end())
+            return found->second.data;
+
+        recency.push_front(key);
+        entries[key] = entry{built, recency.begin()};
+        resident += built->bytes;
+        evict();
+        return built;
+    }
+
+    void evict() {
+        while (resident > budget && entries.size() > 1) {
+            auto last = entries.find(recency.back());
+            resident -= last->second.data->bytes;
+            entries.erase(last);
+            recency.pop_back();
+        }
+    }
+};
+
+struct paged_geometry_stats : primitive_load_stats {
+    size_t pages = 0;
+};
+
+class paged_geometry : public std::enable_shared_from_this<paged_geometry> {
+  public:
+    ~paged_geometry() {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // Pages the primitives of the file at path into pages_path, reading the text
+    // three times: for the bounds of all centroids, for the Morton order, and to
+    // write each record into its page. Only the order, eight bytes per primitive,
+    // is held in memory meanwhile. Returns null when either file cannot be used.
+    static shared_ptr<paged_geometry> build(const std::string& path, const std::string& pages_path, int default_material,
+                                            const std::map<std::string, int>& materials, size_t page_size = 512,
+                                            paged_geometry_stats* stats = nullptr,
+                                            geometry_cache& cache = geometry_cache::global(),
+                                            size_t chunk_bytes = size_t(4) << 20) {
+        auto start = std::chrono::steady_clock::now();
+        paged_geometry_stats counts;
+        page_size = std::max<size_t>(page_size, 1);
+
+        aabb centroids;
+        size_t total = 0;
+        size_t bytes = 0;
+        auto read = [&](auto consume) {
+            bytes = 0;
+            return primitive_file::read_chunks<record_chunk>(path, default_material, materials, chunk_bytes, bytes, consume);
+        };
+
+        if (!read([&](record_chunk& slice) {
+                for (const auto& r : slice.records)
+                    centroids = aabb(centroids, aabb(centroid(r), centroid(r)));
+                total += slice.records.size();
+                counts.skipped += slice.skipped;
+            }))
+            return nullptr;
+        counts.bytes = bytes;
+
+        // Morton code above, file position below; sorted, the position of each entry
+        // is where that primitive goes.
+        std::vector<uint64_t> order;
+        order.reserve(total);
+        read([&](record_chunk& slice) {
+            for (const auto& r : slice.records)
+                order.push_back((morton_code(centroid(r), centroids) << 34) | order.size());
+        });
+        std::sort(order.begin(), order.end());
+        std::vector<size_t> firsts;
+        split_pages(order, 0, order.size(), page_size, firsts);
+        firsts.push_back(order.size());
+
+        std::vector<uint32_t> slot(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+            slot[order[i] & ((uint64_t(1) << 34) - 1)] = static_cast<uint32_t>(i);
+        order = std::vector<uint64_t>();
+
+        auto geometry = shared_ptr<paged_geometry>(new paged_geometry(cache));
+        geometry->fd = open(pages_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (geometry->fd < 0) {
+            std::cerr << "Error: Cannot write geometry pages to '" << pages_path << "'." << std::endl;
+            return nullptr;
+        }
+
+        size_t page_count = firsts.size() - 1;
+        geometry->pages.resize(page_count);
+        geometry->failures = std::make_unique<page_failures[]>(page_count);
+        for (size_t p = 0; p < page_count; p++) {
+            geometry->pages[p].first = firsts[p];
+            geometry->pages[p].count = firsts[p + 1] - firsts[p];
+        }
+
+        // Records collect per page and go out in runs of pending_records.
+        const size_t pending_records = 256;
+        std::vector<std::vector<page_record>> pending(page_count);
+        std::vector<size_t> written(page_count, 0);
+        bool failed = false;
+        auto flush = [&](size_t p) {
+            auto offset = (geometry->pages[p].first + written[p]) * sizeof(page_record);
+            auto size = pending[p].size() * sizeof(page_record);
+            if (pwrite(geometry->fd, pending[p].data(), size, off_t(offset)) != ssize_t(size))
+                failed = true;
+            written[p] += pending[p].size();
+            pending[p].clear();
+        };
+
+        size_t index = 0;
+        read([&](record_chunk& slice) {
+            for (const auto& r : slice.records) {
+                size_t p = std::upper_bound(firsts.begin(), firsts.end(), slot[index++]) - firsts.begin() - 1;
+                geometry->pages[p].bounds = aabb(geometry->pages[p].bounds, r.bounds());
+                pending[p].push_back(r);
+                (r.kind == 0 ? counts.spheres : counts.quads)++;
+                if (pending[p].size() == pending_records)
+                    flush(p);
+            }
+        });
+        for (size_t p = 0; p < page_count; p++)
+            if (!pending[p].empty())
+                flush(p);
+        if (failed) {
+            std::cerr << "Error: Cannot write geometry pages to '" << pages_path << "'." << std::endl;
+            return nullptr;
+        }
+
+        counts.pages = page_count;
+        counts.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (stats)
+            *stats = counts;
+        return geometry;
+    }
+
+    size_t page_count() const { return pages.size(); }
+    const aabb& page_bounds(size_t p) const { return pages[p].bounds; }
+
+    // A page that could not be mapped stands empty until its next attempt, which
+    // backs off with every failure, so rays entering it do not each call mmap.
+    const geometry_page& page(size_t p) const {
+        const auto& failed = failures[p];
+        if (failed.count.load(std::memory_order_relaxed) > 0 && now_ms() < failed.retry_at.load())
+            return missing;
+        return cache.fetch((serial << 32) | p, [&] { return load(p); });
+    }
+
+    // Adds one object per page to world, each standing for the page's primitives.
+    void add_pages(hittable_list& world) {
+        for (size_t p = 0; p < pages.size(); p++)
+            world.add(make_shared<page_proxy>(shared_from_this(), p));
+    }
+
+  private:
+    struct page_extent {
+        size_t first = 0;
+        size_t count = 0;
+        aabb bounds;
+    };
+
+    struct page_failures {
+        std::atomic<int> count{0};
+        std::atomic<int64_t> retry_at{0};   // In now_ms() time
+    };
+
+    struct record_chunk {
+        std::vector<page_record> records;
+        size_t skipped = 0;
+
+        void add_sphere(const point3& center, double radius, int material) {
+            page_record r = {{center.x(), center.y(), center.z(), radius}, 0, material};
+            records.push_back(r);
+        }
+
+        void add_quad(const point3& Q, const vec3& u, const vec3& v, int material) {
+            page_record r = {{Q.x(), Q.y(), Q.z(), u.x(), u.y(), u.z(), v.x(), v.y(), v.z()}, 1, material};
+            records.push_back(r);
+        }
+    };
+
+    class page_proxy : public hittable {
+      public:
+        page_proxy(shared_ptr<const paged_geometry> _owner, size_t _page) : owner(_owner), page(_page) {}
+
+        // Tests the page's bounds first so only rays reaching the page load it.
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (!owner->page_bounds(page).hit(r, ray_t))
+                return false;
+            return owner->page(page).bvh->hit(r, ray_t, rec);
+        }
+
+        aabb bounding_box() const override { return owner->page_bounds(page); }
+
+      private:
+        shared_ptr<const paged_geometry> owner;
+        size_t page;
+    };
+
+    int fd = -1;
+    std::vector<page_extent> pages;
+    std::unique_ptr<page_failures[]> failures;
+    geometry_page missing;
+    geometry_cache& cache;
+    uint64_t serial;
+
+    explicit paged_geometry(geometry_cache& _cache) : cache(_cache) {
+        static std::atomic<uint64_t> counter{1};
+        serial = counter++;
+        missing.primitives = make_shared<primitive_arena>();
+        missing.bvh = make_shared<hittable_list>();
+        missing.complete = false;
+    }
+
+    static int64_t now_ms() {
+        auto since = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(since).count();
+    }
+
+    static point3 centroid(const page_record& r) {
+        if (r.kind == 0)
+            return point3(r.values[0], r.values[1], r.values[2]);
+        return point3(r.values[0] + 0.5 * (r.values[3] + r.values[6]), r.values[1] + 0.5 * (r.values[4] + r.values[7]),
+                      r.values[2] + 0.5 * (r.values[5] + r.values[8]));
+    }
+
+    // Appends the first entry of every page in sorted codes [begin, end).
+    static void split_pages(const std::vector<uint64_t>& order, size_t begin, size_t end, size_t page_size,
+                            std::vector<size_t>& firsts) {
+        if (end - begin <= page_size) {
+            firsts.push_back(begin);
+            return;
+        }
+
+        auto first = order[begin] >> 34, last = order[end - 1] >> 34;
+        size_t middle = begin + (end - begin) / 2;
+        if (first != last) {
+            // The first entry with the highest differing bit set.
+            int bit = 63 - __builtin_clzll(first ^ last);
+            auto split = ((last >> bit) << bit) << 34;
+            middle = std::lower_bound(order.begin() + begin, order.begin() + end, split) - order.begin();
+        }
+        split_pages(order, begin, middle, page_size, firsts);
+        split_pages(order, middle, end, page_size, firsts);
+    }
+
+    shared_ptr<const geometry_page> load(size_t p) const {
+        const auto& extent = pages[p];
+        auto page_bytes = size_t(sysconf(_SC_PAGESIZE));
+        auto offset = extent.first * sizeof(page_record);
+        auto aligned = offset / page_bytes * page_bytes;
+        auto length = offset - aligned + extent.count * sizeof(page_record);
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, off_t(aligned));
+        int error = errno;
+
+        auto built = make_shared<geometry_page>();
+        built->primitives = make_shared<primitive_arena>();
+        hittable_list objects;
+        if (mapped != MAP_FAILED) {
+            auto records = reinterpret_cast<const page_record*>(static_cast<const char*>(mapped) + (offset - aligned));
+            for (size_t i = 0; i < extent.count; i++) {
+                const auto& r = records[i];
+                if (r.kind == 0)
+                    built->primitives->spheres.emplace_back(point3(r.values[0], r.values[1], r.values[2]), r.values[3], r.material);
+                else
+                    built->primitives->quads.emplace_back(point3(r.values[0], r.values[1], r.values[2]),
+                                                          vec3(r.values[3], r.values[4], r.values[5]),
+                                                          vec3(r.values[6], r.values[7], r.values[8]), r.material);
+            }
+            munmap(mapped, length);
+        } else {
+            // Retry after 10 ms, doubling up to about 10 s; report only the first failure.
+            int count = ++failures[p].count;
+            failures[p].retry_at = now_ms() + (int64_t(10) << std::min(count - 1, 10));
+            if (count == 1)
+                std::cerr << "Error: Cannot map geometry page " << p << ": " << std::strerror(error)
+                          << ". Its primitives are missing until it can be mapped." << std::endl;
+            built->complete = false;
+        }
+
+        for (auto& s : built->primitives->spheres)
+            objects.add(shared_ptr<hittable>(built->primitives, &s));
+        for (auto& q : built->primitives->quads)
+            objects.add(shared_ptr<hittable>(built->primitives, &q));
+        if (objects.objects.empty())
+            built->bvh = make_shared<hittable_list>();
+        else
+            built->bvh = make_shared<bvh_node>(objects);
+
+        // Primitives, and a node with its control block for every two, as leaves hold two.
+        built->bytes = built->primitives->spheres.size() * sizeof(sphere) + built->primitives->quads.size() * sizeof(quad)
+                     + objects.objects.size() / 2 * (sizeof(bvh_node) + 2 * sizeof(shared_ptr<hittable>));
+        return built;
+    }
+};
+
+#endif
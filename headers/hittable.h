@@ -1,38 +1,46 @@
-#ifndef HITTABLE_H
-#define HITTABLE_H
-
-#include "common.h"
-#include "aabb.h"
-
-class material;
-
-class hit_record {
-  public:
-    point3 p;
-    vec3 normal;
-    shared_ptr<material> mat;
-    double t;
-    double u;
-    double v;
-    bool front_face;
-
-    void set_face_normal(const ray& r, const vec3& outward_normal) {
+#ifndef HITTABLE_H
+#define HITTABLE_H
+
+#include "common.h"
+#include "aabb.h"
+
+class hit_record {
+  public:
+    point3 p;
+    vec3 normal;
+    int mat_id;
+    double t;
+    double u;
+    double v;
+    double uv_density;
+    double footprint = 0;
+    bool front_face;
+
+    void set_face_normal(const ray& r, const vec3& outward_normal) {
         
         
-
-        front_face = dot(r.direction(), outward_normal) < 0;
-        normal = front_face ? outward_normal : -outward_normal;
-    }
-};
-
-class hittable {
-  public:
-    virtual ~hittable() = default;
-
-    virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
-
-    virtual aabb bounding_box() const = 0;
-
-};
-
+
+        front_face = dot(r.direction(), outward_normal) < 0;
+        normal = front_face ? outward_normal : -outward_normal;
+    }
+};
+
+class hittable {
+  public:
+    virtual ~hittable() = default;
+
+    virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+    virtual aabb bounding_box() const = 0;
+
+    // Bounds at a single instant. Only moving objects need to override this;
+    // bounding_box() has to enclose every position over their motion.
+    virtual aabb bounding_box_at(double time) const { return bounding_box(); }
+
+    // A deep copy for threads on another NUMA node to read locally, or null when
+    // the object should be shared instead.
+    virtual shared_ptr<hittable> replicate() const { return nullptr; }
+
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,92 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+// Thread-safe cache of at most capacity values, evicting the least recently used.
+// Values are built outside the lock; callers asking for a key that is still being
+// built wait for that build instead of starting another. Evicted values stay alive
+// for as long as someone still holds them.
+template <typename Key, typename Value>
+class lru_cache {
+  public:
+    using pointer = std::shared_ptr<const Value>;
+
+    explicit lru_cache(size_t _capacity) : capacity(_capacity > 0 ? _capacity : 1) {}
+
+    // Returns the value for key, calling create() on a miss. hit, when given, reports
+    // whether the value was already cached. Exceptions from create() propagate to
+    // every waiting caller and leave nothing cached.
+    pointer get(const Key& key, const std::function<pointer()>& create, bool* hit = nullptr) {
+        std::promise<pointer> promise;
+        std::shared_future<pointer> future;
+        bool building = false;
+        uint64_t build = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                order.splice(order.begin(), order, it->second.position);
+                future = it->second.value;
+            } else {
+                future = promise.get_future().share();
+                order.push_front(key);
+                build = ++builds;
+                entries.emplace(key, entry{future, order.begin(), build});
+                building = true;
+                while (entries.size() > capacity) {
+                    entries.erase(order.back());
+                    order.pop_back();
+                }
+            }
+        }
+        if (hit)
+            *hit = !building;
+
+        if (building) {
+            try {
+                promise.set_value(create());
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+                erase(key, build);
+            }
+        }
+        return future.get();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+  private:
+    struct entry {
+        std::shared_future<pointer> value;
+        typename std::list<Key>::iterator position;
+        uint64_t build;
+    };
+
+    size_t capacity;
+    uint64_t builds = 0;
+    std::list<Key> order;    // Most recently used first
+    std::map<Key, entry> entries;
+    mutable std::mutex mutex;
+
+    // Drops a failed build unless it was already evicted and the key rebuilt.
+    void erase(const Key& key, uint64_t build) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.build == build) {
+            order.erase(it->second.position);
+            entries.erase(it);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// The CPUs of each NUMA node, for keeping render threads next to the memory they
+// use. detect() reads the machine's nodes from sysfs; simulated() splits the CPUs
+// the process may run on into equal nodes, so the placement can be exercised and
+// timed on a single-node machine. Memory policy calls go straight to the kernel,
+// so nothing extra is linked.
+class numa_topology {
+  public:
+    std::vector<std::vector<int>> cpus;     // CPUs of each node
+    std::vector<int> memory_nodes;          // Physical nodes pages may be placed on
+
+    static numa_topology detect() {
+        numa_topology topology;
+        topology.memory_nodes = read_list("/sys/devices/system/node/online");
+        for (auto node : topology.memory_nodes) {
+            auto node_cpus = read_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!node_cpus.empty())
+                topology.cpus.push_back(node_cpus);
+        }
+        if (topology.cpus.empty())
+            topology.cpus.push_back(allowed_cpus());
+        if (topology.memory_nodes.empty())
+            topology.memory_nodes.push_back(0);
+        return topology;
+    }
+
+    // nodes nodes over the allowed CPUs in order; when there are fewer CPUs than
+    // nodes, nodes share them.
+    static numa_topology simulated(int nodes) {
+        numa_topology topology = detect();
+        auto allowed = allowed_cpus();
+        nodes = std::max(nodes, 1);
+        topology.cpus.assign(nodes, {});
+        for (int node = 0; node < nodes; node++) {
+            size_t first = node * allowed.size() / nodes, last = (node + 1) * allowed.size() / nodes;
+            for (size_t i = first; i < last; i++)
+                topology.cpus[node].push_back(allowed[i]);
+            if (topology.cpus[node].empty())
+                topology.cpus[node].push_back(allowed[node % allowed.size()]);
+        }
+        return topology;
+    }
+
+    int nodes() const { return static_cast<int>(cpus.size()); }
+
+    // Node of thread of threads, spreading threads over the nodes in equal blocks.
+    int node_of(int thread, int threads) const { return int(long(thread) * nodes() / std::max(threads, 1)); }
+
+    bool pin(int node) const { return set_affinity(cpus[node]); }
+
+    static std::vector<int> allowed_cpus() {
+        std::vector<int> result;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if (CPU_ISSET(cpu, &set))
+                    result.push_back(cpu);
+        if (result.empty())
+            result.push_back(0);
+        return result;
+    }
+
+    // Restricts the calling thread to cpus.
+    static bool set_affinity(const std::vector<int>& cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : cpus)
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+
+    // Spreads the pages the calling thread allocates from now on round-robin over
+    // the memory nodes, or goes back to placing them on the node touching them.
+    bool interleave(bool on) const {
+        const int mpol_default = 0, mpol_interleave = 3;
+        unsigned long mask = 0;
+        for (auto node : memory_nodes)
+            if (node >= 0 && node < int(8 * sizeof(mask)))
+                mask |= 1ul << node;
+        if (!on)
+            return syscall(SYS_set_mempolicy, mpol_default, nullptr, 0) == 0;
+        return syscall(SYS_set_mempolicy, mpol_interleave, &mask, 8 * sizeof(mask)) == 0;
+    }
+
+  private:
+    // Parses a sysfs list such as "0-3,8,10-11".
+    static std::vector<int> read_list(const std::string& path) {
+        std::vector<int> result;
+        std::ifstream in(path);
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            int first = 0, last = 0;
+            char dash = 0;
+            std::istringstream parts(range);
+            if (!(parts >> first))
+                continue;
+            if (!(parts >> dash >> last) || dash != '-')
+                last = first;
+            for (int i = first; i <= last; i++)
+                result.push_back(i);
+        }
+        return result;
+    }
+};
+
+// n values in fresh anonymous pages, left unwritten so each page is placed on the
+// node of the thread that first writes to it. Unwritten values read as zero bytes.
+template <typename T>
+class first_touch_buffer {
+    static_assert(std::is_trivially_copyable<T>::value, "first_touch_buffer holds raw bytes");
+
+  public:
+    explicit first_touch_buffer(size_t n) : count(n), bytes(std::max<size_t>(n * sizeof(T), 1)) {
+        void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            throw std::bad_alloc();
+        values = static_cast<T*>(memory);
+    }
+
+    ~first_touch_buffer() { munmap(values, bytes); }
+
+    first_touch_buffer(const first_touch_buffer&) = delete;
+    first_touch_buffer& operator=(const first_touch_buffer&) = delete;
+
+    T* data() { return count ? values : nullptr; }
+    size_t size() const { return count; }
+
+    std::vector<T> to_vector() const { return std::vector<T>(values, values + count); }
+
+  private:
+    size_t count;
+    size_t bytes;
+    T* values;
+};
+
+#endif
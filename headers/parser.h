@@ -1,154 +1,569 @@
-#include "./../camera/camera.h"
-#include "./../material/material.h"
-
-#include <yaml-cpp/yaml.h>
-#include <fstream>
-
-int checkargs(int argc, char* argv[]){
-    if (argc <= 1 || (argc == 2 && std::string(argv[1]) == "-h")) {
-        std::cerr << "\n\n\nUsage: raytracer [OPTION]... SOURCE FILE\n\n" << std::endl;
-        std::cerr << "Optional arguments to configure iamge or camera." << std::endl;
-        std::cerr << "  -ar  [double]                           Ratio of image width over height" << std::endl;
-        std::cerr << "  -iw  [int]                              Rendered image width in pixel count" << std::endl;
-        std::cerr << "  -spp [int]                              Number of rays sent into each pixel" << std::endl;
-        std::cerr << "  -md  [int]                              Maximum number of ray bounces into the scene" << std::endl;
-        std::cerr << "  -bg  [double] [double] [double]         Background color of the rendered scene" << std::endl;
-        std::cerr << "                                           Represents the color seen behind objects in the scene." << std::endl;
-        std::cerr << "  -vf  [double]                           Vertical field of view in degrees" << std::endl;
-        std::cerr << "                                           Determines how much of the scene is visible vertically." << std::endl;
-        std::cerr << "  -lf  [int] [int] [int]                  Camera's initial position in 3D space (x, y, z)" << std::endl;
-        std::cerr << "                                           Defines where the camera is located within the scene." << std::endl;
-        std::cerr << "  -la  [int] [int] [int]                  The point the camera is looking at in 3D space (x, y, z)" << std::endl;
-        std::cerr << "                                           Specifies the point or object the camera is aimed towards." << std::endl;
-        std::cerr << "  -vu  [int] [int] [int]                  Up direction of the camera in 3D space (x, y, z)" << std::endl;
-        std::cerr << "                                           Sets the orientation of the camera's 'up' direction." << std::endl;
-        std::cerr << "  -da [double]                            Angle used for defocusing (if applicable)" << std::endl;
-        std::cerr << "                                           Determines the amount of blur in out-of-focus areas." << std::endl;
-        std::cerr << "  -fd [double]                            Distance for focusing (if applicable)" << std::endl;
-        std::cerr << "                                           Represents the distance at which objects are in sharp focus." << std::endl;
-
-        return 0;
-    }
-    return 1;
-}
-
-void configurecamera(int argc, char* argv[], camera* cam){
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "-ar" && i + 1 < argc) {
-            cam->aspect_ratio = std::stod(argv[++i]);
-        } else if (arg == "-iw" && i + 1 < argc) {
-            cam->image_width = std::stoi(argv[++i]);
-        } else if (arg == "-spp" && i + 1 < argc) {
-            cam->samples_per_pixel = std::stoi(argv[++i]);
-        } else if (arg == "-md" && i + 1 < argc) {
-            cam->max_depth = std::stoi(argv[++i]);
-        } else if (arg == "-bg" && i + 3 < argc) {
-            double r = std::stod(argv[++i]);
-            double g = std::stod(argv[++i]);
-            double b = std::stod(argv[++i]);
-            cam->background = color(r, g, b);
-        } else if (arg == "-vf" && i + 1 < argc) {
-            cam->vfov = std::stod(argv[++i]);
-        } else if (arg == "-lf" && i + 2 < argc) {
-            double x = std::stod(argv[++i]);
-            double y = std::stod(argv[++i]);
-            double z = std::stod(argv[++i]);
-            cam->lookfrom = point3(x, y, z);
-        } else if (arg == "-la" && i + 2 < argc) {
-            double x = std::stod(argv[++i]);
-            double y = std::stod(argv[++i]);
-            double z = std::stod(argv[++i]);
-            cam->lookat = point3(x, y, z);
-        } else if (arg == "-vu" && i + 2 < argc) {
-            double x = std::stod(argv[++i]);
-            double y = std::stod(argv[++i]);
-            double z = std::stod(argv[++i]);
-            cam->vup = vec3(x, y, z);
-        } else if (arg == "-da" && i + 1 < argc) {
-            cam->defocus_angle = std::stod(argv[++i]);
-        } else if (arg == "-fd" && i + 1 < argc) {
-            cam->focus_dist = std::stod(argv[++i]);
-        }
-    }
-}
-
-void createscene(const std::string& filename, camera* cam, hittable_list* world){
-    std::ifstream file(filename);
-    if (!file.good()) {
-        std::cerr << "Error: File '" << filename << "' does not exist or cannot be opened." << std::endl;
-        return;
-    }
-    YAML::Node config = YAML::LoadFile(filename);
-    std::map<std::string, std::shared_ptr<material>> materialsMap;
-
-    cam->aspect_ratio = config["image"]["aspect_ratio"].as<double>();
-    cam->image_width = config["image"]["image_width"].as<int>();
-    cam->samples_per_pixel = config["image"]["samples_per_pixel"].as<int>();
-    cam->max_depth = config["image"]["max_depth"].as<int>();
-    std::vector<double> background = config["image"]["background"].as<std::vector<double>>();
-    cam->background = color(background[0], background[1], background[2]);
-
-    cam-> vfov = config["camera"]["vfov"].as<double>();
-    std::vector<double> lookFrom = config["camera"]["look_from"].as<std::vector<double>>();
-    cam->lookfrom = point3(lookFrom[0], lookFrom[1], lookFrom[2]);
-    std::vector<double> lookAt = config["camera"]["look_at"].as<std::vector<double>>();
-    cam->lookat = point3(lookAt[0], lookAt[1], lookAt[2]);
-    std::vector<double> vup = config["camera"]["vup"].as<std::vector<double>>();
-    cam->vup = vec3(vup[0], vup[1], vup[2]);
-
-    cam->defocus_angle = config["depth_of_field"]["defocus_angle"].as<double>();
-    cam->focus_dist = config["depth_of_field"]["focus_dist"].as<double>();
-
-    for (const auto& material : config["materials"]) {
-        std::string name = material.first.as<std::string>();
-        std::string type = material.second["type"].as<std::string>();
-
-        if (type == "lambertian") {
-            auto colorValues = material.second["color"];
-            auto lambertianMaterial = make_shared<lambertian>(color(colorValues[0].as<double>(), colorValues[1].as<double>(), colorValues[2].as<double>()));
-            materialsMap[name] = lambertianMaterial;
-        } else if (type == "metal") {
-            auto colorValues = material.second["color"];
-            double fuzziness = material.second["fuzziness"].as<double>();
-            auto metalMaterial = make_shared<metal>(color(colorValues[0].as<double>(), colorValues[1].as<double>(), colorValues[2].as<double>()), fuzziness);
-            materialsMap[name] = metalMaterial;
-        } else if (type == "dielectric") {
-            double indexOfRefraction = material.second["index_of_refraction"].as<double>();
-            auto dielectricMaterial = make_shared<dielectric>(indexOfRefraction);
-            materialsMap[name] = dielectricMaterial;
-        } else if (type == "diffuse_light") {
-            auto colorValues = material.second["color"];
-            auto diffuseLightMaterial = make_shared<diffuse_light>(color(colorValues[0].as<double>(), colorValues[1].as<double>(), colorValues[2].as<double>()));
-            materialsMap[name] = diffuseLightMaterial;
-        }
-    }
-
-    for (const auto& obj : config["objects"]) {
-        std::string type = obj["type"].as<std::string>();
-
-        if (type == "quad") {
-            auto parameters = obj["parameters"];
-            point3 Q(parameters["Q"][0].as<double>(), parameters["Q"][1].as<double>(), parameters["Q"][2].as<double>());
-            vec3 u(parameters["u"][0].as<double>(), parameters["u"][1].as<double>(), parameters["u"][2].as<double>());
-            vec3 v(parameters["v"][0].as<double>(), parameters["v"][1].as<double>(), parameters["v"][2].as<double>());
-            std::string materialName = parameters["material"].as<std::string>();
-
-            world->add(make_shared<quad>(Q, u, v, materialsMap[materialName]));
-        } else if (type == "box") {
-            auto parameters = obj["parameters"];
-            point3 a(parameters["a"][0].as<double>(), parameters["a"][1].as<double>(), parameters["a"][2].as<double>());
-            point3 b(parameters["b"][0].as<double>(), parameters["b"][1].as<double>(), parameters["b"][2].as<double>());
-            std::string materialName = parameters["material"].as<std::string>();
-
-            world->add(box(a, b, materialsMap[materialName]));
-        } else if (type == "sphere") {
-            auto parameters = obj["parameters"];
-            point3 center(parameters["center"][0].as<double>(), parameters["center"][1].as<double>(), parameters["center"][2].as<double>());
-            double radius = parameters["radius"].as<double>();
-            std::string materialName = parameters["material"].as<std::string>();
-
-            world->add(make_shared<sphere>(center, radius, materialsMap[materialName]));
-        }
-    }
-}
\ No newline at end of file
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "./../camera/animation.h"
+#include "./../camera/camera.h"
+#include "./../camera/distributed.h"
+#include "./../material/material.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "cuboid.h"
+#include "geometry_pages.h"
+#include "numa.h"
+#include "primitive_file.h"
+
+#include <yaml-cpp/yaml.h>
+#include <fstream>
+#include <sstream>
+
+int checkargs(int argc, char* argv[]){
+    if (argc <= 1 || (argc == 2 && std::string(argv[1]) == "-h")) {
+        std::cerr << "\n\n\nUsage: raytracer [OPTION]... SOURCE FILE" << std::endl;
+        std::cerr << "  or:  raytracer -worker [host] [port]" << std::endl;
+        std::cerr << "  or:  raytracer -stitch [output] [partial image]..." << std::endl;
+        std::cerr << "  or:  raytracer -server [-jobs int] [-cache int] [-tc int] [-gc int] [socket path]" << std::endl;
+        std::cerr << "         Renders JSON jobs read from the socket, or from stdin, one per line:" << std::endl;
+        std::cerr << "         {\"id\": 1, \"scene\": \"scene.yaml\", \"output\": \"out.ppm\", \"options\": {\"spp\": 64}}\n\n" << std::endl;
+        std::cerr << "Optional arguments to configure iamge or camera." << std::endl;
+        std::cerr << "  -ar  [double]                           Ratio of image width over height" << std::endl;
+        std::cerr << "  -iw  [int]                              Rendered image width in pixel count" << std::endl;
+        std::cerr << "  -spp [int]                              Number of rays sent into each pixel" << std::endl;
+        std::cerr << "  -md  [int]                              Maximum number of ray bounces into the scene" << std::endl;
+        std::cerr << "  -bg  [double] [double] [double]         Background color of the rendered scene" << std::endl;
+        std::cerr << "                                           Represents the color seen behind objects in the scene." << std::endl;
+        std::cerr << "  -env [file]                             HDR equirectangular environment map lighting the scene" << std::endl;
+        std::cerr << "                                           Replaces the background color for rays that leave the scene." << std::endl;
+        std::cerr << "  -vf  [double]                           Vertical field of view in degrees" << std::endl;
+        std::cerr << "                                           Determines how much of the scene is visible vertically." << std::endl;
+        std::cerr << "  -lf  [int] [int] [int]                  Camera's initial position in 3D space (x, y, z)" << std::endl;
+        std::cerr << "                                           Defines where the camera is located within the scene." << std::endl;
+        std::cerr << "  -la  [int] [int] [int]                  The point the camera is looking at in 3D space (x, y, z)" << std::endl;
+        std::cerr << "                                           Specifies the point or object the camera is aimed towards." << std::endl;
+        std::cerr << "  -vu  [int] [int] [int]                  Up direction of the camera in 3D space (x, y, z)" << std::endl;
+        std::cerr << "                                           Sets the orientation of the camera's 'up' direction." << std::endl;
+        std::cerr << "  -da [double]                            Angle used for defocusing (if applicable)" << std::endl;
+        std::cerr << "                                           Determines the amount of blur in out-of-focus areas." << std::endl;
+        std::cerr << "  -fd [double]                            Distance for focusing (if applicable)" << std::endl;
+        std::cerr << "                                           Represents the distance at which objects are in sharp focus." << std::endl;
+        std::cerr << "  -sh [double] [double]                   Shutter open and close time for motion blur" << std::endl;
+        std::cerr << "                                           Moving objects are blurred over this interval." << std::endl;
+        std::cerr << "  -denoise                                Filter the rendered image guided by albedo, normal and depth" << std::endl;
+        std::cerr << "                                           Makes low sample counts usable." << std::endl;
+        std::cerr << "  -spectral                               Trace four wavelengths per sample instead of RGB" << std::endl;
+        std::cerr << "                                           Dispersive glass splits light into colors." << std::endl;
+        std::cerr << "  -exposure [double]                      Scale the image by 2 to this power before tone mapping" << std::endl;
+        std::cerr << "  -tonemap [clip|reinhard|aces]           Tone curve mapping the image into the displayable range" << std::endl;
+        std::cerr << "  -srgb                                   Encode the image with the sRGB curve instead of writing linear values" << std::endl;
+        std::cerr << "  -dither                                 Apply ordered dithering before quantizing, hiding banding" << std::endl;
+        std::cerr << "  -bits [8|16]                            Bits per channel of the written image" << std::endl;
+        std::cerr << "  -binary                                 Write a binary P6 image instead of text P3" << std::endl;
+        std::cerr << "  -rr [int]                               Russian roulette from this bounce on, ending dim paths early" << std::endl;
+        std::cerr << "  -sortrays                               Trace each bounce of a tile's paths together, sorted by direction and origin" << std::endl;
+        std::cerr << "  -aov [prefix]                           Also write albedo, normal and depth images starting with prefix" << std::endl;
+        std::cerr << "  -exr [file]                             Also write beauty and all feature channels to one OpenEXR file" << std::endl;
+        std::cerr << "                                           Includes direct/indirect light, depth, normal, material ID and time." << std::endl;
+        std::cerr << "  -crop [int] [int] [int] [int]           Render only pixels x0 y0 up to x1 y1 of the frame" << std::endl;
+        std::cerr << "                                           The partial image records its offset for -stitch." << std::endl;
+        std::cerr << "  -tiles [int]/[int]                      Render only band i of N equal bands of tile rows" << std::endl;
+        std::cerr << "  -coordinator [port]                     Distribute tiles to workers connecting on this TCP port" << std::endl;
+        std::cerr << "                                           Falls back to rendering locally when no worker connects." << std::endl;
+        std::cerr << "  -tc [int]                               Texture cache budget in megabytes" << std::endl;
+        std::cerr << "                                           Image texture tiles beyond this are evicted and reloaded on demand." << std::endl;
+        std::cerr << "  -gc [int]                               Geometry cache budget in megabytes" << std::endl;
+        std::cerr << "                                           Pages of paged primitives beyond this are evicted and reloaded on demand." << std::endl;
+        std::cerr << "  -numa [pin|replicate|interleave]        Pin render threads to NUMA nodes, each rendering its own band of tiles" << std::endl;
+        std::cerr << "                                           replicate copies the BVH to every node; interleave spreads the scene over them." << std::endl;
+        std::cerr << "  -numanodes [int]                        Split the CPUs into this many simulated NUMA nodes for -numa" << std::endl;
+        std::cerr << "  -bvhstats                               Report SAH cost, depth, leaf and overlap statistics of the BVH" << std::endl;
+        std::cerr << "  -bvhopt                                 Improve the BVH with tree rotations before rendering" << std::endl;
+        std::cerr << "  -bvhdump [file]                         Write the BVH's nodes and boxes to file, one per line" << std::endl;
+        std::cerr << "  -preview [output]                       Render progressively, writing the current frame to output or - for stdout" << std::endl;
+        std::cerr << "                                           Starts over when the scene changes; runs until interrupted." << std::endl;
+        std::cerr << "  -interval [int]                         Milliseconds between preview frames" << std::endl;
+        std::cerr << "  -watch [file]                           Flags read from file for the preview and watched for changes" << std::endl;
+        std::cerr << "  -frames [int] [int]                     First and last frame to render from the scene's animation block" << std::endl;
+        std::cerr << "                                           Each frame is written to the animation's output pattern." << std::endl;
+
+        return 0;
+    }
+    return 1;
+}
+
+void configurecamera(int argc, char* argv[], camera* cam){
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-ar" && i + 1 < argc) {
+            cam->aspect_ratio = std::stod(argv[++i]);
+        } else if (arg == "-iw" && i + 1 < argc) {
+            cam->image_width = std::stoi(argv[++i]);
+        } else if (arg == "-spp" && i + 1 < argc) {
+            cam->samples_per_pixel = std::stoi(argv[++i]);
+        } else if (arg == "-md" && i + 1 < argc) {
+            cam->max_depth = std::stoi(argv[++i]);
+        } else if (arg == "-bg" && i + 3 < argc) {
+            double r = std::stod(argv[++i]);
+            double g = std::stod(argv[++i]);
+            double b = std::stod(argv[++i]);
+            cam->background = color(r, g, b);
+        } else if (arg == "-env" && i + 1 < argc) {
+            auto environment = make_shared<environment_map>(argv[++i]);
+            cam->environment = environment->valid() ? environment : nullptr;
+        } else if (arg == "-vf" && i + 1 < argc) {
+            cam->vfov = std::stod(argv[++i]);
+        } else if (arg == "-lf" && i + 3 < argc) {
+            double x = std::stod(argv[++i]);
+            double y = std::stod(argv[++i]);
+            double z = std::stod(argv[++i]);
+            cam->lookfrom = point3(x, y, z);
+        } else if (arg == "-la" && i + 3 < argc) {
+            double x = std::stod(argv[++i]);
+            double y = std::stod(argv[++i]);
+            double z = std::stod(argv[++i]);
+            cam->lookat = point3(x, y, z);
+        } else if (arg == "-vu" && i + 3 < argc) {
+            double x = std::stod(argv[++i]);
+            double y = std::stod(argv[++i]);
+            double z = std::stod(argv[++i]);
+            cam->vup = vec3(x, y, z);
+        } else if (arg == "-da" && i + 1 < argc) {
+            cam->defocus_angle = std::stod(argv[++i]);
+        } else if (arg == "-fd" && i + 1 < argc) {
+            cam->focus_dist = std::stod(argv[++i]);
+        } else if (arg == "-sh" && i + 2 < argc) {
+            cam->shutter_open = std::stod(argv[++i]);
+            cam->shutter_close = std::stod(argv[++i]);
+        } else if (arg == "-denoise") {
+            cam->denoise = true;
+        } else if (arg == "-spectral") {
+            cam->spectral = true;
+        } else if (arg == "-exposure" && i + 1 < argc) {
+            cam->output.exposure = std::stod(argv[++i]);
+        } else if (arg == "-tonemap" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (!parse_tone_curve(name, cam->output.curve))
+                std::cerr << "Error: Unknown tone curve '" << name << "'." << std::endl;
+        } else if (arg == "-srgb") {
+            cam->output.srgb = true;
+        } else if (arg == "-dither") {
+            cam->output.dither = true;
+        } else if (arg == "-bits" && i + 1 < argc) {
+            cam->output.bits = std::stoi(argv[++i]) > 8 ? 16 : 8;
+        } else if (arg == "-binary") {
+            cam->output.binary = true;
+        } else if (arg == "-rr" && i + 1 < argc) {
+            cam->roulette_depth = std::stoi(argv[++i]);
+        } else if (arg == "-sortrays") {
+            cam->sort_rays = true;
+        } else if (arg == "-aov" && i + 1 < argc) {
+            cam->aov_prefix = argv[++i];
+        } else if (arg == "-exr" && i + 1 < argc) {
+            cam->exr_output = argv[++i];
+        } else if (arg == "-crop" && i + 4 < argc) {
+            cam->crop_x0 = std::stoi(argv[++i]);
+            cam->crop_y0 = std::stoi(argv[++i]);
+            cam->crop_x1 = std::stoi(argv[++i]);
+            cam->crop_y1 = std::stoi(argv[++i]);
+        } else if (arg == "-tiles" && i + 1 < argc) {
+            std::string slice = argv[++i];
+            auto slash = slice.find('/');
+            if (slash != std::string::npos) {
+                cam->tile_index = std::stoi(slice.substr(0, slash));
+                cam->tile_count = std::max(1, std::stoi(slice.substr(slash + 1)));
+            }
+        } else if (arg == "-tc" && i + 1 < argc) {
+            texture_cache::global().set_budget(size_t(std::stoi(argv[++i])) << 20);
+        } else if (arg == "-gc" && i + 1 < argc) {
+            geometry_cache::global().set_budget(size_t(std::stoi(argv[++i])) << 20);
+        }
+    }
+}
+
+void configureanimation(int argc, char* argv[], animation* anim){
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-frames" && i + 2 < argc) {
+            anim->enabled = true;
+            anim->frame_start = std::stoi(argv[++i]);
+            anim->frame_end = std::stoi(argv[++i]);
+        }
+    }
+}
+
+// How render threads and scene memory are placed on NUMA nodes.
+struct numa_options {
+    std::string placement;      // Empty for none, else "pin", "replicate" or "interleave"
+    int simulated_nodes = 0;    // Splits the CPUs into this many nodes when positive
+};
+
+void configurenuma(int argc, char* argv[], numa_options* options){
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-numa" && i + 1 < argc) {
+            options->placement = argv[++i];
+            if (options->placement != "pin" && options->placement != "replicate" && options->placement != "interleave") {
+                std::cerr << "Error: Unknown NUMA placement '" << options->placement << "'." << std::endl;
+                options->placement.clear();
+            }
+        } else if (arg == "-numanodes" && i + 1 < argc) {
+            options->simulated_nodes = std::stoi(argv[++i]);
+        }
+    }
+}
+
+// The topology to render on, or null when placement is off.
+shared_ptr<numa_topology> numatopology(const numa_options& options){
+    if (options.placement.empty())
+        return nullptr;
+    auto topology = make_shared<numa_topology>(options.simulated_nodes > 0 ? numa_topology::simulated(options.simulated_nodes)
+                                                                          : numa_topology::detect());
+    std::clog << "NUMA placement '" << options.placement << "' over " << topology->nodes() << " nodes." << std::endl;
+    return topology;
+}
+
+// Sets or clears page interleaving on every OpenMP thread, so it covers the
+// threads building the BVH as well as the one reading the scene.
+void interleavescene(const numa_topology& topology, bool on){
+    #pragma omp parallel
+    topology.interleave(on);
+}
+
+// What to do with the scene's BVH once it is built.
+struct bvh_options {
+    bool report = false;
+    bool optimize = false;
+    std::string dump;
+};
+
+void configurebvh(int argc, char* argv[], bvh_options* options){
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-bvhstats") {
+            options->report = true;
+        } else if (arg == "-bvhopt") {
+            options->optimize = true;
+        } else if (arg == "-bvhdump" && i + 1 < argc) {
+            options->dump = argv[++i];
+        }
+    }
+}
+
+void preparebvh(bvh_node& bvh, const bvh_options& options){
+    if (options.report)
+        bvh.statistics().print(std::clog);
+    if (options.optimize) {
+        auto rotations = bvh.optimize();
+        std::clog << "BVH optimized with " << rotations << " rotations." << std::endl;
+        if (options.report)
+            bvh.statistics().print(std::clog);
+    }
+    if (!options.dump.empty()) {
+        std::ofstream out(options.dump);
+        bvh.dump(out);
+    }
+}
+
+// The texture node names; unknown names are an error.
+shared_ptr<texture> findtexture(const YAML::Node& node, const std::map<std::string, shared_ptr<texture>>& texturesMap){
+    std::string name = node.as<std::string>();
+    auto it = texturesMap.find(name);
+    if (it == texturesMap.end())
+        throw YAML::RepresentationException(node.Mark(), "unknown texture '" + name + "'");
+    return it->second;
+}
+
+color_source readcolorvalue(const YAML::Node& node, const std::map<std::string, shared_ptr<texture>>& texturesMap){
+    if (!node.IsSequence())
+        return color_source(findtexture(node, texturesMap));
+
+    return color_source(color(node[0].as<double>(), node[1].as<double>(), node[2].as<double>()));
+}
+
+color_source readcolorsource(const YAML::Node& node, const std::map<std::string, shared_ptr<texture>>& texturesMap){
+    if (node["texture"])
+        return color_source(findtexture(node["texture"], texturesMap));
+
+    auto colorValues = node["color"];
+    return color_source(color(colorValues[0].as<double>(), colorValues[1].as<double>(), colorValues[2].as<double>()));
+}
+
+// The id of the material node names; unknown names are an error.
+int findmaterial(const YAML::Node& node, const std::map<std::string, int>& materialsMap){
+    std::string name = node.as<std::string>();
+    auto it = materialsMap.find(name);
+    if (it == materialsMap.end())
+        throw YAML::RepresentationException(node.Mark(), "unknown material '" + name + "'");
+    return it->second;
+}
+
+// Reads the image, camera and depth_of_field sections.
+void buildcamera(const YAML::Node& config, camera* cam){
+    cam->aspect_ratio = config["image"]["aspect_ratio"].as<double>();
+    cam->image_width = config["image"]["image_width"].as<int>();
+    cam->samples_per_pixel = config["image"]["samples_per_pixel"].as<int>();
+    cam->max_depth = config["image"]["max_depth"].as<int>();
+    cam->denoise = config["image"]["denoise"].as<bool>(false);
+    cam->spectral = config["image"]["spectral"].as<bool>(false);
+    cam->roulette_depth = config["image"]["roulette_depth"].as<int>(0);
+    cam->sort_rays = config["image"]["sort_rays"].as<bool>(false);
+    cam->output.exposure = config["image"]["exposure"].as<double>(0.0);
+    if (auto curve = config["image"]["tone_curve"]) {
+        if (!parse_tone_curve(curve.as<std::string>(), cam->output.curve))
+            throw YAML::RepresentationException(curve.Mark(), "tone_curve must be clip, reinhard or aces");
+    }
+    cam->output.srgb = config["image"]["srgb"].as<bool>(false);
+    cam->output.dither = config["image"]["dither"].as<bool>(false);
+    cam->output.bits = config["image"]["bits"].as<int>(8) > 8 ? 16 : 8;
+    cam->output.binary = config["image"]["binary"].as<bool>(false);
+    std::vector<double> background = config["image"]["background"].as<std::vector<double>>(std::vector<double>{0, 0, 0});
+    cam->background = color(background[0], background[1], background[2]);
+    if (config["image"]["environment"]) {
+        double intensity = config["image"]["environment_intensity"].as<double>(1.0);
+        double rotation = config["image"]["environment_rotation"].as<double>(0.0);
+        auto environment = make_shared<environment_map>(config["image"]["environment"].as<std::string>(), intensity, rotation);
+        cam->environment = environment->valid() ? environment : nullptr;
+    }
+
+    cam-> vfov = config["camera"]["vfov"].as<double>();
+    std::vector<double> lookFrom = config["camera"]["look_from"].as<std::vector<double>>();
+    cam->lookfrom = point3(lookFrom[0], lookFrom[1], lookFrom[2]);
+    std::vector<double> lookAt = config["camera"]["look_at"].as<std::vector<double>>();
+    cam->lookat = point3(lookAt[0], lookAt[1], lookAt[2]);
+    std::vector<double> vup = config["camera"]["vup"].as<std::vector<double>>();
+    cam->vup = vec3(vup[0], vup[1], vup[2]);
+    cam->shutter_open = config["camera"]["shutter_open"].as<double>(0.0);
+    cam->shutter_close = config["camera"]["shutter_close"].as<double>(cam->shutter_open);
+
+    cam->defocus_angle = config["depth_of_field"]["defocus_angle"].as<double>();
+    cam->focus_dist = config["depth_of_field"]["focus_dist"].as<double>();
+}
+
+// A quad, box or sphere described by obj; null for other types. The boundary of a
+// medium may leave out its material, which is never used.
+shared_ptr<hittable> readshape(const YAML::Node& obj, const std::map<std::string, int>& materialsMap, bool boundary = false){
+    std::string type = obj["type"].as<std::string>();
+    if (type == "quad") {
+        auto parameters = obj["parameters"];
+        point3 Q(parameters["Q"][0].as<double>(), parameters["Q"][1].as<double>(), parameters["Q"][2].as<double>());
+        vec3 u(parameters["u"][0].as<double>(), parameters["u"][1].as<double>(), parameters["u"][2].as<double>());
+        vec3 v(parameters["v"][0].as<double>(), parameters["v"][1].as<double>(), parameters["v"][2].as<double>());
+        int material = findmaterial(parameters["material"], materialsMap);
+
+        if (parameters["Q2"]) {
+            point3 Q2(parameters["Q2"][0].as<double>(), parameters["Q2"][1].as<double>(), parameters["Q2"][2].as<double>());
+            return make_shared<quad>(Q, Q2, u, v, material);
+        } else {
+            return make_shared<quad>(Q, u, v, material);
+        }
+    } else if (type == "box") {
+        auto parameters = obj["parameters"];
+        point3 a(parameters["a"][0].as<double>(), parameters["a"][1].as<double>(), parameters["a"][2].as<double>());
+        point3 b(parameters["b"][0].as<double>(), parameters["b"][1].as<double>(), parameters["b"][2].as<double>());
+        int material = (boundary && !parameters["material"]) ? 0 : findmaterial(parameters["material"], materialsMap);
+
+        std::vector<double> rotate = parameters["rotate"].as<std::vector<double>>(std::vector<double>{0, 0, 0});
+        if (rotate.size() != 3)
+            throw YAML::RepresentationException(parameters["rotate"].Mark(), "rotate needs x y z angles");
+
+        return make_shared<cuboid>(a, b, material, vec3(rotate[0], rotate[1], rotate[2]));
+    } else if (type == "sphere") {
+        auto parameters = obj["parameters"];
+        point3 center(parameters["center"][0].as<double>(), parameters["center"][1].as<double>(), parameters["center"][2].as<double>());
+        double radius = parameters["radius"].as<double>();
+        int material = (boundary && !parameters["material"]) ? 0 : findmaterial(parameters["material"], materialsMap);
+
+        if (parameters["center2"]) {
+            point3 center2(parameters["center2"][0].as<double>(), parameters["center2"][1].as<double>(), parameters["center2"][2].as<double>());
+            return make_shared<sphere>(center, center2, radius, material);
+        } else {
+            return make_shared<sphere>(center, radius, material);
+        }
+    }
+    return nullptr;
+}
+
+void buildscene(const YAML::Node& config, camera* cam, hittable_list* world, material_table* materials, animation* anim = nullptr){
+    std::map<std::string, int> materialsMap;
+    std::map<std::string, shared_ptr<texture>> texturesMap;
+
+    buildcamera(config, cam);
+
+    if (anim && config["animation"]) {
+        std::vector<double> lookFrom = config["camera"]["look_from"].as<std::vector<double>>();
+        std::vector<double> lookAt = config["camera"]["look_at"].as<std::vector<double>>();
+        auto block = config["animation"];
+        anim->enabled = true;
+        anim->fps = block["fps"].as<double>(anim->fps);
+        anim->frame_start = block["frame_start"].as<int>(anim->frame_start);
+        anim->frame_end = block["frame_end"].as<int>(anim->frame_start);
+        anim->output = block["output"].as<std::string>(anim->output);
+        if (anim->frame_filename(0).empty())
+            throw YAML::RepresentationException(block["output"].Mark(), "output needs exactly one %d or %0Nd");
+        anim->rebuild_threshold = block["rebuild_threshold"].as<double>(anim->rebuild_threshold);
+
+        for (const auto& key : config["camera"]["keyframes"]) {
+            std::vector<double> from = key["look_from"].as<std::vector<double>>(lookFrom);
+            std::vector<double> at = key["look_at"].as<std::vector<double>>(lookAt);
+            anim->camera_keyframes.push_back({key["time"].as<double>(), point3(from[0], from[1], from[2]),
+                                              point3(at[0], at[1], at[2]), key["vfov"].as<double>(cam->vfov)});
+        }
+    }
+
+    for (const auto& tex : config["textures"]) {
+        std::string name = tex.first.as<std::string>();
+        std::string type = tex.second["type"].as<std::string>();
+
+        if (type == "solid") {
+            auto colorValues = tex.second["color"];
+            texturesMap[name] = make_shared<solid_color>(colorValues[0].as<double>(), colorValues[1].as<double>(), colorValues[2].as<double>());
+        } else if (type == "image") {
+            texturesMap[name] = make_shared<image_texture>(tex.second["file"].as<std::string>());
+        } else if (type == "checker") {
+            double scale = tex.second["scale"].as<double>();
+            auto even = readcolorvalue(tex.second["even"], texturesMap);
+            auto odd = readcolorvalue(tex.second["odd"], texturesMap);
+            texturesMap[name] = make_shared<checker_texture>(scale, even, odd);
+        } else if (type == "noise" || type == "turbulence" || type == "marble") {
+            auto style = (type == "marble") ? noise_texture::marble
+                       : (type == "turbulence") ? noise_texture::turbulence
+                                                : noise_texture::smooth;
+            double scale = tex.second["scale"].as<double>();
+            std::vector<double> tint = tex.second["color"].as<std::vector<double>>(std::vector<double>{1, 1, 1});
+            int octaves = tex.second["octaves"].as<int>(7);
+            texturesMap[name] = make_shared<noise_texture>(style, scale, color(tint[0], tint[1], tint[2]), octaves);
+        }
+    }
+
+    for (const auto& material : config["materials"]) {
+        std::string name = material.first.as<std::string>();
+        std::string type = material.second["type"].as<std::string>();
+
+        if (type == "lambertian") {
+            materialsMap[name] = materials->add(lambertian(readcolorsource(material.second, texturesMap)));
+        } else if (type == "metal") {
+            double fuzziness = material.second["fuzziness"].as<double>();
+            materialsMap[name] = materials->add(metal(readcolorsource(material.second, texturesMap), fuzziness));
+        } else if (type == "dielectric") {
+            if (material.second["sellmeier"]) {
+                const YAML::Node& sellmeier = material.second["sellmeier"];
+                std::vector<double> coefficients = sellmeier.as<std::vector<double>>();
+                if (coefficients.size() != 6)
+                    throw YAML::RepresentationException(sellmeier.Mark(), "sellmeier needs B1 B2 B3 C1 C2 C3");
+                double b[3] = {coefficients[0], coefficients[1], coefficients[2]};
+                double c[3] = {coefficients[3], coefficients[4], coefficients[5]};
+                materialsMap[name] = materials->add(dielectric::sellmeier(b, c));
+            } else {
+                double indexOfRefraction = material.second["index_of_refraction"].as<double>();
+                double cauchyB = material.second["cauchy_b"].as<double>(0.0);
+                materialsMap[name] = materials->add(dielectric(indexOfRefraction, cauchyB));
+            }
+        } else if (type == "diffuse_light") {
+            materialsMap[name] = materials->add(diffuse_light(readcolorsource(material.second, texturesMap)));
+        } else if (type == "isotropic") {
+            materialsMap[name] = materials->add(isotropic(readcolorsource(material.second, texturesMap)));
+        }
+    }
+
+    for (const auto& obj : config["objects"]) {
+        std::string type = obj["type"].as<std::string>();
+        shared_ptr<hittable> object;
+
+        if (type == "quad" || type == "box" || type == "sphere") {
+            object = readshape(obj, materialsMap);
+        } else if (type == "constant_medium") {
+            auto parameters = obj["parameters"];
+            // Rays must cross the boundary twice, so it has to enclose a volume.
+            auto shape = parameters["boundary"]["type"].as<std::string>();
+            if (shape != "box" && shape != "sphere")
+                throw YAML::RepresentationException(parameters["boundary"].Mark(), "a medium boundary must be a box or sphere");
+            auto boundary = readshape(parameters["boundary"], materialsMap, true);
+            double density = parameters["density"].as<double>();
+            int material = findmaterial(parameters["material"], materialsMap);
+
+            shared_ptr<density_grid> grid;
+            if (parameters["grid"])
+                grid = density_grid::load(parameters["grid"].as<std::string>());
+            if (boundary)
+                object = make_shared<constant_medium>(boundary, density, material, grid);
+        } else if (type == "primitives") {
+            auto parameters = obj["parameters"];
+            auto file = parameters["file"].as<std::string>();
+            int material = findmaterial(parameters["material"], materialsMap);
+
+            if (parameters["pages"]) {
+                auto pagesFile = parameters["pages"].as<std::string>();
+                paged_geometry_stats stats;
+                auto paged = paged_geometry::build(file, pagesFile, material, materialsMap, parameters["page_size"].as<size_t>(512), &stats);
+                if (!paged)
+                    continue;
+                paged->add_pages(*world);
+                std::clog << "Paged " << stats.spheres << " spheres and " << stats.quads << " quads from '" << file << "' into "
+                          << stats.pages << " pages of '" << pagesFile << "' in " << stats.seconds << " s";
+                if (stats.skipped > 0)
+                    std::clog << ", skipped " << stats.skipped << " bad lines";
+                std::clog << "." << std::endl;
+                continue;
+            }
+
+            auto stats = load_primitives(file, material, materialsMap, *world);
+            std::clog << "Loaded " << stats.spheres << " spheres and " << stats.quads << " quads from '" << file << "' in "
+                      << stats.seconds << " s (" << stats.megabytes_per_second() << " MB/s)";
+            if (stats.skipped > 0)
+                std::clog << ", skipped " << stats.skipped << " bad lines";
+            std::clog << "." << std::endl;
+        }
+
+        if (!object)
+            continue;
+
+        if (obj["keyframes"] && anim) {
+            std::vector<transform_keyframe> keyframes;
+            for (const auto& key : obj["keyframes"]) {
+                std::vector<double> translate = key["translate"].as<std::vector<double>>(std::vector<double>{0, 0, 0});
+                keyframes.push_back({key["time"].as<double>(), vec3(translate[0], translate[1], translate[2]),
+                                     key["rotate_y"].as<double>(0.0)});
+            }
+            auto moving = make_shared<animated>(object, keyframes);
+            anim->objects.push_back(moving);
+            object = moving;
+        }
+
+        world->add(object);
+    }
+}
+
+void createscene(const std::string& filename, camera* cam, hittable_list* world, material_table* materials, animation* anim = nullptr){
+    std::ifstream file(filename);
+    if (!file.good()) {
+        std::cerr << "Error: File '" << filename << "' does not exist or cannot be opened." << std::endl;
+        return;
+    }
+    buildscene(YAML::LoadFile(filename), cam, world, materials, anim);
+}
+
+// Everything a worker needs to rebuild the scene: the YAML text and the options.
+std::string createpayload(int argc, char* argv[]){
+    std::ifstream file(argv[argc - 1]);
+    std::stringstream scene;
+    scene << file.rdbuf();
+
+    std::vector<std::string> strings = {scene.str()};
+    for (int i = 0; i < argc - 1; ++i)
+        strings.push_back(argv[i]);
+    return pack_strings(strings);
+}
+
+bool loadpayload(const std::string& payload, camera& cam, hittable_list& world, material_table& materials){
+    std::vector<std::string> strings = unpack_strings(payload);
+    if (strings.empty())
+        return false;
+
+    buildscene(YAML::Load(strings[0]), &cam, &world, &materials);
+
+    std::vector<char*> args;
+    for (size_t i = 1; i < strings.size(); ++i)
+        args.push_back(&strings[i][0]);
+    configurecamera(static_cast<int>(args.size()), args.data(), &cam);
+    return true;
+}
+
+#endif
\ No newline at end of file
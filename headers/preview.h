@@ -0,0 +1,195 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "parser.h"
+#include "./../camera/progressive.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Interactive preview: renders the scene progressively and writes the current frame
+// every interval, starting over whenever the scene file or the flags file changes.
+// A change that leaves textures, materials and objects alone only re-reads the
+// camera, keeping the parsed scene and its BVH.
+class preview_session {
+  public:
+    // args are the command line flags; flags_path, when set, names a file holding
+    // more flags that are applied after them and watched like the scene.
+    preview_session(const std::string& _scene_path, const std::string& _flags_path, std::vector<std::string> _args)
+      : scene_path(_scene_path), flags_path(_flags_path), args(std::move(_args)) {}
+
+    // Re-reads what changed and restarts the render. Keeps the previous scene and
+    // returns false when the new one does not parse.
+    bool reload() {
+        scene_time = modified(scene_path);
+        flags_time = modified(flags_path);
+        try {
+            YAML::Node config = YAML::LoadFile(scene_path);
+            std::string signature = YAML::Dump(config["textures"]) + '\n' + YAML::Dump(config["materials"]) + '\n'
+                                  + YAML::Dump(config["objects"]);
+
+            camera cam;
+            auto world = scene_world;
+            auto materials = scene_materials;
+            if (!bvh || signature != scene_signature) {
+                world = make_shared<hittable_list>();
+                materials = make_shared<material_table>();
+                buildscene(config, &cam, world.get(), materials.get());
+            } else {
+                buildcamera(config, &cam);
+            }
+            configure(cam);
+
+            if (world != scene_world || cam.shutter_open != bvh_open || cam.shutter_close != bvh_close) {
+                bvh = make_shared<hittable_list>(*world);
+                if (!world->objects.empty())
+                    bvh = make_shared<bvh_node>(*world, cam.shutter_open, cam.shutter_close);
+                bvh_open = cam.shutter_open;
+                bvh_close = cam.shutter_close;
+            }
+            scene_world = world;
+            scene_materials = materials;
+            scene_signature = signature;
+            render = std::make_unique<progressive_render>(cam);
+            return true;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: Cannot load '" << scene_path << "': " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    bool changed() const {
+        return modified(scene_path) != scene_time || modified(flags_path) != flags_time;
+    }
+
+    bool loaded() const { return render != nullptr; }
+    bool done() const   { return !render || render->done(); }
+    const progressive_render& progress() const { return *render; }
+
+    void step() {
+        if (render)
+            render->step(*bvh, *scene_materials);
+    }
+
+  private:
+    std::string scene_path;
+    std::string flags_path;
+    std::vector<std::string> args;
+    std::filesystem::file_time_type scene_time, flags_time;
+
+    std::string scene_signature;
+    shared_ptr<hittable_list> scene_world;
+    shared_ptr<material_table> scene_materials;
+    shared_ptr<hittable> bvh;
+    double bvh_open = 0, bvh_close = 0;
+    std::unique_ptr<progressive_render> render;
+
+    static std::filesystem::file_time_type modified(const std::string& path) {
+        std::error_code error;
+        return path.empty() ? std::filesystem::file_time_type() : std::filesystem::last_write_time(path, error);
+    }
+
+    void configure(camera& cam) const {
+        std::vector<std::string> flags = args;
+        if (!flags_path.empty()) {
+            std::ifstream file(flags_path);
+            std::string flag;
+            while (file >> flag)
+                flags.push_back(flag);
+        }
+
+        std::vector<char*> argv;
+        for (auto& flag : flags)
+            argv.push_back(&flag[0]);
+        configurecamera(static_cast<int>(argv.size()), argv.data(), &cam);
+    }
+};
+
+// Writes one preview frame. A file is replaced in one rename so readers never see
+// half a frame; "-" appends the frame to stdout, one image after another.
+inline void write_preview(const progressive_render& render, const std::string& output) {
+    if (output == "-") {
+        render.view().write_plane(render.frame(), std::cout);
+        std::cout.flush();
+        return;
+    }
+    auto temporary = output + ".tmp";
+    {
+        std::ofstream out(temporary);
+        render.view().write_plane(render.frame(), out);
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, output, error);
+}
+
+// raytracer -preview [output] [-interval ms] [-watch flags file] [OPTION]... SOURCE FILE
+// Runs until interrupted.
+inline int run_preview(int argc, char* argv[]) {
+    std::string output = "-";
+    std::string flags_path;
+    int interval_ms = 250;
+    std::vector<std::string> args = {"raytracer"};
+    for (int i = 1; i < argc - 1; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-preview" && i + 1 < argc - 1)
+            output = argv[++i];
+        else if (arg == "-interval" && i + 1 < argc - 1)
+            interval_ms = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "-watch" && i + 1 < argc - 1)
+            flags_path = argv[++i];
+        else
+            args.push_back(arg);
+    }
+
+    using clock = std::chrono::steady_clock;
+    const auto interval = std::chrono::milliseconds(interval_ms);
+    const auto watch_period = std::chrono::milliseconds(100);
+
+    preview_session session(argv[argc - 1], flags_path, args);
+    auto started = clock::now();
+    session.reload();
+    auto next_frame = started, next_watch = started + watch_period;
+    bool fresh = true;      // Nothing shown since the render (re)started
+    bool dirty = false;     // Rendered more than the last frame shows
+
+    for (;;) {
+        auto now = clock::now();
+        if (now >= next_watch) {
+            next_watch = now + watch_period;
+            if (session.changed() && session.reload()) {
+                started = now;
+                fresh = true;
+                dirty = false;
+            }
+        }
+
+        if (!session.done()) {
+            session.step();
+            dirty = true;
+        }
+
+        now = clock::now();
+        if (dirty && session.loaded() && (fresh || now >= next_frame || session.done())) {
+            write_preview(session.progress(), output);
+            auto ms = std::chrono::duration<double, std::milli>(now - started).count();
+            std::clog << "\rPreview: " << session.progress().samples() << " of " << session.progress().view().samples_per_pixel
+                      << " spp after " << static_cast<long long>(ms) << " ms.    " << std::flush;
+            next_frame = now + interval;
+            fresh = dirty = false;
+        }
+
+        if (session.done())
+            std::this_thread::sleep_for(watch_period / 2);
+    }
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef PRIMITIVE_FILE_H
+#define PRIMITIVE_FILE_H
+
+#include "hittable_list.h"
+#include "quad.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <omp.h>
+#include <string>
+#include <vector>
+
+// Bulk primitives referenced from a scene, one per line of a text file:
+//
+//   sphere cx cy cz radius [material]
+//   quad Qx Qy Qz ux uy uz vx vy vz [material]
+//
+// '#' starts a comment. The file is read a chunk at a time and each chunk is
+// parsed on all threads, so neither the file nor a document tree is ever held in
+// memory whole. Primitives are stored back to back in one arena; the world gets
+// pointers sharing the arena's ownership rather than one allocation per object.
+
+struct primitive_arena {
+    std::deque<sphere> spheres;     // A deque never moves what it holds as it grows
+    std::deque<quad>   quads;
+};
+
+struct primitive_load_stats {
+    size_t spheres = 0;
+    size_t quads = 0;
+    size_t skipped = 0;             // Malformed lines and unknown materials
+    size_t bytes = 0;
+    double seconds = 0;
+
+    double megabytes_per_second() const { return (seconds > 0) ? bytes / seconds / (1 << 20) : 0; }
+};
+
+namespace primitive_file {
+
+struct parsed_chunk {
+    std::vector<sphere> spheres;
+    std::vector<quad>   quads;
+    size_t skipped = 0;
+
+    void add_sphere(const point3& center, double radius, int material) {
+        spheres.emplace_back(center, radius, material);
+    }
+
+    void add_quad(const point3& Q, const vec3& u, const vec3& v, int material) {
+        quads.emplace_back(Q, u, v, material);
+    }
+};
+
+inline const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+// Reads count numbers from the line, which ends at end.
+inline bool read_numbers(const char*& p, const char* end, double* values, int count) {
+    for (int i = 0; i < count; i++) {
+        p = skip_blanks(p, end);
+        if (p == end)
+            return false;
+        char* next;
+        values[i] = std::strtod(p, &next);
+        if (next == p || next > end)
+            return false;
+        p = next;
+    }
+    return true;
+}
+
+// Hands the primitive on the line to out, which may be any type with parsed_chunk's
+// add_sphere, add_quad and skipped.
+template <typename Chunk>
+void parse_line(const char* p, const char* end, int default_material,
+                const std::map<std::string, int>& materials, Chunk& out) {
+    p = skip_blanks(p, end);
+    if (p == end || *p == '#')
+        return;
+
+    const char* word = p;
+    while (p < end && *p != ' ' && *p != '\t')
+        p++;
+    std::string type(word, p);
+
+    double values[9];
+    int count = (type == "sphere") ? 4 : (type == "quad") ? 9 : 0;
+    if (count == 0 || !read_numbers(p, end, values, count)) {
+        out.skipped++;
+        return;
+    }
+
+    int material = default_material;
+    p = skip_blanks(p, end);
+    if (p < end && *p != '#') {
+        const char* name = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+        auto it = materials.find(std::string(name, p));
+        if (it == materials.end()) {
+            out.skipped++;
+            return;
+        }
+        material = it->second;
+    }
+
+    if (count == 4)
+        out.add_sphere(point3(values[0], values[1], values[2]), values[3], material);
+    else
+        out.add_quad(point3(values[0], values[1], values[2]), vec3(values[3], values[4], values[5]),
+                     vec3(values[6], values[7], values[8]), material);
+}
+
+// Parses whole lines [begin, end), split into one slice per thread at line breaks.
+template <typename Chunk>
+void parse_lines(const char* begin, const char* end, int default_material,
+                 const std::map<std::string, int>& materials, std::vector<Chunk>& slices) {
+    int threads = omp_get_max_threads();
+    std::vector<const char*> bounds = {begin};
+    for (int t = 1; t < threads; t++) {
+        const char* p = std::max(bounds.back(), begin + (end - begin) * t / threads);
+        while (p > begin && p < end && p[-1] != '\n')
+            p++;
+        bounds.push_back(p);
+    }
+    bounds.push_back(end);
+
+    slices.assign(threads, Chunk());
+    #pragma omp parallel for schedule(static, 1)
+    for (int t = 0; t < threads; t++) {
+        for (const char* line = bounds[t]; line < bounds[t + 1]; ) {
+            const char* newline = static_cast<const char*>(std::memchr(line, '\n', bounds[t + 1] - line));
+            const char* line_end = newline ? newline : bounds[t + 1];
+            parse_line(line, line_end, default_material, materials, slices[t]);
+            line = line_end + 1;
+        }
+    }
+}
+
+// Reads the file at path chunk_bytes at a time, parsing each chunk into slices
+// that are handed to consume in file order. Adds the bytes read to bytes; returns
+// false when the file cannot be opened.
+template <typename Chunk, typename Consume>
+bool read_chunks(const std::string& path, int default_material, const std::map<std::string, int>& materials,
+                 size_t chunk_bytes, size_t& bytes, Consume consume) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.good()) {
+        std::cerr << "Error: File '" << path << "' does not exist or cannot be opened." << std::endl;
+        return false;
+    }
+
+    std::vector<Chunk> slices;
+    std::string buffer;
+    size_t carried = 0;     // Bytes of an unfinished line kept from the previous chunk
+    for (;;) {
+        buffer.resize(carried + std::max<size_t>(chunk_bytes, 1));
+        in.read(&buffer[carried], buffer.size() - carried);
+        size_t filled = carried + static_cast<size_t>(in.gcount());
+        bytes += filled - carried;
+        bool last = filled < buffer.size();
+
+        // Parse up to the last line break; the rest starts the next chunk.
+        size_t complete = filled;
+        if (!last) {
+            auto newline = buffer.rfind('\n', filled - 1);
+            complete = (newline == std::string::npos) ? 0 : newline + 1;
+        }
+        parse_lines(buffer.data(), buffer.data() + complete, default_material, materials, slices);
+        for (auto& slice : slices)
+            consume(slice);
+
+        carried = filled - complete;
+        buffer.erase(0, complete);
+        if (last)
+            return true;
+    }
+}
+
+}
+
+// Appends the primitives of the file at path to world, using default_material for
+// lines that name none. Reads chunk_bytes at a time.
+inline primitive_load_stats load_primitives(const std::string& path, int default_material,
+                                            const std::map<std::string, int>& materials, hittable_list& world,
+                                            size_t chunk_bytes = size_t(4) << 20) {
+    auto start = std::chrono::steady_clock::now();
+    primitive_load_stats stats;
+    auto arena = make_shared<primitive_arena>();
+    bool opened = primitive_file::read_chunks<primitive_file::parsed_chunk>(path, default_material, materials, chunk_bytes, stats.bytes,
+        [&](primitive_file::parsed_chunk& slice) {
+            arena->spheres.insert(arena->spheres.end(), slice.spheres.begin(), slice.spheres.end());
+            arena->quads.insert(arena->quads.end(), slice.quads.begin(), slice.quads.end());
+            stats.skipped += slice.skipped;
+        });
+    if (!opened)
+        return stats;
+
+    world.objects.reserve(world.objects.size() + arena->spheres.size() + arena->quads.size());
+    for (auto& s : arena->spheres)
+        world.add(shared_ptr<hittable>(arena, &s));
+    for (auto& q : arena->quads)
+        world.add(shared_ptr<hittable>(arena, &q));
+
+    stats.spheres = arena->spheres.size();
+    stats.quads = arena->quads.size();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+#endif
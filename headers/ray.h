@@ -1,24 +1,45 @@
-#ifndef RAY_H
-#define RAY_H
-
-#include "vec3.h"
-
-class ray {
-  public:
-    ray() {}
-
-    ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction) {}
-
-    point3 origin() const  { return orig; }
-    vec3 direction() const { return dir; }
-
-    point3 at(double t) const {
-        return orig + t*dir;
-    }
-
-  private:
-    point3 orig;
-    vec3 dir;
-};
-
+#ifndef RAY_H
+#define RAY_H
+
+#include "vec3.h"
+
+#include <cmath>
+
+// Besides origin and direction, a ray carries values the intersection kernels
+// would otherwise recompute for every box and primitive: the reciprocal of each
+// direction component, which of them are negative, and the squared length.
+// Zero components give infinite reciprocals, which the slab test relies on.
+class ray {
+  public:
+    ray() {}
+
+    ray(const point3& origin, const vec3& direction, double time = 0.0)
+      : orig(origin), dir(direction), tm(time) {
+        inv_dir = vec3(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+        for (int a = 0; a < 3; a++)
+            negative[a] = std::signbit(inv_dir[a]);
+        len_sq = dir.length_squared();
+    }
+
+    const point3& origin() const  { return orig; }
+    const vec3& direction() const { return dir; }
+    double time() const           { return tm; }
+
+    const vec3& inv_direction() const { return inv_dir; }
+    bool is_negative(int axis) const  { return negative[axis]; }
+    double length_squared() const     { return len_sq; }
+
+    point3 at(double t) const {
+        return orig + t*dir;
+    }
+
+  private:
+    point3 orig;
+    vec3 dir;
+    double tm;
+    vec3 inv_dir;
+    bool negative[3];
+    double len_sq;
+};
+
 #endif
\ No newline at end of file
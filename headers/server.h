@@ -0,0 +1,322 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "lru_cache.h"
+#include "parser.h"
+#include "thread_pool.h"
+#include "./../camera/render_job.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Long-running render server. Each job is one line of JSON naming a scene file, an
+// output path and options that override the scene just like command line flags:
+//
+//   {"id": 7, "scene": "cornell.yaml", "output": "a.ppm", "options": {"spp": 64, "lf": [0, 2, 9], "denoise": true}}
+//
+// Parsed scenes and their BVHs stay cached between jobs, keyed by path and
+// modification time. Jobs are parsed and loaded concurrently on a pool of jobs
+// threads, and their tiles all render on one shared work-stealing pool, so a lone
+// job uses every core and concurrent ones share them. Each finished job is
+// answered with one line of JSON carrying its id.
+
+struct cached_scene {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    shared_ptr<hittable> bvh;
+};
+
+class render_server {
+  public:
+    // jobs renders run at once; cache_size scenes are kept in memory.
+    render_server(int jobs, size_t cache_size) : scenes(cache_size), pool(jobs) {}
+
+    // Queues the job on the pool; respond is called with the reply once it finishes.
+    std::future<void> submit(const std::string& line, std::function<void(const std::string&)> respond) {
+        return pool.submit([this, line, respond] { respond(run(line)); });
+    }
+
+    std::string run(const std::string& line) {
+        auto start = std::chrono::steady_clock::now();
+        std::string id = "null";
+        try {
+            YAML::Node job = YAML::Load(line);
+            if (job["id"])
+                id = json_scalar(job["id"]);
+            if (!job["scene"] || !job["output"])
+                return reply(id, "error", "job needs a scene and an output");
+
+            auto scene_path = job["scene"].as<std::string>();
+            bool hit = false;
+            auto scene = load(scene_path, hit);
+
+            std::vector<std::string> args = {"raytracer"};
+            for (const auto& option : job["options"]) {
+                auto flag = option.first.as<std::string>();
+                const auto& value = option.second;
+                if (flag == "tc" || flag == "gc")
+                    return reply(id, "error", "option '" + flag + "' is shared by every job; pass -" + flag + " to -server");
+                auto count = option_values().find(flag);
+                if (count == option_values().end())
+                    return reply(id, "error", "unknown option '" + flag + "'");
+
+                if (count->second == 0) {
+                    auto text = value.IsScalar() ? value.as<std::string>() : "";
+                    if (text != "true" && text != "false")
+                        return reply(id, "error", "option '" + flag + "' takes true or false");
+                    if (text == "true")
+                        args.push_back("-" + flag);
+                    continue;
+                }
+
+                size_t given = value.IsSequence() ? value.size() : value.IsScalar() ? 1 : 0;
+                if (given != count->second)
+                    return reply(id, "error", "option '" + flag + "' takes " + std::to_string(count->second)
+                                              + (count->second == 1 ? " value" : " values"));
+                args.push_back("-" + flag);
+                if (value.IsSequence()) {
+                    for (const auto& v : value)
+                        args.push_back(v.as<std::string>());
+                } else {
+                    args.push_back(value.as<std::string>());
+                }
+            }
+            std::vector<char*> argv;
+            for (auto& arg : args)
+                argv.push_back(&arg[0]);
+            argv.push_back(nullptr);
+
+            camera cam = scene->cam;
+            configurecamera(static_cast<int>(args.size()), argv.data(), &cam);
+
+            // The cached BVH holds primitives at the scene's shutter times.
+            auto bvh = scene->bvh;
+            if (cam.shutter_open != scene->cam.shutter_open || cam.shutter_close != scene->cam.shutter_close)
+                bvh = make_shared<bvh_node>(scene->world, cam.shutter_open, cam.shutter_close);
+
+            auto output = job["output"].as<std::string>();
+            std::ofstream out(output);
+            if (!out.good())
+                return reply(id, "error", "cannot write " + output);
+            auto render = render_job::start(tiles, cam, bvh, std::shared_ptr<const material_table>(scene, &scene->materials));
+            render->wait();
+            render->write(out);
+
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::stringstream extra;
+            extra << ", \"output\": " << quote(output) << ", \"cached\": " << (hit ? "true" : "false")
+                  << ", \"seconds\": " << seconds;
+            return reply(id, "ok", "", extra.str());
+        } catch (const std::exception& e) {
+            return reply(id, "error", e.what());
+        }
+    }
+
+  private:
+    lru_cache<std::string, cached_scene> scenes;
+    work_stealing_pool tiles;   // Outlives pool, whose threads wait on it
+    thread_pool pool;
+
+    std::shared_ptr<const cached_scene> load(const std::string& path, bool& hit) {
+        auto modified = std::filesystem::last_write_time(path).time_since_epoch().count();
+        auto key = path + '\n' + std::to_string(modified);
+
+        return scenes.get(key, [&] {
+            auto scene = std::make_shared<cached_scene>();
+            buildscene(YAML::LoadFile(path), &scene->cam, &scene->world, &scene->materials);
+            scene->bvh = make_shared<hittable_list>(scene->world);
+            if (!scene->world.objects.empty())
+                scene->bvh = make_shared<bvh_node>(scene->world, scene->cam.shutter_open, scene->cam.shutter_close);
+            return std::shared_ptr<const cached_scene>(scene);
+        }, &hit);
+    }
+
+    // How many values each job option takes; 0 for switches set by true or false.
+    static const std::map<std::string, size_t>& option_values() {
+        static const std::map<std::string, size_t> values = {
+            {"ar", 1}, {"iw", 1}, {"spp", 1}, {"md", 1}, {"bg", 3}, {"env", 1}, {"vf", 1}, {"lf", 3},
+            {"la", 3}, {"vu", 3}, {"da", 1}, {"fd", 1}, {"sh", 2}, {"denoise", 0}, {"spectral", 0},
+            {"exposure", 1}, {"tonemap", 1}, {"srgb", 0}, {"dither", 0}, {"bits", 1}, {"binary", 0},
+            {"rr", 1}, {"sortrays", 0}, {"aov", 1}, {"exr", 1}, {"crop", 4}, {"tiles", 1}};
+        return values;
+    }
+
+    static std::string quote(const std::string& s) {
+        std::string quoted = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+                quoted += c;
+            } else if (c == '\n') {
+                quoted += "\\n";
+            } else if (c == '\r') {
+                quoted += "\\r";
+            } else if (c == '\t') {
+                quoted += "\\t";
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[7];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                quoted += escaped;
+            } else {
+                quoted += c;
+            }
+        }
+        return quoted + "\"";
+    }
+
+    // node as the job wrote it: unquoted numbers, true, false and null stay as
+    // they are, anything else becomes a string.
+    static std::string json_scalar(const YAML::Node& node) {
+        auto value = node.as<std::string>();
+        static const std::regex number("-?(0|[1-9][0-9]*)(\\.[0-9]+)?([eE][+-]?[0-9]+)?");
+        bool plain = node.Tag() == "?";
+        if (plain && (value == "true" || value == "false" || value == "null" || std::regex_match(value, number)))
+            return value;
+        return quote(value);
+    }
+
+    static std::string reply(const std::string& id, const std::string& status, const std::string& message,
+                             const std::string& extra = "") {
+        std::string line = "{\"id\": " + id + ", \"status\": " + quote(status);
+        if (!message.empty())
+            line += ", \"message\": " + quote(message);
+        return line + extra + "}";
+    }
+};
+
+// Serves jobs read line by line from stdin, replying on stdout, until stdin closes
+// and every job has finished.
+inline int serve_stdin(render_server& server) {
+    std::mutex output;
+    std::vector<std::future<void>> jobs;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        jobs.push_back(server.submit(line, [&output](const std::string& response) {
+            std::lock_guard<std::mutex> lock(output);
+            std::cout << response << std::endl;
+        }));
+    }
+    for (auto& job : jobs)
+        job.wait();
+    return 0;
+}
+
+// Serves jobs on a Unix domain socket at path; every connection sends job lines
+// and receives one reply line per job.
+inline int serve_socket(render_server& server, const std::string& path) {
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: Socket path '" << path << "' is too long." << std::endl;
+        close(listen_fd);
+        return 1;
+    }
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(path.c_str());
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listen_fd, 16) < 0) {
+        std::cerr << "Error: Cannot listen on '" << path << "'." << std::endl;
+        close(listen_fd);
+        return 1;
+    }
+
+    for (;;) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+
+        // The socket closes once the peer has stopped sending and every reply is out.
+        struct connection_state {
+            std::mutex mutex;
+            int fd;
+            int outstanding = 0;
+            bool reading = true;
+
+            void finish_if_done() {
+                if (!reading && outstanding == 0)
+                    close(fd);
+            }
+        };
+        auto connection = std::make_shared<connection_state>();
+        connection->fd = fd;
+
+        std::thread([&server, connection] {
+            int fd = connection->fd;
+            std::string pending;
+            char buffer[4096];
+            ssize_t received;
+            while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+                pending.append(buffer, received);
+                size_t end;
+                while ((end = pending.find('\n')) != std::string::npos) {
+                    auto line = pending.substr(0, end);
+                    pending.erase(0, end + 1);
+                    if (line.find_first_not_of(" \t\r") == std::string::npos)
+                        continue;
+                    {
+                        std::lock_guard<std::mutex> lock(connection->mutex);
+                        connection->outstanding++;
+                    }
+                    server.submit(line, [connection](const std::string& response) {
+                        std::lock_guard<std::mutex> lock(connection->mutex);
+                        auto text = response + "\n";
+                        send(connection->fd, text.data(), text.size(), MSG_NOSIGNAL);
+                        connection->outstanding--;
+                        connection->finish_if_done();
+                    });
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            connection->reading = false;
+            connection->finish_if_done();
+        }).detach();
+    }
+}
+
+// raytracer -server [-jobs int] [-cache int] [-tc int] [-gc int] [socket path]
+//
+// The texture and geometry cache budgets are shared by every job, so they are set
+// here rather than in job options.
+inline int run_render_server(int argc, char* argv[]) {
+    int jobs = 1;
+    int cache_size = 8;
+    std::string path;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-jobs" && i + 1 < argc)
+            jobs = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "-cache" && i + 1 < argc)
+            cache_size = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "-tc" && i + 1 < argc)
+            texture_cache::global().set_budget(size_t(std::stoi(argv[++i])) << 20);
+        else if (arg == "-gc" && i + 1 < argc)
+            geometry_cache::global().set_budget(size_t(std::stoi(argv[++i])) << 20);
+        else
+            path = arg;
+    }
+
+    render_server server(jobs, cache_size);
+    return path.empty() ? serve_stdin(server) : serve_socket(server, path);
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "common.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Spectral rendering with hero wavelengths. Each camera sample carries four
+// wavelengths down one path: a hero drawn uniformly over the visible range and
+// three more spaced evenly after it, wrapping around. Radiance is a value per
+// wavelength, four wide so the arithmetic vectorizes. A material whose behavior
+// depends on wavelength, such as dispersive glass, follows the hero and drops the
+// others. Wavelengths are in nanometres.
+
+constexpr double lambda_min = 360;
+constexpr double lambda_max = 830;
+
+class sampled_spectrum {
+  public:
+    static constexpr int count = 4;
+
+    sampled_spectrum() : sampled_spectrum(0) {}
+    explicit sampled_spectrum(double c) {
+        for (int i = 0; i < count; i++)
+            v[i] = c;
+    }
+
+    double operator[](int i) const { return v[i]; }
+    double& operator[](int i) { return v[i]; }
+
+    sampled_spectrum& operator+=(const sampled_spectrum& s) {
+        for (int i = 0; i < count; i++)
+            v[i] += s.v[i];
+        return *this;
+    }
+
+    sampled_spectrum& operator*=(const sampled_spectrum& s) {
+        for (int i = 0; i < count; i++)
+            v[i] *= s.v[i];
+        return *this;
+    }
+
+    sampled_spectrum& operator*=(double t) {
+        for (int i = 0; i < count; i++)
+            v[i] *= t;
+        return *this;
+    }
+
+    double max_value() const {
+        return fmax(fmax(v[0], v[1]), fmax(v[2], v[3]));
+    }
+
+  private:
+    double v[count];
+};
+
+inline sampled_spectrum operator+(sampled_spectrum a, const sampled_spectrum& b) { return a += b; }
+inline sampled_spectrum operator*(sampled_spectrum a, const sampled_spectrum& b) { return a *= b; }
+inline sampled_spectrum operator*(sampled_spectrum a, double t) { return a *= t; }
+inline sampled_spectrum operator*(double t, sampled_spectrum a) { return a *= t; }
+
+namespace spectral {
+
+// One lobe of the piecewise Gaussian fit to the CIE 1931 color matching functions
+// by Wyman, Sloan and Shirley (2013).
+inline double lobe(double lambda, double mean, double sigma_below, double sigma_above) {
+    auto t = (lambda - mean) / (lambda < mean ? sigma_below : sigma_above);
+    return exp(-0.5 * t * t);
+}
+
+inline vec3 cie_xyz(double lambda) {
+    return vec3(1.056 * lobe(lambda, 599.8, 37.9, 31.0) + 0.362 * lobe(lambda, 442.0, 16.0, 26.7)
+                    - 0.065 * lobe(lambda, 501.1, 20.4, 26.2),
+                0.821 * lobe(lambda, 568.8, 46.9, 40.5) + 0.286 * lobe(lambda, 530.9, 16.3, 31.1),
+                1.217 * lobe(lambda, 437.0, 11.8, 36.0) + 0.681 * lobe(lambda, 459.0, 26.0, 13.8));
+}
+
+inline color xyz_to_linear_srgb(const vec3& xyz) {
+    return color( 3.2404542 * xyz.x() - 1.5371385 * xyz.y() - 0.4985314 * xyz.z(),
+                 -0.9692660 * xyz.x() + 1.8760108 * xyz.y() + 0.0415560 * xyz.z(),
+                  0.0556434 * xyz.x() - 0.2040259 * xyz.y() + 1.0572252 * xyz.z());
+}
+
+// Smooth reflectance curves for the red, green and blue parts of a color. They
+// sum to one at every wavelength, so white stays flat and a reflectance no
+// greater than one in every channel stays physical.
+inline vec3 rgb_basis(double lambda) {
+    const double width = 10;
+    auto above_blue = 1 / (1 + exp(-(lambda - 490) / width));
+    auto above_green = 1 / (1 + exp(-(lambda - 585) / width));
+    return vec3(above_green, above_blue - above_green, 1 - above_blue);
+}
+
+// Linear sRGB of the integral of f against the matching functions, in 1 nm steps.
+template <typename F>
+color integrate_rgb(F f) {
+    vec3 xyz(0,0,0);
+    for (double lambda = lambda_min + 0.5; lambda < lambda_max; lambda += 1)
+        xyz += f(lambda) * cie_xyz(lambda);
+    return xyz_to_linear_srgb(xyz);
+}
+
+// cie_xyz and rgb_basis every nanometre, interpolated in between; the fits cost
+// several exponentials each.
+class table {
+  public:
+    static const table& get() {
+        static const table instance;
+        return instance;
+    }
+
+    vec3 xyz(double lambda) const { return lookup(xyz_values, lambda); }
+    vec3 basis(double lambda) const { return lookup(basis_values, lambda); }
+
+  private:
+    static constexpr int size = int(lambda_max - lambda_min) + 1;
+    vec3 xyz_values[size];
+    vec3 basis_values[size];
+
+    table() {
+        for (int i = 0; i < size; i++) {
+            xyz_values[i] = cie_xyz(lambda_min + i);
+            basis_values[i] = rgb_basis(lambda_min + i);
+        }
+    }
+
+    static vec3 lookup(const vec3* values, double lambda) {
+        auto x = fmin(fmax(lambda - lambda_min, 0.0), size - 1.0);
+        int i = std::min(int(x), size - 2);
+        auto t = x - i;
+        return (1 - t) * values[i] + t * values[i + 1];
+    }
+};
+
+// Scales per channel so the flat unit spectrum comes out as white.
+inline const color& white_balance() {
+    static const color white = integrate_rgb([](double) { return 1.0; });
+    static const color scale(1 / white.x(), 1 / white.y(), 1 / white.z());
+    return scale;
+}
+
+}
+
+class sampled_wavelengths {
+  public:
+    // The hero at u in [0,1) of the range, the others a quarter of the range apart.
+    static sampled_wavelengths sample_uniform(double u) {
+        sampled_wavelengths w;
+        const double range = lambda_max - lambda_min;
+        for (int i = 0; i < sampled_spectrum::count; i++) {
+            auto lambda = lambda_min + (u + double(i) / sampled_spectrum::count) * range;
+            if (lambda >= lambda_max)
+                lambda -= range;
+            w.lambda[i] = lambda;
+            w.pdf[i] = 1 / range;
+            auto basis = spectral::table::get().basis(lambda);
+            for (int c = 0; c < 3; c++)
+                w.basis[c][i] = basis[c];
+        }
+        return w;
+    }
+
+    double operator[](int i) const { return lambda[i]; }
+    double hero() const { return lambda[0]; }
+
+    bool secondary_terminated() const { return pdf[1] == 0; }
+
+    // Leaves only the hero, which then stands for all four.
+    void terminate_secondary() {
+        if (secondary_terminated())
+            return;
+        for (int i = 1; i < sampled_spectrum::count; i++)
+            pdf[i] = 0;
+        pdf[0] /= sampled_spectrum::count;
+    }
+
+    // A reflectance or emission given as linear RGB, at the sampled wavelengths.
+    sampled_spectrum upsample(const color& c) const {
+        sampled_spectrum s;
+        for (int i = 0; i < sampled_spectrum::count; i++)
+            s[i] = c.x() * basis[0][i] + c.y() * basis[1][i] + c.z() * basis[2][i];
+        return s;
+    }
+
+    // One sample's estimate of the linear RGB of radiance s.
+    color to_rgb(const sampled_spectrum& s) const {
+        vec3 xyz(0,0,0);
+        for (int i = 0; i < sampled_spectrum::count; i++)
+            if (pdf[i] > 0)
+                xyz += (s[i] / pdf[i]) * spectral::table::get().xyz(lambda[i]);
+        auto rgb = spectral::xyz_to_linear_srgb(xyz / sampled_spectrum::count);
+        return rgb * spectral::white_balance();
+    }
+
+  private:
+    double lambda[sampled_spectrum::count];
+    double pdf[sampled_spectrum::count];
+    double basis[3][sampled_spectrum::count];
+};
+
+#endif
@@ -1,51 +1,86 @@
-#ifndef SPHERE_H
-#define SPHERE_H
-
-#include "hittable.h"
-#include "common.h"
-
-class sphere : public hittable {
-  public:
-    sphere(point3 _center, double _radius, shared_ptr<material> _material)
-      : center(_center), radius(_radius), mat(_material) {
-        auto rvec = vec3(radius, radius, radius);
-        bbox = aabb(center - rvec, center + rvec);
-      }
-
-    aabb bounding_box() const override { return bbox; }
-
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        vec3 oc = r.origin() - center;
-        auto a = r.direction().length_squared();
-        auto half_b = dot(oc, r.direction());
-        auto c = oc.length_squared() - radius*radius;
-
-        auto discriminant = half_b*half_b - a*c;
-        if (discriminant < 0) return false;
-        auto sqrtd = sqrt(discriminant);
-
+#ifndef SPHERE_H
+#define SPHERE_H
+
+#include "hittable.h"
+#include "common.h"
+
+class sphere : public hittable {
+  public:
+    sphere(point3 _center, double _radius, int _material)
+      : center(_center), radius(_radius), mat(_material) {
+        auto rvec = vec3(radius, radius, radius);
+        bbox = aabb(center - rvec, center + rvec);
+      }
+
+    // Moving sphere, centered at _center at time 0 and at _center2 at time 1.
+    sphere(point3 _center, point3 _center2, double _radius, int _material)
+      : center(_center), radius(_radius), mat(_material), is_moving(true) {
+        center_vec = _center2 - _center;
+        bbox = aabb(bounding_box_at(0), bounding_box_at(1));
+      }
+
+    aabb bounding_box() const override { return bbox; }
+
+    shared_ptr<hittable> replicate() const override { return make_shared<sphere>(*this); }
+
+    aabb bounding_box_at(double time) const override {
+        if (!is_moving)
+            return bbox;
+        auto rvec = vec3(radius, radius, radius);
+        return aabb(center_at(time) - rvec, center_at(time) + rvec);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        point3 current_center = is_moving ? center_at(r.time()) : center;
+        vec3 oc = r.origin() - current_center;
+        auto a = r.length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius*radius;
+
+        auto discriminant = half_b*half_b - a*c;
+        if (discriminant < 0) return false;
+        auto sqrtd = sqrt(discriminant);
+
         
-        auto root = (-half_b - sqrtd) / a;
-        if (!ray_t.surrounds(root)) {
-            root = (-half_b + sqrtd) / a;
-            if (!ray_t.surrounds(root))
-                return false;
-        }
-
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        rec.mat = mat;
-
-        return true;
-    }
-
-  private:
-    point3 center;
-    double radius;
-    shared_ptr<material> mat;
-    aabb bbox;
-};
-
+        auto root = (-half_b - sqrtd) / a;
+        if (!ray_t.surrounds(root)) {
+            root = (-half_b + sqrtd) / a;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+
+        rec.t = root;
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - current_center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.uv_density = 1 / (pi * radius);
+        rec.mat_id = mat;
+
+        return true;
+    }
+
+  private:
+    point3 center;
+    double radius;
+    int mat;
+    bool is_moving = false;
+    vec3 center_vec;
+    aabb bbox;
+
+    point3 center_at(double time) const {
+        return center + time*center_vec;
+    }
+
+    static void get_sphere_uv(const point3& p, double& u, double& v) {
+        // p is a point on the unit sphere; u wraps around the Y axis starting at -X,
+        // v runs from the bottom pole to the top one.
+        auto theta = acos(-p.y());
+        auto phi = atan2(-p.z(), p.x()) + pi;
+
+        u = phi / (2*pi);
+        v = theta / pi;
+    }
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,190 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running submitted tasks in order of submission. The
+// destructor finishes every queued task before joining.
+class thread_pool {
+  public:
+    explicit thread_pool(int threads = static_cast<int>(std::thread::hardware_concurrency())) {
+        for (int i = 0; i < (threads > 0 ? threads : 1); i++)
+            workers.emplace_back([this] { run(); });
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const { return static_cast<int>(workers.size()); }
+
+    template <typename F>
+    auto submit(F&& f) -> std::future<decltype(f())> {
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
+        auto result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([task] { (*task)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+  private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void run() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
+
+// Threads that each keep their own deque of tasks. A task posted from a worker goes
+// on that worker's deque, which it runs newest first; one posted from outside goes
+// on a shared queue, run oldest first. An idle worker takes from its own deque,
+// then the shared queue, then steals the oldest task of another worker, so work
+// split recursively spreads its largest pieces first. The destructor finishes every
+// queued task, including ones posted while finishing, before joining.
+class work_stealing_pool {
+  public:
+    explicit work_stealing_pool(int threads = static_cast<int>(std::thread::hardware_concurrency())) {
+        threads = threads > 0 ? threads : 1;
+        for (int i = 0; i < threads; i++)
+            queues.push_back(std::make_unique<task_queue>());
+        for (int i = 0; i < threads; i++)
+            workers.emplace_back([this, i] { run(i); });
+    }
+
+    ~work_stealing_pool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    work_stealing_pool(const work_stealing_pool&) = delete;
+    work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+    int size() const { return static_cast<int>(workers.size()); }
+
+    void post(std::function<void()> task) {
+        auto& self = current();
+        auto& queue = (self.pool == this) ? *queues[self.index] : shared;
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            pending++;
+        }
+        wake.notify_one();
+    }
+
+    // Tasks taken from another worker's deque so far.
+    size_t steals() const { return stolen.load(); }
+
+  private:
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    struct worker_identity {
+        const work_stealing_pool* pool = nullptr;
+        int index = 0;
+    };
+
+    std::vector<std::unique_ptr<task_queue>> queues;
+    task_queue shared;
+    std::vector<std::thread> workers;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<size_t> pending{0};     // Queued and not yet taken; raised under sleep_mutex
+    std::atomic<size_t> stolen{0};
+    bool stopping = false;
+
+    static worker_identity& current() {
+        static thread_local worker_identity identity;
+        return identity;
+    }
+
+    static bool pop(task_queue& queue, bool newest, std::function<void()>& task) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            return false;
+        if (newest) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+
+    bool take(int index, std::function<void()>& task) {
+        if (pop(*queues[index], true, task) || pop(shared, false, task))
+            return true;
+        for (size_t k = 1; k < queues.size(); k++) {
+            if (pop(*queues[(index + k) % queues.size()], false, task)) {
+                stolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(int index) {
+        current() = {this, index};
+        for (;;) {
+            std::function<void()> task;
+            if (take(index, task)) {
+                pending--;
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || pending > 0; });
+            if (stopping && pending == 0)
+                return;
+        }
+    }
+};
+
+#endif
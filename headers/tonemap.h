@@ -0,0 +1,193 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include "color.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class tone_curve { clip, reinhard, aces };
+
+inline bool parse_tone_curve(const std::string& name, tone_curve& curve) {
+    if (name == "clip")
+        curve = tone_curve::clip;
+    else if (name == "reinhard")
+        curve = tone_curve::reinhard;
+    else if (name == "aces")
+        curve = tone_curve::aces;
+    else
+        return false;
+    return true;
+}
+
+// How summed samples become the values written out. The defaults are what
+// write_color does: linear values, clipped and truncated to 8 bits, as text.
+struct output_settings {
+    double exposure = 0;                    // In stops; each one doubles the brightness
+    tone_curve curve = tone_curve::clip;
+    bool srgb = false;                      // Encode with the sRGB transfer curve
+    bool dither = false;                    // 4x4 ordered dither before quantizing
+    int bits = 8;                           // 8 or 16 bits per channel
+    bool binary = false;                    // P6 instead of P3; -stitch only reads P3
+
+    int max_value() const { return bits > 8 ? 65535 : 255; }
+};
+
+// The output stage, a row at a time: scales by exposure, applies the tone curve,
+// encodes through a table of the sRGB curve and quantizes, dithered or not. The
+// channels of a row are handled as one flat array in loops the compiler
+// vectorizes, and write_pixels() maps and formats blocks of rows in parallel.
+class tone_mapper {
+  public:
+    // scale multiplies every value first, as 1 / samples_per_pixel does for sums.
+    tone_mapper(const output_settings& _settings, double scale) : settings(_settings) {
+        gain = scale * exp2(settings.exposure);
+        levels = settings.max_value() + 1.0;
+
+        // Bayer thresholds in [0, 1) for the four columns of each row, repeated for
+        // the three channels of a pixel; truncating after adding one rounds up as
+        // often as the fraction dropped, so flat areas keep their mean. The pattern
+        // is anchored to the frame, so crops dither as the full render does.
+        static const int bayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+        for (int y = 0; y < 4; y++)
+            for (int k = 0; k < 12; k++)
+                offsets[y][k] = settings.dither ? (bayer[y][k / 3] + 0.5) / 16 : 0.0;
+
+        if (settings.srgb) {
+            srgb_table.resize(table_size + 1);
+            for (int i = 0; i <= table_size; i++)
+                srgb_table[i] = srgb_encode(double(i) / table_size);
+        }
+    }
+
+    static double srgb_encode(double linear) {
+        return linear <= 0.0031308 ? 12.92 * linear : 1.055 * pow(linear, 1 / 2.4) - 0.055;
+    }
+
+    // Maps width pixels, from column x of frame row y, to 3 * width values in
+    // [0, max_value].
+    template <typename T>
+    void map_row(const color* row, int width, int x, int y, T* out) const {
+        int n = 3 * width;
+        std::vector<double> v(n);
+        for (int i = 0; i < width; i++)
+            for (int c = 0; c < 3; c++)
+                v[3 * i + c] = row[i][c];
+
+        const double g = gain;
+        switch (settings.curve) {
+          case tone_curve::clip:
+            #pragma omp simd
+            for (int k = 0; k < n; k++)
+                v[k] = std::min(std::max(v[k] * g, 0.0), 1.0);
+            break;
+          case tone_curve::reinhard:
+            #pragma omp simd
+            for (int k = 0; k < n; k++) {
+                auto x = std::max(v[k] * g, 0.0);
+                v[k] = x / (1 + x);
+            }
+            break;
+          case tone_curve::aces:
+            // Narkowicz's fit of the ACES filmic curve.
+            #pragma omp simd
+            for (int k = 0; k < n; k++) {
+                auto x = std::max(v[k] * g, 0.0);
+                v[k] = std::min(x * (2.51 * x + 0.03) / (x * (2.43 * x + 0.59) + 0.14), 1.0);
+            }
+            break;
+        }
+
+        if (settings.srgb) {
+            const double* table = srgb_table.data();
+            #pragma omp simd
+            for (int k = 0; k < n; k++) {
+                auto x = v[k] * table_size;
+                int i = std::min(int(x), table_size - 1);
+                v[k] = table[i] + (x - i) * (table[i + 1] - table[i]);
+            }
+        }
+
+        const double* offset = offsets[y & 3];
+        const int shift = 3 * (x & 3);
+        const double top = levels - 1;
+        #pragma omp simd
+        for (int k = 0; k < n; k++)
+            out[k] = static_cast<T>(std::min(std::max(v[k] * levels + offset[(k + shift) % 12], 0.0), top));
+    }
+
+    // Writes the width x height pixels of image as PPM rows, after the header.
+    // (x0, y0) is the image's top left pixel in the frame.
+    void write_pixels(const std::vector<color>& image, int width, int height, std::ostream& out,
+                      int x0 = 0, int y0 = 0) const {
+        const int block = 64;
+        std::vector<std::string> rows(block);
+        for (int first = 0; first < height; first += block) {
+            int count = std::min(block, height - first);
+            #pragma omp parallel for schedule(dynamic)
+            for (int r = 0; r < count; r++) {
+                const color* row = image.data() + size_t(first + r) * width;
+                int y = y0 + first + r;
+                rows[r] = settings.binary ? pack_row(row, width, x0, y) : format_row(row, width, x0, y);
+            }
+            for (int r = 0; r < count; r++)
+                out.write(rows[r].data(), rows[r].size());
+        }
+    }
+
+  private:
+    static constexpr int table_size = 4096;
+
+    output_settings settings;
+    double gain;
+    double levels;
+    double offsets[4][12];
+    std::vector<double> srgb_table;
+
+    // "r g b\n" per pixel, as write_color prints.
+    std::string format_row(const color* row, int width, int x, int y) const {
+        std::vector<uint16_t> values(3 * size_t(width));
+        map_row(row, width, x, y, values.data());
+
+        std::string text(values.size() * 6, '\0');
+        char* p = &text[0];
+        for (size_t k = 0; k < values.size(); k++) {
+            char digits[5];
+            int count = 0;
+            unsigned value = values[k];
+            do {
+                digits[count++] = char('0' + value % 10);
+                value /= 10;
+            } while (value);
+            while (count)
+                *p++ = digits[--count];
+            *p++ = (k % 3 == 2) ? '\n' : ' ';
+        }
+        text.resize(p - text.data());
+        return text;
+    }
+
+    // Bytes, or big-endian 16-bit words, as P6 stores them.
+    std::string pack_row(const color* row, int width, int x, int y) const {
+        size_t n = 3 * size_t(width);
+        if (settings.bits <= 8) {
+            std::string bytes(n, '\0');
+            map_row(row, width, x, y, reinterpret_cast<uint8_t*>(&bytes[0]));
+            return bytes;
+        }
+        std::vector<uint16_t> values(n);
+        map_row(row, width, x, y, values.data());
+        std::string bytes(2 * n, '\0');
+        for (size_t k = 0; k < n; k++) {
+            bytes[2 * k] = char(values[k] >> 8);
+            bytes[2 * k + 1] = char(values[k] & 0xff);
+        }
+        return bytes;
+    }
+};
+
+#endif
@@ -1,28 +1,97 @@
-#include "headers/common.h"
-#include "headers/color.h"
-#include "headers/hittable_list.h"
-#include "headers/sphere.h"
-#include "headers/quad.h"
-#include "headers/bvh.h"
-#include "headers/parser.h"
-#include "camera/camera.h"
-#include "material/material.h"
-
-#include <iostream>
-#include <cstdlib>
-#include <chrono>
-#include <iomanip>
-
-int main(int argc, char *argv[]) {
-    
-    if(!checkargs(argc, argv))
-        return 0;
-
-    hittable_list world;
-    camera cam;
-
-    createscene(argv[argc - 1], &cam, &world);
-    configurecamera(argc, argv, &cam);
-    
-    cam.render(world);
+#include "headers/common.h"
+#include "headers/color.h"
+#include "headers/hittable_list.h"
+#include "headers/sphere.h"
+#include "headers/quad.h"
+#include "headers/bvh.h"
+#include "headers/parser.h"
+#include "headers/preview.h"
+#include "headers/server.h"
+#include "camera/camera.h"
+#include "camera/render_job.h"
+#include "camera/stitch.h"
+#include "material/material.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <iomanip>
+
+int main(int argc, char *argv[]) {
+    
+    if (argc == 4 && std::string(argv[1]) == "-worker")
+        return run_render_worker(argv[2], std::stoi(argv[3]), loadpayload);
+
+    if (argc >= 3 && std::string(argv[1]) == "-stitch")
+        return stitch_images(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+
+    if (argc >= 2 && std::string(argv[1]) == "-server")
+        return run_render_server(argc, argv);
+
+    if(!checkargs(argc, argv))
+        return 0;
+
+    for (int i = 1; i < argc - 1; ++i)
+        if (std::string(argv[i]) == "-preview")
+            return run_preview(argc, argv);
+
+    hittable_list world;
+    camera cam;
+    material_table materials;
+    animation anim;
+
+    numa_options numa_flags;
+    configurenuma(argc, argv, &numa_flags);
+    auto numa = numatopology(numa_flags);
+    bool interleave = numa && numa_flags.placement == "interleave";
+    if (interleave)
+        interleavescene(*numa, true);
+
+    createscene(argv[argc - 1], &cam, &world, &materials, &anim);
+    configurecamera(argc, argv, &cam);
+    configureanimation(argc, argv, &anim);
+    bvh_options bvh_flags;
+    configurebvh(argc, argv, &bvh_flags);
+
+    if (anim.enabled) {
+        anim.render(cam, world, materials);
+        return 0;
+    }
+
+    shared_ptr<hittable> scene = make_shared<hittable_list>(world);
+    if (!world.objects.empty()) {
+        auto bvh = make_shared<bvh_node>(world, cam.shutter_open, cam.shutter_close);
+        preparebvh(*bvh, bvh_flags);
+        scene = bvh;
+    }
+    if (interleave)
+        interleavescene(*numa, false);
+    cam.numa = numa;
+    cam.numa_replicate = numa_flags.placement == "replicate";
+
+    for (int i = 1; i + 1 < argc - 1; ++i) {
+        if (std::string(argv[i]) == "-coordinator") {
+            render_coordinator coordinator(std::stoi(argv[i + 1]));
+            std::vector<pixel_features> features;
+            auto image = coordinator.render(cam, *scene, materials, createpayload(argc, argv), 32, &features);
+            cam.finish(image, features, std::cout);
+            return 0;
+        }
+    }
+
+    // NUMA placement pins its own team of threads to the nodes.
+    if (cam.numa) {
+        cam.render(*scene, materials);
+        return 0;
+    }
+
+    work_stealing_pool pool(cam.threads);
+    render_callbacks callbacks;
+    callbacks.on_progress = [](int completed, int total) {
+        std::clog << "\rProcessed " << completed << " out of " << total << " tiles." << std::flush;
+    };
+    auto job = render_job::start(pool, cam, scene, make_shared<material_table>(materials), callbacks);
+    job->wait();
+    std::clog << std::endl;
+    job->write(std::cout);
 }
\ No newline at end of file
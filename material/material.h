@@ -1,106 +1,277 @@
-#ifndef MATERIAL_H
-#define MATERIAL_H
-
-#include "./../headers/common.h"
-#include "./../headers/hittable_list.h"
-#include "./../headers/vec3.h"
-#include "./../texture/texture.h"
-
-class material {
-  public:
-    virtual ~material() = default;
-
-    virtual color emitted(double u, double v, const point3& p) const {
-        return color(0,0,0);
-    }
-
-    virtual bool scatter(
-        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
-};
-
-class lambertian : public material {
-  public:
-    lambertian(const color& a) : albedo(a) {}
-
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-    const override {
-        auto scatter_direction = rec.normal + random_unit_vector();
-
-        
-        if (scatter_direction.near_zero())
-            scatter_direction = rec.normal;
-
-        scattered = ray(rec.p, scatter_direction);
-        attenuation = albedo;
-        return true;
-    }
-
-  private:
-    color albedo;
-};
-
-class metal : public material {
-  public:
-    metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
-
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-    const override {
-        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz*random_unit_vector());
-        attenuation = albedo;
-        return (dot(scattered.direction(), rec.normal) > 0);
-    }
-
-  private:
-    color albedo;
-    double fuzz;
-};
-
-class dielectric : public material {
-  public:
-    dielectric(double index_of_refraction) : ir(index_of_refraction) {}
-
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-    const override {
-        attenuation = color(1.0, 1.0, 1.0);
-        double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
-
-        vec3 unit_direction = unit_vector(r_in.direction());
-        double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
-
-        bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-        vec3 direction;
-
-        if (cannot_refract)
-            direction = reflect(unit_direction, rec.normal);
-        else
-            direction = refract(unit_direction, rec.normal, refraction_ratio);
-
-        scattered = ray(rec.p, direction);
-        return true;
-    }
-
-  private:
-    double ir; 
-};
-
-class diffuse_light : public material {
-  public:
-    diffuse_light(shared_ptr<texture> a) : emit(a) {}
-    diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
-
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-    const override {
-        return false;
-    }
-
-    color emitted(double u, double v, const point3& p) const override {
-        return emit->value(u, v, p);
-    }
-
-  private:
-    shared_ptr<texture> emit;
-};
-
-#endif
\ No newline at end of file
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "./../headers/common.h"
+#include "./../headers/hittable_list.h"
+#include "./../headers/vec3.h"
+#include "./../texture/texture.h"
+
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+class lambertian {
+  public:
+    lambertian(const color& a) : albedo(a) {}
+    lambertian(shared_ptr<texture> a) : albedo(a) {}
+    lambertian(const color_source& a) : albedo(a) {}
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+        auto scatter_direction = rec.normal + random_unit_vector();
+
+
+        if (scatter_direction.near_zero())
+            scatter_direction = rec.normal;
+
+        scattered = ray(rec.p, scatter_direction, r_in.time());
+        attenuation = albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+        return true;
+    }
+
+    // BSDF times cosine for light arriving from direction, and the density with which
+    // scatter() would have picked that direction.
+    color evaluate(const hit_record& rec, const vec3& direction, double& pdf) const {
+        auto cosine = dot(rec.normal, unit_vector(direction));
+        if (cosine <= 0) {
+            pdf = 0;
+            return color(0,0,0);
+        }
+
+        pdf = cosine / pi;
+        return albedo.value(rec.u, rec.v, rec.p, rec.footprint) * (cosine / pi);
+    }
+
+    color surface_albedo(const hit_record& rec) const {
+        return albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+    }
+
+  private:
+    color_source albedo;
+};
+
+class metal {
+  public:
+    metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    metal(shared_ptr<texture> a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    metal(const color_source& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+        scattered = ray(rec.p, reflected + fuzz*random_unit_vector(), r_in.time());
+        attenuation = albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+        return (dot(scattered.direction(), rec.normal) > 0);
+    }
+
+    color surface_albedo(const hit_record& rec) const {
+        return albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+    }
+
+  private:
+    color_source albedo;
+    double fuzz;
+};
+
+// The index of refraction may vary with wavelength (in nanometres), following
+// either Cauchy's equation, n = ir + cauchy_b (1/lambda^2 - 1/lambda_d^2) with
+// lambda in micrometres, or a three-term Sellmeier equation. ir is the index at
+// the helium d line, which is what the glass has when rendered in RGB.
+class dielectric {
+  public:
+    static constexpr double d_line = 587.56;
+
+    dielectric(double index_of_refraction, double _cauchy_b = 0)
+      : ir(index_of_refraction), cauchy_b(_cauchy_b) {}
+
+    // Coefficients B1..B3 and C1..C3 (in square micrometres) as glass catalogues list them.
+    static dielectric sellmeier(const double (&b)[3], const double (&c)[3]) {
+        dielectric glass(1);
+        glass.has_sellmeier = true;
+        for (int i = 0; i < 3; i++) {
+            glass.sellmeier_b[i] = b[i];
+            glass.sellmeier_c[i] = c[i];
+        }
+        glass.ir = glass.index(d_line);
+        return glass;
+    }
+
+    bool dispersive() const { return cauchy_b != 0 || has_sellmeier; }
+
+    double index(double wavelength) const {
+        auto l2 = (wavelength / 1000) * (wavelength / 1000);
+        if (has_sellmeier) {
+            double n2 = 1;
+            for (int i = 0; i < 3; i++)
+                n2 += sellmeier_b[i] * l2 / (l2 - sellmeier_c[i]);
+            return sqrt(n2);
+        }
+        auto d2 = (d_line / 1000) * (d_line / 1000);
+        return ir + cauchy_b * (1 / l2 - 1 / d2);
+    }
+
+    // A wavelength of zero refracts with ir.
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, double wavelength = 0) const {
+        attenuation = color(1.0, 1.0, 1.0);
+        double eta = (wavelength > 0 && dispersive()) ? index(wavelength) : ir;
+        double refraction_ratio = rec.front_face ? (1.0/eta) : eta;
+
+        vec3 unit_direction = unit_vector(r_in.direction());
+        double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+        double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+
+        bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+        vec3 direction;
+
+        if (cannot_refract)
+            direction = reflect(unit_direction, rec.normal);
+        else
+            direction = refract(unit_direction, rec.normal, refraction_ratio);
+
+        scattered = ray(rec.p, direction, r_in.time());
+        return true;
+    }
+
+    color surface_albedo(const hit_record& rec) const {
+        return color(1, 1, 1);
+    }
+
+  private:
+    double ir;
+    double cauchy_b;
+    bool has_sellmeier = false;
+    double sellmeier_b[3] = {0, 0, 0};
+    double sellmeier_c[3] = {0, 0, 0};
+};
+
+class diffuse_light {
+  public:
+    diffuse_light(shared_ptr<texture> a) : emit(a) {}
+    diffuse_light(color c) : emit(c) {}
+    diffuse_light(const color_source& c) : emit(c) {}
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+        return false;
+    }
+
+    color emitted(double u, double v, const point3& p) const {
+        return emit.value(u, v, p);
+    }
+
+    color surface_albedo(const hit_record& rec) const {
+        auto e = emit.value(rec.u, rec.v, rec.p);
+        return color(fmin(e.x(), 1.0), fmin(e.y(), 1.0), fmin(e.z(), 1.0));
+    }
+
+  private:
+    color_source emit;
+};
+
+// Scatters equally in every direction: the phase function of fog and smoke in a
+// constant_medium.
+class isotropic {
+  public:
+    isotropic(const color& a) : albedo(a) {}
+    isotropic(shared_ptr<texture> a) : albedo(a) {}
+    isotropic(const color_source& a) : albedo(a) {}
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+        scattered = ray(rec.p, random_unit_vector(), r_in.time());
+        attenuation = albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+        return true;
+    }
+
+    color evaluate(const hit_record& rec, const vec3& direction, double& pdf) const {
+        pdf = 1 / (4 * pi);
+        return albedo.value(rec.u, rec.v, rec.p, rec.footprint) * pdf;
+    }
+
+    color surface_albedo(const hit_record& rec) const {
+        return albedo.value(rec.u, rec.v, rec.p, rec.footprint);
+    }
+
+  private:
+    color_source albedo;
+};
+
+// Materials are stored by value in a tagged union so shading dispatches through
+// a jump table on the variant index instead of a virtual call per bounce.
+using material = std::variant<lambertian, metal, dielectric, diffuse_light, isotropic>;
+
+class material_table {
+  public:
+    int add(const material& m) {
+        materials.push_back(m);
+        return static_cast<int>(materials.size()) - 1;
+    }
+
+    size_t size() const { return materials.size(); }
+
+    const material& operator[](int id) const { return materials[id]; }
+
+    // Whether any material emits light; paths in scenes without one skip the lookups.
+    bool emissive() const {
+        for (const auto& m : materials)
+            if (std::holds_alternative<diffuse_light>(m))
+                return true;
+        return false;
+    }
+
+    // Variant index of the material, used to bin hits by material type.
+    size_t kind(int id) const { return materials[id].index(); }
+
+    color emitted(int id, double u, double v, const point3& p) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            if constexpr (std::is_same_v<T, diffuse_light>)
+                return m.emitted(u, v, p);
+            else
+                return color(0,0,0);
+        }, materials[id]);
+    }
+
+    // Only non-specular materials can be evaluated for an arbitrary direction, which is
+    // what direct light sampling needs; returns false for the others.
+    bool evaluate(int id, const hit_record& rec, const vec3& direction, color& f, double& pdf) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            if constexpr (std::is_same_v<T, lambertian> || std::is_same_v<T, isotropic>) {
+                f = m.evaluate(rec, direction, pdf);
+                return true;
+            } else {
+                return false;
+            }
+        }, materials[id]);
+    }
+
+    // Reflectance seen at a first hit, used as a feature buffer by the denoiser.
+    color albedo(int id, const hit_record& rec) const {
+        return std::visit([&](const auto& m) { return m.surface_albedo(rec); }, materials[id]);
+    }
+
+    bool scatter(int id, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+        return std::visit([&](const auto& m) {
+            return m.scatter(r_in, rec, attenuation, scattered);
+        }, materials[id]);
+    }
+
+    // Whether scattering off the material depends on the wavelength of the light.
+    bool dispersive(int id) const {
+        auto glass = std::get_if<dielectric>(&materials[id]);
+        return glass && glass->dispersive();
+    }
+
+    // Scatters light of the given wavelength, for spectral rendering.
+    bool scatter(int id, const ray& r_in, const hit_record& rec, double wavelength, color& attenuation, ray& scattered) const {
+        return std::visit([&](const auto& m) {
+            using T = std::decay_t<decltype(m)>;
+            if constexpr (std::is_same_v<T, dielectric>)
+                return m.scatter(r_in, rec, attenuation, scattered, wavelength);
+            else
+                return m.scatter(r_in, rec, attenuation, scattered);
+        }, materials[id]);
+    }
+
+  private:
+    std::vector<material> materials;
+};
+
+#endif
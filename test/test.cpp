@@ -1,467 +1,2049 @@
-#include <gtest/gtest.h>
-#include "../headers/common.h"
-#include "../headers/ray.h"
-#include "../material/material.h"
-#include "../headers/color.h"
-#include "../headers/aabb.h"
-
-TEST(CommonTest, DegreesToRadians) {
-  // Test with 0 degrees
-  double result = degrees_to_radians(0.0);
-  EXPECT_NEAR(result, 0.0, 0.00001);
-
-  // Test with positive degrees
-  result = degrees_to_radians(45.0);
-  EXPECT_NEAR(result, 0.78539816, 0.00001);
-
-  // Test with negative degrees
-  result = degrees_to_radians(-90.0);
-  EXPECT_NEAR(result, -1.5707963, 0.00001);
-
-  // Test with large degrees
-  result = degrees_to_radians(180.0);
-  EXPECT_NEAR(result, 3.1415926, 0.00001);
-}
-
-
-TEST(Vec3Test, OperatorNegation) {
-  vec3 v(1.0, 2.0, 3.0);
-  vec3 neg_v = -v;
-  EXPECT_EQ(neg_v.x(), -1.0);
-  EXPECT_EQ(neg_v.y(), -2.0);
-  EXPECT_EQ(neg_v.z(), -3.0);
-}
-
-TEST(Vec3Test, OperatorSubscript) {
-  vec3 v(1.0, 2.0, 3.0);
-  EXPECT_EQ(v[0], 1.0);
-  EXPECT_EQ(v[1], 2.0);
-  EXPECT_EQ(v[2], 3.0);
-}
-
-TEST(Vec3Test, OperatorSubscriptAssignment) {
-  vec3 v(1.0, 2.0, 3.0);
-  v[0] = 4.0;
-  v[1] = 5.0;
-  v[2] = 6.0;
-  EXPECT_EQ(v.x(), 4.0);
-  EXPECT_EQ(v.y(), 5.0);
-  EXPECT_EQ(v.z(), 6.0);
-}
-
-TEST(Vec3Test, OperatorPlusEqual) {
-  vec3 v1(1.0, 2.0, 3.0);
-  vec3 v2(4.0, 5.0, 6.0);
-  v1 += v2;
-  EXPECT_EQ(v1.x(), 5.0);
-  EXPECT_EQ(v1.y(), 7.0);
-  EXPECT_EQ(v1.z(), 9.0);
-}
-
-TEST(Vec3Test, OperatorMultiplyEqual) {
-  vec3 v(1.0, 2.0, 3.0);
-  double t = 2.0;
-  v *= t;
-  EXPECT_EQ(v.x(), 2.0);
-  EXPECT_EQ(v.y(), 4.0);
-  EXPECT_EQ(v.z(), 6.0);
-}
-
-TEST(Vec3Test, OperatorDivideEqual) {
-  vec3 v(2.0, 4.0, 6.0);
-  double t = 2.0;
-  v /= t;
-  EXPECT_EQ(v.x(), 1.0);
-  EXPECT_EQ(v.y(), 2.0);
-  EXPECT_EQ(v.z(), 3.0);
-}
-
-TEST(Vec3Test, Length) {
-  vec3 v(3.0, 4.0, 0.0);
-  EXPECT_DOUBLE_EQ(v.length(), 5.0);
-}
-
-TEST(Vec3Test, LengthSquared) {
-  vec3 v(3.0, 4.0, 0.0);
-  EXPECT_DOUBLE_EQ(v.length_squared(), 25.0);
-}
-
-TEST(Vec3Test, NearZeroTest) {
-  // Test case 1: Vector is not near zero
-  vec3 vec1(1.0, 2.0, 3.0);
-  EXPECT_FALSE(vec1.near_zero());
-
-  // Test case 2: Vector is near zero
-  vec3 vec2(0.000000001, 0.000000002, 0.000000003);
-  EXPECT_TRUE(vec2.near_zero());
-
-  // Test case 3: Vector is exactly zero
-  vec3 vec3(0.0, 0.0, 0.0);
-  EXPECT_TRUE(vec3.near_zero());
-}
-
-TEST(Vec3Test, DotProduct) {
-  vec3 u(1.0, 2.0, 3.0);
-  vec3 v(4.0, 5.0, 6.0);
-
-  double result = dot(u, v);
-
-  // Check if the dot product is calculated correctly
-  EXPECT_EQ(result, 32.0);
-}
-
-TEST(Vec3Test, OrthogonalVectors) {
-  vec3 u(1.0, 0.0, 0.0);
-  vec3 v(0.0, 1.0, 0.0);
-
-  double result = dot(u, v);
-
-  // Check if the dot product of orthogonal vectors is zero
-  EXPECT_EQ(result, 0.0);
-}
-
-TEST(Vec3Test, CrossProduct) {
-  // Test case 1: Cross product of (1, 0, 0) and (0, 1, 0)
-  vec3 u(1, 0, 0);
-  vec3 v(0, 1, 0);
-  vec3 result = cross(u, v);
-  vec3 expected_result(0, 0, 1);
-  EXPECT_DOUBLE_EQ(result.x(), expected_result.x());
-  EXPECT_DOUBLE_EQ(result.y(), expected_result.y());
-  EXPECT_DOUBLE_EQ(result.z(), expected_result.z());
-
-  // Test case 2: Cross product of (2, 3, 4) and (5, 6, 7)
-  u = vec3(2, 3, 4);
-  v = vec3(5, 6, 7);
-  result = cross(u, v);
-  expected_result = vec3(-3, 6, -3);
-  EXPECT_DOUBLE_EQ(result.x(), expected_result.x());
-  EXPECT_DOUBLE_EQ(result.y(), expected_result.y());
-  EXPECT_DOUBLE_EQ(result.z(), expected_result.z());
-}
-
-TEST(Vec3Test, ReflectionInYAxis) {
-  vec3 v(1.0, 1.0, 0.0);
-  vec3 n(0.0, 1.0, 0.0);
-  vec3 reflected = reflect(v, n);
-  vec3 expected(1.0, -1.0, 0.0);
-
-  EXPECT_DOUBLE_EQ(reflected.x(), expected.x());
-  EXPECT_DOUBLE_EQ(reflected.y(), expected.y());
-  EXPECT_DOUBLE_EQ(reflected.z(), expected.z());
-}
-
-TEST(IntervalTest, Contains) {
-  interval i(0, 10);
-  
-  // Test if the interval contains a value within its range
-  EXPECT_TRUE(i.contains(5));
-  
-  // Test if the interval does not contain a value outside its range
-  EXPECT_FALSE(i.contains(-5));
-  EXPECT_FALSE(i.contains(15));
-}
-
-TEST(IntervalTest, Surrounds) {
-  interval i(0, 10);
-  
-  // Test if the interval surrounds a value within its range
-  EXPECT_TRUE(i.surrounds(5));
-  
-  // Test if the interval does not surround a value outside its range
-  EXPECT_FALSE(i.surrounds(0));
-  EXPECT_FALSE(i.surrounds(10));
-}
-
-TEST(IntervalTest, Clamp) {
-  interval i(0, 10);
-  
-  // Test if the interval clamps a value within its range
-  EXPECT_EQ(i.clamp(5), 5);
-  
-  // Test if the interval clamps a value below its range
-  EXPECT_EQ(i.clamp(-5), 0);
-  
-  // Test if the interval clamps a value above its range
-  EXPECT_EQ(i.clamp(15), 10);
-}
-
-TEST(IntervalTest, Size) {
-  interval i(0.0, 10.0);
-  
-  // Test if the interval size is calculated correctly
-  EXPECT_EQ(i.size(), 10.0);
-}
-
-TEST(IntervalTest, Expand) {
-  interval i(0, 10);
-  
-  // Test if the interval is expanded correctly
-  interval expanded = i.expand(2);
-  EXPECT_EQ(expanded.min, -1);
-  EXPECT_EQ(expanded.max, 11);
-}
-
-
-TEST(RayTest, AtFunctionReturnsCorrectPoint) {
-  // Create a ray with origin at (1, 2, 3) and direction (4, 5, 6)
-  ray r(point3(1, 2, 3), vec3(4, 5, 6));
-
-  // Test the at() function for different values of t
-  EXPECT_EQ(r.at(0).x(), 1);
-  EXPECT_EQ(r.at(0).y(), 2);
-  EXPECT_EQ(r.at(0).z(), 3);
-
-  EXPECT_EQ(r.at(1).x(), 5);
-  EXPECT_EQ(r.at(1).y(), 7);
-  EXPECT_EQ(r.at(1).z(), 9);
-
-  EXPECT_EQ(r.at(-1).x(), -3);
-  EXPECT_EQ(r.at(-1).y(), -3);
-  EXPECT_EQ(r.at(-1).z(), -3);
-
-  EXPECT_EQ(r.at(2.5).x(), 11);
-  EXPECT_EQ(r.at(2.5).y(), 14.5);
-  EXPECT_EQ(r.at(2.5).z(), 18);
-}
-
-TEST(RayTest, OriginAndDirectionFunctionsReturnCorrectValues) {
-  // Create a ray with origin at (1, 2, 3) and direction (4, 5, 6)
-  ray r(point3(1, 2, 3), vec3(4, 5, 6));
-
-  // Test the origin() and direction() functions
-  EXPECT_EQ(r.origin().x(), 1);
-  EXPECT_EQ(r.origin().y(), 2);
-  EXPECT_EQ(r.origin().z(), 3);
-
-  EXPECT_EQ(r.direction().x(), 4);
-  EXPECT_EQ(r.direction().y(), 5);
-  EXPECT_EQ(r.direction().z(), 6);
-}
-
-
-TEST(MaterialTest, LambertianScatter) {
-    lambertian mat(color(0.5, 0.5, 0.5));
-    ray r_in(point3(0, 0, 0), vec3(1, 1, 1));
-    hit_record rec;
-    color attenuation;
-    ray scattered;
-
-    bool result = mat.scatter(r_in, rec, attenuation, scattered);
-
-    // Assert the result and check the values of attenuation and scattered
-    EXPECT_TRUE(result);
-    EXPECT_EQ(attenuation.x(), 0.5);
-    EXPECT_EQ(attenuation.y(), 0.5);
-    EXPECT_EQ(attenuation.z(), 0.5);
-    EXPECT_EQ(scattered.origin().x(), rec.p.x());
-    EXPECT_EQ(scattered.origin().y(), rec.p.y());
-    EXPECT_EQ(scattered.origin().z(), rec.p.z());
-    // Add more assertions for scattered direction and other properties
-}
-
-TEST(MaterialTest, MetalScatter) {
-    // Create a metal material with albedo (0.8, 0.8, 0.8) and fuzz 0.2
-    metal mat(color(0.8, 0.8, 0.8), 0.2);
-
-    // Create a ray pointing in the positive x direction
-    ray r_in(point3(0, 0, 0), vec3(1, 0, 0));
-
-    // Create a hit record indicating a hit at (1, 0, 0) with a normal pointing in the positive y direction
-    hit_record rec;
-    rec.p = point3(1, 0, 0);
-    rec.normal = vec3(0, 1, 0);
-
-    color attenuation;
-    ray scattered;
-
-    // Call the scatter function
-    bool result = mat.scatter(r_in, rec, attenuation, scattered);
-
-    // Check the result
-    EXPECT_TRUE(result);
-
-    // Check the attenuation
-    EXPECT_EQ(attenuation.x(), 0.8);
-    EXPECT_EQ(attenuation.y(), 0.8);
-    EXPECT_EQ(attenuation.z(), 0.8);
-
-    // Check the origin of the scattered ray
-    EXPECT_EQ(scattered.origin().x(), rec.p.x());
-    EXPECT_EQ(scattered.origin().y(), rec.p.y());
-    EXPECT_EQ(scattered.origin().z(), rec.p.z());
-
-    // Check the direction of the scattered ray
-    // The exact direction will depend on the random unit vector, so we can't check it directly
-    // But we can check that it's not equal to the original direction
-    EXPECT_NE(scattered.direction().x(), r_in.direction().x());
-    EXPECT_NE(scattered.direction().y(), r_in.direction().y());
-    EXPECT_NE(scattered.direction().z(), r_in.direction().z());
-
-    // Check that the dot product of the scattered direction and the normal is positive
-    EXPECT_GT(dot(scattered.direction(), rec.normal), 0);
-}
-
-TEST(MaterialTest, DielectricScatter) {
-    // Create a dielectric material with index of refraction 1.5
-    dielectric mat(1.5);
-
-    // Create a ray pointing in the positive x direction
-    ray r_in(point3(0, 0, 0), vec3(1, 0, 0));
-
-    // Create a hit record indicating a hit at (1, 0, 0) with a normal pointing in the positive y direction
-    hit_record rec;
-    rec.p = point3(1, 0, 0);
-    rec.normal = vec3(0, 1, 0);
-    rec.front_face = true; // Assuming the ray hits the front face of the material
-
-    color attenuation;
-    ray scattered;
-
-    // Call the scatter function
-    bool result = mat.scatter(r_in, rec, attenuation, scattered);
-
-    // Check the result
-    EXPECT_TRUE(result);
-
-    // Check the attenuation
-    EXPECT_EQ(attenuation.x(), 1.0);
-    EXPECT_EQ(attenuation.y(), 1.0);
-    EXPECT_EQ(attenuation.z(), 1.0);
-
-    // Check the origin of the scattered ray
-    EXPECT_EQ(scattered.origin().x(), rec.p.x());
-    EXPECT_EQ(scattered.origin().y(), rec.p.y());
-    EXPECT_EQ(scattered.origin().z(), rec.p.z());
-}
-
-TEST(MaterialTest, DiffuseLightScatter) {
-    diffuse_light mat(color(1.0, 1.0, 1.0));
-    ray r_in(point3(0, 0, 0), vec3(1, 1, 1));
-    hit_record rec;
-    color attenuation;
-    ray scattered;
-
-    bool result = mat.scatter(r_in, rec, attenuation, scattered);
-
-    // Assert the result and check the values of attenuation and scattered
-    EXPECT_FALSE(result);
-    EXPECT_EQ(scattered.origin().x(), rec.p.x());
-    EXPECT_EQ(scattered.origin().y(), rec.p.y());
-    EXPECT_EQ(scattered.origin().z(), rec.p.z());
-    // Add more assertions for emitted color and other properties
-}
-
-TEST(MaterialTest, DiffuseLightEmitted) {
-    diffuse_light mat(color(1.0, 1.0, 1.0));
-    double u = 0.5;
-    double v = 0.5;
-    point3 p(1, 1, 1);
-
-    color emittedColor = mat.emitted(u, v, p);
-
-    // Assert the emitted color value
-    EXPECT_EQ(emittedColor.x(), 1.0);
-    EXPECT_EQ(emittedColor.y(), 1.0);
-    EXPECT_EQ(emittedColor.z(), 1.0);
-    // Add more assertions for emitted color properties
-}
-
-TEST(MaterialTest, DiffuseLight) {
-    // Create a diffuse light with a solid color texture
-    color c(0.8, 0.8, 0.8);
-    auto texture = make_shared<solid_color>(c);
-    diffuse_light mat(texture);
-
-    // Test the scatter method
-    // Create a ray pointing in the positive x direction
-    ray r_in(point3(0, 0, 0), vec3(1, 0, 0));
-
-    // Create a hit record indicating a hit at (1, 0, 0) with a normal pointing in the positive y direction
-    hit_record rec;
-    rec.p = point3(1, 0, 0);
-    rec.normal = vec3(0, 1, 0);
-
-    color attenuation;
-    ray scattered;
-
-    // Call the scatter function
-    bool result = mat.scatter(r_in, rec, attenuation, scattered);
-
-    // Check the result
-    EXPECT_FALSE(result);
-
-    // Test the emitted method
-    color emitted = mat.emitted(0.5, 0.5, point3(1, 0, 0));
-
-    // Check the emitted color
-    EXPECT_EQ(emitted.x(), c.x());
-    EXPECT_EQ(emitted.y(), c.y());
-    EXPECT_EQ(emitted.z(), c.z());
-}
-
-TEST(AABBTest, Constructor) {
-  // Test the default constructor
-  aabb box1;
-  EXPECT_EQ(box1.x.min, std::numeric_limits<double>::infinity());
-  EXPECT_EQ(box1.x.max, -std::numeric_limits<double>::infinity());
-  EXPECT_EQ(box1.y.min, std::numeric_limits<double>::infinity());
-  EXPECT_EQ(box1.y.max, -std::numeric_limits<double>::infinity());
-  EXPECT_EQ(box1.z.min, std::numeric_limits<double>::infinity());
-  EXPECT_EQ(box1.z.max, -std::numeric_limits<double>::infinity());
-
-  // Test the constructor with intervals
-  interval ix(1.0, 2.0);
-  interval iy(3.0, 4.0);
-  interval iz(5.0, 6.0);
-  aabb box2(ix, iy, iz);
-  EXPECT_EQ(box2.x.min, 1.0);
-  EXPECT_EQ(box2.x.max, 2.0);
-  EXPECT_EQ(box2.y.min, 3.0);
-  EXPECT_EQ(box2.y.max, 4.0);
-  EXPECT_EQ(box2.z.min, 5.0);
-  EXPECT_EQ(box2.z.max, 6.0);
-
-  // Test the constructor with points
-  point3 a(1.0, 2.0, 3.0);
-  point3 b(4.0, 5.0, 6.0);
-  aabb box3(a, b);
-  EXPECT_EQ(box3.x.min, 1.0);
-  EXPECT_EQ(box3.x.max, 4.0);
-  EXPECT_EQ(box3.y.min, 2.0);
-  EXPECT_EQ(box3.y.max, 5.0);
-  EXPECT_EQ(box3.z.min, 3.0);
-  EXPECT_EQ(box3.z.max, 6.0);
-
-  // Test the constructor with two boxes
-  aabb box4(box2, box3);
-  EXPECT_EQ(box4.x.min, 1.0);
-  EXPECT_EQ(box4.x.max, 4.0);
-  EXPECT_EQ(box4.y.min, 2.0);
-  EXPECT_EQ(box4.y.max, 5.0);
-  EXPECT_EQ(box4.z.min, 3.0);
-  EXPECT_EQ(box4.z.max, 6.0);
-}
-
-TEST(AABBTest, Pad) {
-  // Test the pad method
-  aabb box(interval(1.0, 2.0), interval(3.0, 4.0), interval(5.0, 6.0));
-  aabb paddedBox = box.pad();
-  EXPECT_NEAR(paddedBox.x.min, 0.9999, 0.0002);
-  EXPECT_NEAR(paddedBox.x.max, 2.0001, 0.0002);
-  EXPECT_NEAR(paddedBox.y.min, 2.9999, 0.0002);
-  EXPECT_NEAR(paddedBox.y.max, 4.0001, 0.0002);
-  EXPECT_NEAR(paddedBox.z.min, 4.9999, 0.0002);
-  EXPECT_NEAR(paddedBox.z.max, 6.0001, 0.0002);
-}
-
-TEST(AABBTest, Axis) {
-  // Test the axis method
-  aabb box(interval(1.0, 2.0), interval(3.0, 4.0), interval(5.0, 6.0));
-  EXPECT_EQ(box.axis(0).min, 1.0);
-  EXPECT_EQ(box.axis(0).max, 2.0);
-  EXPECT_EQ(box.axis(1).min, 3.0);
-  EXPECT_EQ(box.axis(1).max, 4.0);
-  EXPECT_EQ(box.axis(2).min, 5.0);
-  EXPECT_EQ(box.axis(2).max, 6.0);
-}
\ No newline at end of file
+#include <gtest/gtest.h>
+#include "../headers/common.h"
+#include "../headers/ray.h"
+#include "../material/material.h"
+#include "../headers/color.h"
+#include "../headers/aabb.h"
+#include "../headers/constant_medium.h"
+#include "../headers/cuboid.h"
+#include "../headers/quad.h"
+#include "../headers/sphere.h"
+#include "../camera/animation.h"
+#include "../camera/distributed.h"
+#include "../camera/progressive.h"
+#include "../camera/render_job.h"
+#include "../camera/stitch.h"
+#include "../headers/distribution.h"
+#include "../headers/lru_cache.h"
+#include "../headers/numa.h"
+#include "../headers/geometry_pages.h"
+#include "../headers/primitive_file.h"
+#include "../headers/thread_pool.h"
+#include "../texture/environment.h"
+
+#include <fstream>
+#include <future>
+#include <thread>
+
+TEST(CommonTest, DegreesToRadians) {
+  // Test with 0 degrees
+  double result = degrees_to_radians(0.0);
+  EXPECT_NEAR(result, 0.0, 0.00001);
+
+  // Test with positive degrees
+  result = degrees_to_radians(45.0);
+  EXPECT_NEAR(result, 0.78539816, 0.00001);
+
+  // Test with negative degrees
+  result = degrees_to_radians(-90.0);
+  EXPECT_NEAR(result, -1.5707963, 0.00001);
+
+  // Test with large degrees
+  result = degrees_to_radians(180.0);
+  EXPECT_NEAR(result, 3.1415926, 0.00001);
+}
+
+
+TEST(Vec3Test, OperatorNegation) {
+  vec3 v(1.0, 2.0, 3.0);
+  vec3 neg_v = -v;
+  EXPECT_EQ(neg_v.x(), -1.0);
+  EXPECT_EQ(neg_v.y(), -2.0);
+  EXPECT_EQ(neg_v.z(), -3.0);
+}
+
+TEST(Vec3Test, OperatorSubscript) {
+  vec3 v(1.0, 2.0, 3.0);
+  EXPECT_EQ(v[0], 1.0);
+  EXPECT_EQ(v[1], 2.0);
+  EXPECT_EQ(v[2], 3.0);
+}
+
+TEST(Vec3Test, OperatorSubscriptAssignment) {
+  vec3 v(1.0, 2.0, 3.0);
+  v[0] = 4.0;
+  v[1] = 5.0;
+  v[2] = 6.0;
+  EXPECT_EQ(v.x(), 4.0);
+  EXPECT_EQ(v.y(), 5.0);
+  EXPECT_EQ(v.z(), 6.0);
+}
+
+TEST(Vec3Test, OperatorPlusEqual) {
+  vec3 v1(1.0, 2.0, 3.0);
+  vec3 v2(4.0, 5.0, 6.0);
+  v1 += v2;
+  EXPECT_EQ(v1.x(), 5.0);
+  EXPECT_EQ(v1.y(), 7.0);
+  EXPECT_EQ(v1.z(), 9.0);
+}
+
+TEST(Vec3Test, OperatorMultiplyEqual) {
+  vec3 v(1.0, 2.0, 3.0);
+  double t = 2.0;
+  v *= t;
+  EXPECT_EQ(v.x(), 2.0);
+  EXPECT_EQ(v.y(), 4.0);
+  EXPECT_EQ(v.z(), 6.0);
+}
+
+TEST(Vec3Test, OperatorDivideEqual) {
+  vec3 v(2.0, 4.0, 6.0);
+  double t = 2.0;
+  v /= t;
+  EXPECT_EQ(v.x(), 1.0);
+  EXPECT_EQ(v.y(), 2.0);
+  EXPECT_EQ(v.z(), 3.0);
+}
+
+TEST(Vec3Test, Length) {
+  vec3 v(3.0, 4.0, 0.0);
+  EXPECT_DOUBLE_EQ(v.length(), 5.0);
+}
+
+TEST(Vec3Test, LengthSquared) {
+  vec3 v(3.0, 4.0, 0.0);
+  EXPECT_DOUBLE_EQ(v.length_squared(), 25.0);
+}
+
+TEST(Vec3Test, NearZeroTest) {
+  // Test case 1: Vector is not near zero
+  vec3 vec1(1.0, 2.0, 3.0);
+  EXPECT_FALSE(vec1.near_zero());
+
+  // Test case 2: Vector is near zero
+  vec3 vec2(0.000000001, 0.000000002, 0.000000003);
+  EXPECT_TRUE(vec2.near_zero());
+
+  // Test case 3: Vector is exactly zero
+  vec3 vec3(0.0, 0.0, 0.0);
+  EXPECT_TRUE(vec3.near_zero());
+}
+
+TEST(Vec3Test, DotProduct) {
+  vec3 u(1.0, 2.0, 3.0);
+  vec3 v(4.0, 5.0, 6.0);
+
+  double result = dot(u, v);
+
+  // Check if the dot product is calculated correctly
+  EXPECT_EQ(result, 32.0);
+}
+
+TEST(Vec3Test, OrthogonalVectors) {
+  vec3 u(1.0, 0.0, 0.0);
+  vec3 v(0.0, 1.0, 0.0);
+
+  double result = dot(u, v);
+
+  // Check if the dot product of orthogonal vectors is zero
+  EXPECT_EQ(result, 0.0);
+}
+
+TEST(Vec3Test, CrossProduct) {
+  // Test case 1: Cross product of (1, 0, 0) and (0, 1, 0)
+  vec3 u(1, 0, 0);
+  vec3 v(0, 1, 0);
+  vec3 result = cross(u, v);
+  vec3 expected_result(0, 0, 1);
+  EXPECT_DOUBLE_EQ(result.x(), expected_result.x());
+  EXPECT_DOUBLE_EQ(result.y(), expected_result.y());
+  EXPECT_DOUBLE_EQ(result.z(), expected_result.z());
+
+  // Test case 2: Cross product of (2, 3, 4) and (5, 6, 7)
+  u = vec3(2, 3, 4);
+  v = vec3(5, 6, 7);
+  result = cross(u, v);
+  expected_result = vec3(-3, 6, -3);
+  EXPECT_DOUBLE_EQ(result.x(), expected_result.x());
+  EXPECT_DOUBLE_EQ(result.y(), expected_result.y());
+  EXPECT_DOUBLE_EQ(result.z(), expected_result.z());
+}
+
+TEST(Vec3Test, ReflectionInYAxis) {
+  vec3 v(1.0, 1.0, 0.0);
+  vec3 n(0.0, 1.0, 0.0);
+  vec3 reflected = reflect(v, n);
+  vec3 expected(1.0, -1.0, 0.0);
+
+  EXPECT_DOUBLE_EQ(reflected.x(), expected.x());
+  EXPECT_DOUBLE_EQ(reflected.y(), expected.y());
+  EXPECT_DOUBLE_EQ(reflected.z(), expected.z());
+}
+
+TEST(IntervalTest, Contains) {
+  interval i(0, 10);
+  
+  // Test if the interval contains a value within its range
+  EXPECT_TRUE(i.contains(5));
+  
+  // Test if the interval does not contain a value outside its range
+  EXPECT_FALSE(i.contains(-5));
+  EXPECT_FALSE(i.contains(15));
+}
+
+TEST(IntervalTest, Surrounds) {
+  interval i(0, 10);
+  
+  // Test if the interval surrounds a value within its range
+  EXPECT_TRUE(i.surrounds(5));
+  
+  // Test if the interval does not surround a value outside its range
+  EXPECT_FALSE(i.surrounds(0));
+  EXPECT_FALSE(i.surrounds(10));
+}
+
+TEST(IntervalTest, Clamp) {
+  interval i(0, 10);
+  
+  // Test if the interval clamps a value within its range
+  EXPECT_EQ(i.clamp(5), 5);
+  
+  // Test if the interval clamps a value below its range
+  EXPECT_EQ(i.clamp(-5), 0);
+  
+  // Test if the interval clamps a value above its range
+  EXPECT_EQ(i.clamp(15), 10);
+}
+
+TEST(IntervalTest, Size) {
+  interval i(0.0, 10.0);
+  
+  // Test if the interval size is calculated correctly
+  EXPECT_EQ(i.size(), 10.0);
+}
+
+TEST(IntervalTest, Expand) {
+  interval i(0, 10);
+  
+  // Test if the interval is expanded correctly
+  interval expanded = i.expand(2);
+  EXPECT_EQ(expanded.min, -1);
+  EXPECT_EQ(expanded.max, 11);
+}
+
+
+TEST(RayTest, AtFunctionReturnsCorrectPoint) {
+  // Create a ray with origin at (1, 2, 3) and direction (4, 5, 6)
+  ray r(point3(1, 2, 3), vec3(4, 5, 6));
+
+  // Test the at() function for different values of t
+  EXPECT_EQ(r.at(0).x(), 1);
+  EXPECT_EQ(r.at(0).y(), 2);
+  EXPECT_EQ(r.at(0).z(), 3);
+
+  EXPECT_EQ(r.at(1).x(), 5);
+  EXPECT_EQ(r.at(1).y(), 7);
+  EXPECT_EQ(r.at(1).z(), 9);
+
+  EXPECT_EQ(r.at(-1).x(), -3);
+  EXPECT_EQ(r.at(-1).y(), -3);
+  EXPECT_EQ(r.at(-1).z(), -3);
+
+  EXPECT_EQ(r.at(2.5).x(), 11);
+  EXPECT_EQ(r.at(2.5).y(), 14.5);
+  EXPECT_EQ(r.at(2.5).z(), 18);
+}
+
+TEST(RayTest, OriginAndDirectionFunctionsReturnCorrectValues) {
+  // Create a ray with origin at (1, 2, 3) and direction (4, 5, 6)
+  ray r(point3(1, 2, 3), vec3(4, 5, 6));
+
+  // Test the origin() and direction() functions
+  EXPECT_EQ(r.origin().x(), 1);
+  EXPECT_EQ(r.origin().y(), 2);
+  EXPECT_EQ(r.origin().z(), 3);
+
+  EXPECT_EQ(r.direction().x(), 4);
+  EXPECT_EQ(r.direction().y(), 5);
+  EXPECT_EQ(r.direction().z(), 6);
+}
+
+
+TEST(MaterialTest, LambertianScatter) {
+    lambertian mat(color(0.5, 0.5, 0.5));
+    ray r_in(point3(0, 0, 0), vec3(1, 1, 1));
+    hit_record rec;
+    color attenuation;
+    ray scattered;
+
+    bool result = mat.scatter(r_in, rec, attenuation, scattered);
+
+    // Assert the result and check the values of attenuation and scattered
+    EXPECT_TRUE(result);
+    EXPECT_EQ(attenuation.x(), 0.5);
+    EXPECT_EQ(attenuation.y(), 0.5);
+    EXPECT_EQ(attenuation.z(), 0.5);
+    EXPECT_EQ(scattered.origin().x(), rec.p.x());
+    EXPECT_EQ(scattered.origin().y(), rec.p.y());
+    EXPECT_EQ(scattered.origin().z(), rec.p.z());
+    // Add more assertions for scattered direction and other properties
+}
+
+TEST(MaterialTest, MetalScatter) {
+    // Create a metal material with albedo (0.8, 0.8, 0.8) and fuzz 0.2
+    metal mat(color(0.8, 0.8, 0.8), 0.2);
+
+    // Create a ray pointing in the positive x direction
+    ray r_in(point3(0, 0, 0), vec3(1, 0, 0));
+
+    // Create a hit record indicating a hit at (1, 0, 0) with a normal pointing in the positive y direction
+    hit_record rec;
+    rec.p = point3(1, 0, 0);
+    rec.normal = vec3(0, 1, 0);
+
+    color attenuation;
+    ray scattered;
+
+    // Call the scatter function
+    bool result = mat.scatter(r_in, rec, attenuation, scattered);
+
+    // Check the result
+    EXPECT_TRUE(result);
+
+    // Check the attenuation
+    EXPECT_EQ(attenuation.x(), 0.8);
+    EXPECT_EQ(attenuation.y(), 0.8);
+    EXPECT_EQ(attenuation.z(), 0.8);
+
+    // Check the origin of the scattered ray
+    EXPECT_EQ(scattered.origin().x(), rec.p.x());
+    EXPECT_EQ(scattered.origin().y(), rec.p.y());
+    EXPECT_EQ(scattered.origin().z(), rec.p.z());
+
+    // Check the direction of the scattered ray
+    // The exact direction will depend on the random unit vector, so we can't check it directly
+    // But we can check that it's not equal to the original direction
+    EXPECT_NE(scattered.direction().x(), r_in.direction().x());
+    EXPECT_NE(scattered.direction().y(), r_in.direction().y());
+    EXPECT_NE(scattered.direction().z(), r_in.direction().z());
+
+    // Check that the dot product of the scattered direction and the normal is positive
+    EXPECT_GT(dot(scattered.direction(), rec.normal), 0);
+}
+
+TEST(MaterialTest, DielectricScatter) {
+    // Create a dielectric material with index of refraction 1.5
+    dielectric mat(1.5);
+
+    // Create a ray pointing in the positive x direction
+    ray r_in(point3(0, 0, 0), vec3(1, 0, 0));
+
+    // Create a hit record indicating a hit at (1, 0, 0) with a normal pointing in the positive y direction
+    hit_record rec;
+    rec.p = point3(1, 0, 0);
+    rec.normal = vec3(0, 1, 0);
+    rec.front_face = true; // Assuming the ray hits the front face of the material
+
+    color attenuation;
+    ray scattered;
+
+    // Call the scatter function
+    bool result = mat.scatter(r_in, rec, attenuation, scattered);
+
+    // Check the result
+    EXPECT_TRUE(result);
+
+    // Check the attenuation
+    EXPECT_EQ(attenuation.x(), 1.0);
+    EXPECT_EQ(attenuation.y(), 1.0);
+    EXPECT_EQ(attenuation.z(), 1.0);
+
+    // Check the origin of the scattered ray
+    EXPECT_EQ(scattered.origin().x(), rec.p.x());
+    EXPECT_EQ(scattered.origin().y(), rec.p.y());
+    EXPECT_EQ(scattered.origin().z(), rec.p.z());
+}
+
+TEST(MaterialTest, DiffuseLightScatter) {
+    diffuse_light mat(color(1.0, 1.0, 1.0));
+    ray r_in(point3(0, 0, 0), vec3(1, 1, 1));
+    hit_record rec;
+    color attenuation;
+    ray scattered;
+
+    bool result = mat.scatter(r_in, rec, attenuation, scattered);
+
+    // Assert the result and check the values of attenuation and scattered
+    EXPECT_FALSE(result);
+    EXPECT_EQ(scattered.origin().x(), rec.p.x());
+    EXPECT_EQ(scattered.origin().y(), rec.p.y());
+    EXPECT_EQ(scattered.origin().z(), rec.p.z());
+    // Add more assertions for emitted color and other properties
+}
+
+TEST(MaterialTest, DiffuseLightEmitted) {
+    diffuse_light mat(color(1.0, 1.0, 1.0));
+    double u = 0.5;
+    double v = 0.5;
+    point3 p(1, 1, 1);
+
+    color emittedColor = mat.emitted(u, v, p);
+
+    // Assert the emitted color value
+    EXPECT_EQ(emittedColor.x(), 1.0);
+    EXPECT_EQ(emittedColor.y(), 1.0);
+    EXPECT_EQ(emittedColor.z(), 1.0);
+    // Add more assertions for emitted color properties
+}
+
+TEST(MaterialTest, DiffuseLight) {
+    // Create a diffuse light with a solid color texture
+    color c(0.8, 0.8, 0.8);
+    auto texture = make_shared<solid_color>(c);
+    diffuse_light mat(texture);
+
+    // Test the scatter method
+    // Create a ray pointing in the positive x direction
+    ray r_in(point3(0, 0, 0), vec3(1, 0, 0));
+
+    // Create a hit record indicating a hit at (1, 0, 0) with a normal pointing in the positive y direction
+    hit_record rec;
+    rec.p = point3(1, 0, 0);
+    rec.normal = vec3(0, 1, 0);
+
+    color attenuation;
+    ray scattered;
+
+    // Call the scatter function
+    bool result = mat.scatter(r_in, rec, attenuation, scattered);
+
+    // Check the result
+    EXPECT_FALSE(result);
+
+    // Test the emitted method
+    color emitted = mat.emitted(0.5, 0.5, point3(1, 0, 0));
+
+    // Check the emitted color
+    EXPECT_EQ(emitted.x(), c.x());
+    EXPECT_EQ(emitted.y(), c.y());
+    EXPECT_EQ(emitted.z(), c.z());
+}
+
+TEST(MaterialTableTest, AddReturnsSequentialIds) {
+    material_table materials;
+    int first = materials.add(lambertian(color(0.5, 0.5, 0.5)));
+    int second = materials.add(dielectric(1.5));
+
+    EXPECT_EQ(first, 0);
+    EXPECT_EQ(second, 1);
+    EXPECT_EQ(materials.size(), 2u);
+
+    // The kind is the variant index, so hits can be binned by material type
+    EXPECT_EQ(materials.kind(first), material(lambertian(color())).index());
+    EXPECT_EQ(materials.kind(second), material(dielectric(1.0)).index());
+}
+
+TEST(MaterialTableTest, ScatterDispatchesToMaterial) {
+    material_table materials;
+    int id = materials.add(metal(color(0.8, 0.6, 0.4), 0.0));
+
+    ray r_in(point3(0, 0, 0), vec3(1, -1, 0));
+    hit_record rec;
+    rec.p = point3(1, -1, 0);
+    rec.normal = vec3(0, 1, 0);
+
+    color attenuation;
+    ray scattered;
+    bool result = materials.scatter(id, r_in, rec, attenuation, scattered);
+
+    // A perfect mirror reflects about the normal
+    EXPECT_TRUE(result);
+    EXPECT_EQ(attenuation.x(), 0.8);
+    EXPECT_EQ(attenuation.y(), 0.6);
+    EXPECT_EQ(attenuation.z(), 0.4);
+    EXPECT_NEAR(scattered.direction().x(), 1 / sqrt(2.0), 1e-12);
+    EXPECT_NEAR(scattered.direction().y(), 1 / sqrt(2.0), 1e-12);
+}
+
+TEST(MaterialTableTest, OnlyLightsEmit) {
+    material_table materials;
+    int surface = materials.add(lambertian(color(0.5, 0.5, 0.5)));
+    int light = materials.add(diffuse_light(color(4.0, 2.0, 1.0)));
+
+    color dark = materials.emitted(surface, 0.5, 0.5, point3(0, 0, 0));
+    color bright = materials.emitted(light, 0.5, 0.5, point3(0, 0, 0));
+
+    EXPECT_EQ(dark.length_squared(), 0.0);
+    EXPECT_EQ(bright.x(), 4.0);
+    EXPECT_EQ(bright.y(), 2.0);
+    EXPECT_EQ(bright.z(), 1.0);
+
+    // Lights absorb everything that reaches them
+    ray r_in(point3(0, 0, 0), vec3(1, 1, 1));
+    hit_record rec;
+    color attenuation;
+    ray scattered;
+    EXPECT_FALSE(materials.scatter(light, r_in, rec, attenuation, scattered));
+}
+
+TEST(ImageTextureTest, ReadsAsciiAndBinaryPPM) {
+    // A 2x1 image: a white pixel followed by a mid gray one
+    std::string ascii = testing::TempDir() + "ascii.ppm";
+    std::ofstream(ascii) << "P3\n# comment\n2 1\n255\n255 255 255 128 128 128\n";
+
+    std::string binary = testing::TempDir() + "binary.ppm";
+    std::ofstream out(binary, std::ios::binary);
+    out << "P6\n2 1\n255\n";
+    const unsigned char rgb[6] = {255, 255, 255, 128, 128, 128};
+    out.write(reinterpret_cast<const char*>(rgb), 6);
+    out.close();
+
+    for (const auto& filename : {ascii, binary}) {
+        image_file img(filename);
+        ASSERT_TRUE(img.valid());
+        EXPECT_EQ(img.width(), 2);
+        EXPECT_EQ(img.height(), 1);
+
+        float block[6];
+        img.read_block(0, 0, 2, 1, block);
+
+        // Eight-bit values are decoded with the gamma 2 curve used on output
+        EXPECT_FLOAT_EQ(block[0], 1.0f);
+        EXPECT_NEAR(block[3], (128.0 / 255) * (128.0 / 255), 1e-6);
+    }
+}
+
+TEST(ImageTextureTest, CoarseLevelsAverageTheImage) {
+    // Left half black, right half white
+    std::string filename = testing::TempDir() + "halves.ppm";
+    std::ofstream file(filename);
+    file << "P3\n64 64\n255\n";
+    for (int y = 0; y < 64; y++)
+        for (int x = 0; x < 64; x++)
+            file << (x < 32 ? "0 0 0 " : "255 255 255 ");
+    file.close();
+
+    texture_cache cache;
+    image_texture tex(filename, cache);
+
+    // Without a footprint the finest level is sampled
+    EXPECT_NEAR(tex.value(0.25, 0.5, point3()).x(), 0.0, 1e-6);
+    EXPECT_NEAR(tex.value(0.75, 0.5, point3()).x(), 1.0, 1e-6);
+
+    // A footprint covering the whole texture lands on the 1x1 level
+    color average = tex.value(0.25, 0.5, point3(), 1.0);
+    EXPECT_NEAR(average.x(), 0.5, 1e-6);
+    EXPECT_NEAR(average.y(), 0.5, 1e-6);
+    EXPECT_NEAR(average.z(), 0.5, 1e-6);
+}
+
+TEST(ImageTextureTest, CacheStaysWithinBudget) {
+    std::string filename = testing::TempDir() + "large.ppm";
+    std::ofstream file(filename, std::ios::binary);
+    file << "P6\n256 256\n255\n";
+    for (int i = 0; i < 256 * 256; i++)
+        file.put(char(i % 256)).put(char(i / 256)).put(0);
+    file.close();
+
+    // Room for four of the sixty four level 0 tiles
+    texture_cache cache(4 * sizeof(texture_cache::tile));
+    image_texture tex(filename, cache);
+
+    for (int j = 0; j < 8; j++)
+        for (int i = 0; i < 8; i++)
+            tex.value((i + 0.5) / 8, (j + 0.5) / 8, point3());
+
+    EXPECT_LE(cache.resident_bytes(), 4 * sizeof(texture_cache::tile));
+    EXPECT_GE(cache.tile_loads(), 64u);
+
+    // Evicted tiles are reloaded with the same contents: red and green hold the
+    // texel's column and row, decoded with the gamma 2 curve.
+    size_t loads = cache.tile_loads();
+    for (auto [x, y] : {std::pair<int, int>{5, 9}, std::pair<int, int>{200, 100}}) {
+        color texel = tex.value((x + 0.5) / 256, 1 - (y + 0.5) / 256, point3());
+        EXPECT_NEAR(texel.x(), (x / 255.0) * (x / 255.0), 1e-6);
+        EXPECT_NEAR(texel.y(), (y / 255.0) * (y / 255.0), 1e-6);
+        EXPECT_NEAR(texel.z(), 0.0, 1e-6);
+    }
+    EXPECT_GT(cache.tile_loads(), loads);
+}
+
+TEST(ProceduralTextureTest, PerlinNoiseIsZeroOnLatticeAndBounded) {
+    perlin noise;
+
+    // Gradient noise vanishes at integer lattice points
+    EXPECT_DOUBLE_EQ(noise.noise(point3(0, 0, 0)), 0.0);
+    EXPECT_DOUBLE_EQ(noise.noise(point3(3, -7, 12)), 0.0);
+
+    double lowest = 0, highest = 0;
+    for (int i = 0; i < 1000; i++) {
+        double n = noise.noise(point3(i * 0.137, i * 0.291, i * -0.173));
+        lowest = fmin(lowest, n);
+        highest = fmax(highest, n);
+    }
+    EXPECT_GE(lowest, -1.0);
+    EXPECT_LE(highest, 1.0);
+    EXPECT_LT(lowest, 0.0);
+    EXPECT_GT(highest, 0.0);
+}
+
+TEST(ProceduralTextureTest, CheckerAlternatesCells) {
+    checker_texture checker(1.0, color(1, 1, 1), color(0, 0, 0));
+
+    EXPECT_EQ(checker.value(0, 0, point3(0.5, 0.5, 0.5)).x(), 1.0);
+    EXPECT_EQ(checker.value(0, 0, point3(1.5, 0.5, 0.5)).x(), 0.0);
+    EXPECT_EQ(checker.value(0, 0, point3(1.5, 1.5, 0.5)).x(), 1.0);
+    EXPECT_EQ(checker.value(0, 0, point3(-0.5, 0.5, 0.5)).x(), 0.0);
+}
+
+TEST(EnvironmentTest, DistributionFollowsFunction) {
+    double f[4] = {0.0, 1.0, 3.0, 0.0};
+    distribution_1d dist(f, 4);
+
+    EXPECT_DOUBLE_EQ(dist.integral, 1.0);
+
+    // The first quarter of the range maps onto the second bin, the rest onto the third
+    double pdf;
+    int offset;
+    double x = dist.sample(0.125, pdf, offset);
+    EXPECT_EQ(offset, 1);
+    EXPECT_DOUBLE_EQ(pdf, 1.0);
+    EXPECT_DOUBLE_EQ(x, 0.375);
+
+    x = dist.sample(0.625, pdf, offset);
+    EXPECT_EQ(offset, 2);
+    EXPECT_DOUBLE_EQ(pdf, 3.0);
+    EXPECT_DOUBLE_EQ(x, 0.625);
+}
+
+TEST(EnvironmentTest, SamplingMatchesDensity) {
+    // An 8x4 map, dark except for one bright texel in the upper hemisphere
+    std::string filename = testing::TempDir() + "sky.pfm";
+    std::ofstream file(filename, std::ios::binary);
+    file << "PF\n8 4\n-1.0\n";
+    for (int y = 3; y >= 0; y--) {
+        for (int x = 0; x < 8; x++) {
+            float value = (x == 2 && y == 1) ? 100.0f : 0.5f;
+            float rgb[3] = {value, value, value};
+            file.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+        }
+    }
+    file.close();
+
+    environment_map env(filename);
+    ASSERT_TRUE(env.valid());
+
+    // The solid angle density integrates to one over the sphere
+    double sum = 0;
+    const int n = 200000;
+    for (int i = 0; i < n; i++)
+        sum += env.pdf(random_unit_vector());
+    EXPECT_NEAR(sum / n * 4 * pi, 1.0, 0.05);
+
+    // Sampled directions report the radiance and density found by direct lookup,
+    // and the bright texel is chosen most of the time
+    int bright = 0;
+    for (int i = 0; i < 1000; i++) {
+        vec3 direction;
+        double pdf;
+        color radiance = env.sample(random_double(), random_double(), direction, pdf);
+
+        EXPECT_NEAR(pdf, env.pdf(direction), 1e-6 * pdf);
+        EXPECT_EQ(radiance.x(), env.value(direction).x());
+        if (radiance.x() > 1)
+            bright++;
+    }
+    EXPECT_GT(bright, 800);
+}
+
+// A small, fast view of a floor with a unit sphere at (0, 1, 0)
+static void set_test_view(camera& cam) {
+    cam.image_width = 40;
+    cam.aspect_ratio = 4.0 / 3.0;
+    cam.samples_per_pixel = 4;
+    cam.max_depth = 5;
+    cam.lookfrom = point3(0, 2, 6);
+    cam.lookat = point3(0, 1, 0);
+    cam.vup = vec3(0, 1, 0);
+    cam.vfov = 40;
+}
+
+// A small lit scene shared by the rendering tests
+static void build_test_scene(camera& cam, hittable_list& world, material_table& materials) {
+    int white = materials.add(lambertian(color(0.7, 0.7, 0.7)));
+    int glass = materials.add(dielectric(1.5));
+    int light = materials.add(diffuse_light(color(4, 4, 4)));
+
+    world.add(make_shared<quad>(point3(-3, 0, -3), vec3(6, 0, 0), vec3(0, 0, 6), white));
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, glass));
+    world.add(make_shared<quad>(point3(-1, 4, -1), vec3(2, 0, 0), vec3(0, 0, 2), light));
+
+    set_test_view(cam);
+}
+
+static std::vector<color> render_single_process(camera cam, const hittable_list& world, const material_table& materials) {
+    cam.initialize();
+    std::vector<color> image(size_t(cam.image_width) * cam.height());
+    cam.render_region(world, materials, 0, 0, cam.image_width, cam.height(), image.data(), cam.image_width);
+    return image;
+}
+
+static void expect_same_image(const std::vector<color>& a, const std::vector<color>& b) {
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        EXPECT_EQ(a[i].x(), b[i].x());
+        EXPECT_EQ(a[i].y(), b[i].y());
+        EXPECT_EQ(a[i].z(), b[i].z());
+    }
+}
+
+// A bare connection to a coordinator, for playing a misbehaving worker.
+static int connect_to_coordinator(int port) {
+    int fd = -1;
+    addrinfo* address = nullptr;
+    getaddrinfo("localhost", std::to_string(port).c_str(), nullptr, &address);
+    for (auto a = address; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, SOCK_STREAM, 0);
+        if (connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(address);
+    return fd;
+}
+
+TEST(DistributedTest, WorkersMatchSingleProcessDespiteFailure) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+    auto expected = render_single_process(cam, world, materials);
+
+    render_coordinator coordinator(0);
+    ASSERT_TRUE(coordinator.listening());
+    int port = coordinator.port();
+
+    auto result = std::async(std::launch::async, [&] {
+        return coordinator.render(cam, world, materials, "scene", 8);
+    });
+
+    // This worker takes the job and a tile, then dies without answering
+    {
+        int fd = connect_to_coordinator(port);
+        ASSERT_GE(fd, 0);
+
+        uint32_t type;
+        std::vector<char> body;
+        ASSERT_TRUE(recv_message(fd, type, body));
+        EXPECT_EQ(type, job_message);
+        EXPECT_EQ(std::string(body.begin(), body.end()), "scene");
+        ASSERT_TRUE(recv_message(fd, type, body));
+        EXPECT_EQ(type, tile_message);
+        close(fd);
+    }
+
+    auto loader = [&](const std::string& payload, camera& c, hittable_list& w, material_table& m) {
+        c = cam;
+        w = world;
+        m = materials;
+        return payload == "scene";
+    };
+    std::thread first([&] { EXPECT_EQ(run_render_worker("localhost", port, loader), 0); });
+    std::thread second([&] { EXPECT_EQ(run_render_worker("127.0.0.1", port, loader), 0); });
+
+    expect_same_image(result.get(), expected);
+    first.join();
+    second.join();
+}
+
+TEST(DistributedTest, MalformedAndSilentWorkersAreDropped) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+    auto expected = render_single_process(cam, world, materials);
+
+    render_coordinator coordinator(0);
+    ASSERT_TRUE(coordinator.listening());
+    coordinator.fallback_seconds = 1;
+    coordinator.tile_seconds = 0.5;
+    int port = coordinator.port();
+    auto result = std::async(std::launch::async, [&] {
+        return coordinator.render(cam, world, materials, "scene", 8);
+    });
+
+    // The first worker answers its tile with a single pixel too few, the second
+    // claims a reply of 4 GB, the third stops halfway through its reply and the
+    // last takes tiles and never answers. All are dropped and the tiles rendered
+    // locally.
+    uint32_t type;
+    std::vector<char> body;
+    int truncating = connect_to_coordinator(port);
+    ASSERT_GE(truncating, 0);
+    ASSERT_TRUE(recv_message(truncating, type, body));
+    ASSERT_TRUE(recv_message(truncating, type, body));
+    ASSERT_EQ(type, tile_message);
+    render_tile_request t;
+    std::memcpy(&t, body.data(), sizeof(t));
+    std::vector<char> reply(sizeof(int32_t) + (size_t(t.x1 - t.x0) * (t.y1 - t.y0) - 1) * sizeof(color));
+    std::memcpy(reply.data(), &t.id, sizeof(t.id));
+    EXPECT_TRUE(send_message(truncating, result_message, reply.data(), static_cast<uint32_t>(reply.size())));
+
+    int oversized = connect_to_coordinator(port);
+    ASSERT_GE(oversized, 0);
+    ASSERT_TRUE(recv_message(oversized, type, body));
+    ASSERT_TRUE(recv_message(oversized, type, body));
+    uint32_t huge[2] = {result_message, 0xFFFFFFFFu};
+    EXPECT_TRUE(send_all(oversized, huge, sizeof(huge)));
+
+    int stalling = connect_to_coordinator(port);
+    ASSERT_GE(stalling, 0);
+    ASSERT_TRUE(recv_message(stalling, type, body));
+    ASSERT_TRUE(recv_message(stalling, type, body));
+    std::memcpy(&t, body.data(), sizeof(t));
+    reply.assign(sizeof(int32_t) + size_t(t.x1 - t.x0) * (t.y1 - t.y0) * sizeof(color), 0);
+    std::memcpy(reply.data(), &t.id, sizeof(t.id));
+    uint32_t header[2] = {result_message, static_cast<uint32_t>(reply.size())};
+    EXPECT_TRUE(send_all(stalling, header, sizeof(header)));
+    EXPECT_TRUE(send_all(stalling, reply.data(), reply.size() / 2));
+
+    int silent = connect_to_coordinator(port);
+    ASSERT_GE(silent, 0);
+    ASSERT_TRUE(recv_message(silent, type, body));
+    ASSERT_TRUE(recv_message(silent, type, body));
+    EXPECT_EQ(type, tile_message);
+
+    expect_same_image(result.get(), expected);
+    close(truncating);
+    close(oversized);
+    close(stalling);
+    close(silent);
+}
+
+TEST(DistributedTest, WorkersReturnFeatures) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+    cam.denoise = true;
+    cam.initialize();
+    size_t pixels = size_t(cam.image_width) * cam.height();
+    std::vector<color> expected(pixels);
+    std::vector<pixel_features> expected_features(pixels);
+    cam.render_region(world, materials, 0, 0, cam.image_width, cam.height(), expected.data(), cam.image_width,
+                      expected_features.data());
+
+    render_coordinator coordinator(0);
+    ASSERT_TRUE(coordinator.listening());
+    int port = coordinator.port();
+    std::vector<pixel_features> features;
+    auto result = std::async(std::launch::async, [&] {
+        return coordinator.render(cam, world, materials, "scene", 8, &features);
+    });
+    auto loader = [&](const std::string&, camera& c, hittable_list& w, material_table& m) {
+        c = cam;
+        w = world;
+        m = materials;
+        return true;
+    };
+    EXPECT_EQ(run_render_worker("localhost", port, loader), 0);
+
+    expect_same_image(result.get(), expected);
+    ASSERT_EQ(features.size(), pixels);
+    for (size_t i = 0; i < pixels; i++) {
+        EXPECT_EQ(features[i].depth, expected_features[i].depth);
+        EXPECT_EQ(features[i].albedo.x(), expected_features[i].albedo.x());
+        EXPECT_EQ(features[i].normal.y(), expected_features[i].normal.y());
+    }
+}
+
+TEST(DistributedTest, CoordinatorRendersLocallyWithoutWorkers) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+    auto expected = render_single_process(cam, world, materials);
+
+    render_coordinator coordinator(0);
+    coordinator.fallback_seconds = 0;
+    expect_same_image(coordinator.render(cam, world, materials, "scene"), expected);
+}
+
+TEST(AnimationTest, AnimatedObjectFollowsKeyframes) {
+    auto ball = make_shared<sphere>(point3(0, 0, 0), 1.0, 0);
+    animated moving(ball, {{0, vec3(0, 0, 0), 0}, {1, vec3(4, 0, 0), 90}});
+
+    // Halfway: moved to x = 2 and turned 45 degrees, so the box widens by sqrt(2).
+    moving.set_time(0.5);
+    EXPECT_NEAR(moving.bounding_box().x.min, 2.0 - sqrt(2.0), 1e-6);
+    EXPECT_NEAR(moving.bounding_box().x.max, 2.0 + sqrt(2.0), 1e-6);
+
+    hit_record rec;
+    ray r(point3(2, 0, -5), vec3(0, 0, 1));
+    ASSERT_TRUE(moving.hit(r, interval(0.001, infinity), rec));
+    EXPECT_NEAR(rec.p.z(), -1.0, 1e-6);
+    EXPECT_NEAR(rec.normal.z(), -1.0, 1e-6);
+
+    // Poses hold outside the keyframe range.
+    moving.set_time(2.0);
+    EXPECT_NEAR(moving.bounding_box().x.min, 3.0, 1e-6);
+    EXPECT_NEAR(moving.bounding_box().x.max, 5.0, 1e-6);
+}
+
+TEST(AnimationTest, FrameFilenamesTakeOneNumber) {
+    animation anim;
+    EXPECT_EQ(anim.frame_filename(7), "frame_0007.ppm");
+    anim.output = "100%%/shot_%d.ppm";
+    EXPECT_EQ(anim.frame_filename(42), "100%/shot_42.ppm");
+    anim.output = "shot_%3d.ppm";
+    EXPECT_EQ(anim.frame_filename(5), "shot_  5.ppm");
+
+    // The pattern comes from the scene, so anything but one %d or %0Nd is refused.
+    for (const char* pattern : {"shot.ppm", "%d_%d.ppm", "%s.ppm", "%n%d.ppm", "%x.ppm", "shot_%", "%99999d.ppm"}) {
+        anim.output = pattern;
+        EXPECT_EQ(anim.frame_filename(1), "") << pattern;
+    }
+}
+
+TEST(AnimationTest, RefitTracksMovingObjects) {
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(-5, 0, 0), 1.0, 0));
+    auto moving = make_shared<animated>(make_shared<sphere>(point3(0, 0, 0), 1.0, 0),
+                                        std::vector<transform_keyframe>{{0, vec3(5, 0, 0), 0}, {1, vec3(5, 10, 0), 0}});
+    world.add(moving);
+
+    bvh_node bvh(world);
+    auto built_cost = bvh.sah_cost();
+    EXPECT_GE(built_cost, 1.0);
+
+    moving->set_time(1.0);
+    bvh.refit();
+    EXPECT_NEAR(bvh.bounding_box().y.max, 11.0, 1e-3);
+
+    hit_record rec;
+    EXPECT_TRUE(bvh.hit(ray(point3(5, 10, -5), vec3(0, 0, 1)), interval(0.001, infinity), rec));
+    EXPECT_FALSE(bvh.hit(ray(point3(5, 0, -5), vec3(0, 0, 1)), interval(0.001, infinity), rec));
+}
+
+TEST(BVHTest, ParallelBuildMatchesSerialBuild) {
+    seed_random(3);
+    hittable_list world;
+    for (size_t i = 0; i < 3 * bvh_node::parallel_span; i++) {
+        point3 center(random_double(-50, 50), random_double(-50, 50), random_double(-50, 50));
+        world.add(make_shared<sphere>(center, 0.2, int(i)));
+    }
+
+    omp_set_num_threads(1);
+    bvh_node serial(world);
+    omp_set_num_threads(4);
+    bvh_node parallel(world);
+    omp_set_num_threads(omp_get_num_procs());
+    EXPECT_EQ(serial.sah_cost(), parallel.sah_cost());
+
+    // Every sphere is found through the tree, with the closest one reported.
+    for (size_t i = 0; i < world.objects.size(); i += 97) {
+        auto target = world.objects[i]->bounding_box();
+        point3 center(0.5 * (target.x.min + target.x.max), 0.5 * (target.y.min + target.y.max), target.z.min - 10);
+        hit_record expected, rec;
+        ASSERT_TRUE(world.hit(ray(center, vec3(0, 0, 1)), interval(0.001, infinity), expected));
+        ASSERT_TRUE(parallel.hit(ray(center, vec3(0, 0, 1)), interval(0.001, infinity), rec));
+        EXPECT_EQ(rec.mat_id, expected.mat_id);
+        EXPECT_EQ(rec.t, expected.t);
+    }
+}
+
+TEST(BVHTest, StatisticsDumpAndRotations) {
+    // Spheres built in one order and then moved into another leave a refit tree
+    // that rotations can improve.
+    hittable_list world;
+    std::vector<shared_ptr<animated>> spheres;
+    for (int i = 0; i < 64; i++) {
+        auto moving = make_shared<animated>(make_shared<sphere>(point3(0, 0, 0), 0.4, i),
+            std::vector<transform_keyframe>{{0, vec3(i, 0, 0), 0}, {1, vec3((i * 37) % 64, (i * 11) % 8, 0), 0}});
+        spheres.push_back(moving);
+        world.add(moving);
+    }
+    bvh_node bvh(world);
+
+    auto stats = bvh.statistics();
+    EXPECT_EQ(stats.primitives, 64u);
+    EXPECT_EQ(stats.nodes, 63u);
+    EXPECT_EQ(stats.leaf_children[2], 32u);
+    EXPECT_EQ(stats.depth_histogram.size(), 7u);
+    EXPECT_EQ(stats.depth_histogram[6], 64u);
+    EXPECT_NEAR(stats.overlap, 0, 1e-12);
+
+    std::stringstream dump;
+    bvh.dump(dump);
+    std::string kind;
+    int nodes = 0, primitives = 0;
+    for (std::string line; std::getline(dump, line); ) {
+        std::istringstream entry(line);
+        entry >> kind;
+        (kind == "N" ? nodes : primitives)++;
+    }
+    EXPECT_EQ(nodes, 63);
+    EXPECT_EQ(primitives, 64);
+
+    for (auto& s : spheres)
+        s->set_time(1.0);
+    bvh.refit();
+    auto refit_cost = bvh.sah_cost();
+    EXPECT_GT(bvh.optimize(), 0u);
+    EXPECT_LT(bvh.sah_cost(), refit_cost);
+    EXPECT_EQ(bvh.statistics().primitives, 64u);
+
+    for (int i = 0; i < 64; i++) {
+        hit_record expected, rec;
+        ray r(point3(i, (i * 3) % 8, -5), vec3(0, 0, 1));
+        bool hit = world.hit(r, interval(0.001, infinity), expected);
+        ASSERT_EQ(bvh.hit(r, interval(0.001, infinity), rec), hit);
+        if (hit) {
+            EXPECT_EQ(rec.mat_id, expected.mat_id);
+        }
+    }
+}
+
+TEST(CuboidTest, MatchesSixQuadBox) {
+    point3 a(1, -2, 0.5), b(3, 1, 2);
+    auto quads = box(a, b, 4);
+    cuboid solid(a, b, 4);
+    EXPECT_NEAR(solid.bounding_box().x.min, quads->bounding_box().x.min, 1e-3);
+    EXPECT_NEAR(solid.bounding_box().y.max, quads->bounding_box().y.max, 1e-3);
+
+    // Rays from outside and from inside, some along the axes.
+    seed_random(5);
+    int hits = 0;
+    for (int i = 0; i < 2000; i++) {
+        point3 origin = (i % 3 == 0) ? point3(random_double(1.2, 2.8), random_double(-1.8, 0.8), random_double(0.7, 1.8))
+                                     : point3(2, -0.5, 1.25) + 6 * random_unit_vector();
+        vec3 direction = point3(random_double(1, 3), random_double(-2, 1), random_double(0.5, 2)) - origin;
+        if (i % 7 == 0)
+            direction = vec3(0, 0, (origin.z() < 1.25) ? 1 : -1);
+
+        hit_record expected, rec;
+        ray r(origin, direction);
+        bool hit = quads->hit(r, interval(0.001, infinity), expected);
+        ASSERT_EQ(solid.hit(r, interval(0.001, infinity), rec), hit);
+        if (!hit)
+            continue;
+        hits++;
+        EXPECT_NEAR(rec.t, expected.t, 1e-9);
+        EXPECT_NEAR((rec.normal - expected.normal).length(), 0, 1e-12);
+        EXPECT_EQ(rec.front_face, expected.front_face);
+        EXPECT_NEAR(rec.u, expected.u, 1e-9);
+        EXPECT_NEAR(rec.v, expected.v, 1e-9);
+        EXPECT_EQ(rec.mat_id, 4);
+    }
+    EXPECT_GT(hits, 1000);
+}
+
+TEST(CuboidTest, OrientedBoxRotatesAboutItsCenter) {
+    // A 4 x 2 x 2 box turned 90 degrees around Y spans 2 along X and 4 along Z.
+    cuboid turned(point3(-2, -1, -1), point3(2, 1, 1), 0, vec3(0, 90, 0));
+    EXPECT_NEAR(turned.bounding_box().x.max, 1, 1e-9);
+    EXPECT_NEAR(turned.bounding_box().z.max, 2, 1e-9);
+
+    hit_record rec;
+    ASSERT_TRUE(turned.hit(ray(point3(0, 0, -10), vec3(0, 0, 1)), interval(0.001, infinity), rec));
+    EXPECT_NEAR(rec.t, 8, 1e-9);
+    EXPECT_NEAR(rec.normal.z(), -1, 1e-9);
+    ASSERT_TRUE(turned.hit(ray(point3(-10, 0.5, 1.5), vec3(1, 0, 0)), interval(0.001, infinity), rec));
+    EXPECT_NEAR(rec.t, 9, 1e-9);
+    EXPECT_NEAR(rec.normal.x(), -1, 1e-9);
+    EXPECT_FALSE(turned.hit(ray(point3(-10, 0, 2.5), vec3(1, 0, 0)), interval(0.001, infinity), rec));
+}
+
+TEST(SpectrumTest, UpsampledColorsRoundTrip) {
+    // White upsamples to a flat spectrum, which converts back to white.
+    auto lambda = sampled_wavelengths::sample_uniform(0.3);
+    auto flat = lambda.upsample(color(1, 1, 1));
+    for (int i = 0; i < sampled_spectrum::count; i++)
+        EXPECT_NEAR(flat[i], 1.0, 1e-12);
+
+    const int steps = 2000;
+    color grey(0, 0, 0), red(0, 0, 0), hero_only(0, 0, 0);
+    for (int k = 0; k < steps; k++) {
+        auto w = sampled_wavelengths::sample_uniform((k + 0.5) / steps);
+        grey += w.to_rgb(w.upsample(color(0.5, 0.5, 0.5)));
+        red += w.to_rgb(w.upsample(color(0.65, 0.05, 0.05)));
+        w.terminate_secondary();
+        hero_only += w.to_rgb(w.upsample(color(0.5, 0.5, 0.5)));
+    }
+    for (int c = 0; c < 3; c++) {
+        EXPECT_NEAR(grey[c] / steps, 0.5, 1e-3);
+        EXPECT_NEAR(hero_only[c] / steps, 0.5, 1e-3);
+    }
+    EXPECT_NEAR(red.x() / steps, 0.65, 0.03);
+    EXPECT_NEAR(red.y() / steps, 0.05, 0.05);
+    EXPECT_NEAR(red.z() / steps, 0.05, 0.03);
+}
+
+TEST(SpectrumTest, DispersiveGlassBendsWavelengthsApart) {
+    dielectric crown(1.5168, 0.0042);
+    EXPECT_NEAR(crown.index(dielectric::d_line), 1.5168, 1e-12);
+    EXPECT_GT(crown.index(450), crown.index(650));
+
+    // N-BK7 from its catalogue coefficients.
+    double b[3] = {1.03961212, 0.231792344, 1.01046945};
+    double c[3] = {0.00600069867, 0.0200179144, 103.560653};
+    auto bk7 = dielectric::sellmeier(b, c);
+    EXPECT_NEAR(bk7.index(dielectric::d_line), 1.5168, 1e-4);
+    EXPECT_NEAR(bk7.index(486.13), 1.5224, 1e-4);
+
+    material_table materials;
+    int plain = materials.add(dielectric(1.5));
+    int dispersive = materials.add(crown);
+    EXPECT_FALSE(materials.dispersive(plain));
+    EXPECT_TRUE(materials.dispersive(dispersive));
+
+    ray r_in(point3(0, 1, 0), vec3(1, -1, 0));
+    hit_record rec;
+    rec.p = point3(1, 0, 0);
+    rec.normal = vec3(0, 1, 0);
+    rec.front_face = true;
+    color attenuation;
+    ray blue, red;
+    materials.scatter(dispersive, r_in, rec, 450, attenuation, blue);
+    materials.scatter(dispersive, r_in, rec, 650, attenuation, red);
+    EXPECT_LT(blue.direction().x(), red.direction().x());
+
+    materials.scatter(plain, r_in, rec, 450, attenuation, blue);
+    materials.scatter(plain, r_in, rec, 650, attenuation, red);
+    EXPECT_EQ(blue.direction().x(), red.direction().x());
+}
+
+TEST(SpectrumTest, SpectralRenderMatchesRGBUnderGreySky) {
+    // Under a grey sky every path ends in the same flat spectrum, so only the
+    // wavelengths and the glass add noise, even when the glass disperses.
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    int white = materials.add(lambertian(color(0.7, 0.7, 0.7)));
+    int glass = materials.add(dielectric(1.5, 0.0042));
+    world.add(make_shared<quad>(point3(-3, 0, -3), vec3(6, 0, 0), vec3(0, 0, 6), white));
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, glass));
+    set_test_view(cam);
+    cam.samples_per_pixel = 16;
+    cam.background = color(0.5, 0.5, 0.5);
+
+    auto rgb = render_single_process(cam, world, materials);
+    cam.spectral = true;
+    auto spectral = render_single_process(cam, world, materials);
+
+    color rgb_sum(0, 0, 0), spectral_sum(0, 0, 0);
+    for (size_t i = 0; i < rgb.size(); i++) {
+        rgb_sum += rgb[i];
+        spectral_sum += spectral[i];
+    }
+    for (int c = 0; c < 3; c++)
+        EXPECT_NEAR(spectral_sum[c] / rgb_sum[c], 1.0, 0.03);
+}
+
+TEST(KernelTest, SpecializedKernelsMatchTheGeneralOne) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    int white = materials.add(lambertian(color(0.7, 0.7, 0.7)));
+    world.add(make_shared<quad>(point3(-3, 0, -3), vec3(6, 0, 0), vec3(0, 0, 6), white));
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, white));
+    set_test_view(cam);
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 8;
+    cam.background = color(0.5, 0.5, 0.5);
+    cam.defocus_angle = 1;
+    cam.focus_dist = 5;
+    cam.initialize();
+    int width = cam.image_width, height = cam.height();
+    size_t pixels = size_t(width) * height;
+
+    // Without lights, render_region skips emission; the image is unchanged.
+    std::vector<color> general(pixels), specialized(pixels);
+    std::vector<pixel_features> general_features(pixels), specialized_features(pixels);
+    cam.render_kernel<true, true, false, true>(world, materials, 0, 0, width, height, general.data(), width, general_features.data());
+    cam.render_region(world, materials, 0, 0, width, height, specialized.data(), width, specialized_features.data());
+    for (size_t i = 0; i < pixels; i++) {
+        for (int c = 0; c < 3; c++) {
+            EXPECT_EQ(specialized[i][c], general[i][c]);
+            EXPECT_EQ(specialized_features[i].direct[c], general_features[i].direct[c]);
+        }
+    }
+
+    // Roulette from the first bounce trades noise for time, not brightness.
+    cam.roulette_depth = 1;
+    std::vector<color> roulette(pixels);
+    cam.render_region(world, materials, 0, 0, width, height, roulette.data(), width);
+    color general_sum(0, 0, 0), roulette_sum(0, 0, 0);
+    for (size_t i = 0; i < pixels; i++) {
+        general_sum += general[i];
+        roulette_sum += roulette[i];
+    }
+    for (int c = 0; c < 3; c++)
+        EXPECT_NEAR(roulette_sum[c] / general_sum[c], 1.0, 0.01);
+}
+
+TEST(KernelTest, SortedRaysFollowTheSamePaths) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    int white = materials.add(lambertian(color(0.7, 0.7, 0.7)));
+    int steel = materials.add(metal(color(0.8, 0.8, 0.9), 0.2));
+    int glass = materials.add(dielectric(1.5));
+    int lamp = materials.add(diffuse_light(color(4, 4, 4)));
+    int haze = materials.add(isotropic(color(0.9, 0.9, 0.9)));
+    world.add(make_shared<quad>(point3(-3, 0, -3), vec3(6, 0, 0), vec3(0, 0, 6), white));
+    world.add(make_shared<quad>(point3(-1, 3, -1), vec3(2, 0, 0), vec3(0, 0, 2), lamp));
+    world.add(make_shared<sphere>(point3(-1, 1, 0), 1.0, steel));
+    world.add(make_shared<sphere>(point3(1, 1, 0), 1.0, glass));
+    world.add(make_shared<constant_medium>(make_shared<sphere>(point3(0, 0.5, 1.5), 0.5, 0), 2.0, haze));
+    set_test_view(cam);
+    cam.samples_per_pixel = 32;     // Two waves of paths
+    cam.max_depth = 8;
+    cam.background = color(0.2, 0.2, 0.3);
+    cam.defocus_angle = 1;
+    cam.focus_dist = 5;
+
+    for (int roulette : {0, 2}) {
+        cam.roulette_depth = roulette;
+        cam.sort_rays = false;
+        cam.initialize();
+        int width = cam.image_width, height = cam.height();
+        std::vector<color> recursive(size_t(width) * height), sorted(recursive.size());
+        cam.render_region(world, materials, 0, 0, width, height, recursive.data(), width);
+        cam.sort_rays = true;
+        cam.render_region(world, materials, 0, 0, width, height, sorted.data(), width);
+        // Only the order light is added up along a path differs.
+        for (size_t i = 0; i < recursive.size(); i++)
+            for (int c = 0; c < 3; c++)
+                EXPECT_NEAR(sorted[i][c], recursive[i][c], 1e-9 * (1 + recursive[i][c]));
+    }
+}
+
+TEST(MediumTest, FreeFlightFollowsBeerLambert) {
+    // A slab two units thick; half a scattering event per unit leaves exp(-1) unscattered.
+    auto slab = make_shared<cuboid>(point3(-10, -10, 0), point3(10, 10, 2), 0);
+    constant_medium fog(slab, 0.5, 0);
+    constant_medium tracked(slab, 2.0, 0, make_shared<density_grid>(2, 2, 2, std::vector<double>(8, 0.25)));
+    constant_medium empty(slab, 2.0, 0, make_shared<density_grid>(2, 2, 2, std::vector<double>(8, 0.0)));
+
+    seed_random(7);
+    const int rays = 20000;
+    int fog_passed = 0, tracked_passed = 0;
+    double depth_sum = 0;
+    hit_record rec;
+    for (int i = 0; i < rays; i++) {
+        ray r(point3(0, 0, -1), vec3(0, 0, 2));
+        if (fog.hit(r, interval(0.001, infinity), rec)) {
+            EXPECT_GE(rec.p.z(), 0);
+            EXPECT_LE(rec.p.z(), 2);
+            depth_sum += rec.p.z();
+        } else {
+            fog_passed++;
+        }
+        if (!tracked.hit(r, interval(0.001, infinity), rec))
+            tracked_passed++;
+        EXPECT_FALSE(empty.hit(r, interval(0.001, infinity), rec));
+    }
+    EXPECT_NEAR(double(fog_passed) / rays, exp(-1.0), 0.01);
+    EXPECT_NEAR(double(tracked_passed) / rays, exp(-1.0), 0.01);
+
+    // Mean depth of the scattering events, of an exponential truncated at 2.
+    auto expected_depth = 2 - 2 * exp(-1.0) / (1 - exp(-1.0));
+    EXPECT_NEAR(depth_sum / (rays - fog_passed), expected_depth, 0.02);
+
+    // A ray ending inside the medium can only scatter before its end.
+    for (int i = 0; i < 100; i++) {
+        if (fog.hit(ray(point3(0, 0, -1), vec3(0, 0, 1)), interval(0.001, 1.5), rec)) {
+            EXPECT_LT(rec.t, 1.5);
+        }
+    }
+}
+
+TEST(MediumTest, IsotropicScattersEveryWay) {
+    material_table materials;
+    int id = materials.add(isotropic(color(0.8, 0.8, 0.8)));
+
+    hit_record rec;
+    rec.p = point3(0, 0, 0);
+    rec.normal = vec3(1, 0, 0);
+    color f;
+    double pdf;
+    EXPECT_TRUE(materials.evaluate(id, rec, vec3(-1, 0, 0), f, pdf));
+    EXPECT_NEAR(pdf, 1 / (4 * pi), 1e-12);
+    EXPECT_NEAR(f.x(), 0.8 / (4 * pi), 1e-12);
+
+    seed_random(3);
+    vec3 mean(0, 0, 0);
+    color attenuation;
+    ray scattered;
+    for (int i = 0; i < 10000; i++) {
+        EXPECT_TRUE(materials.scatter(id, ray(point3(-1, 0, 0), vec3(1, 0, 0)), rec, attenuation, scattered));
+        mean += scattered.direction();
+    }
+    EXPECT_NEAR(mean.length() / 10000, 0, 0.03);
+}
+
+TEST(MotionBlurTest, MovingPrimitivesFollowRayTime) {
+    sphere ball(point3(0, 0, 0), point3(4, 0, 0), 1.0, 0);
+    EXPECT_NEAR(ball.bounding_box().x.min, -1.0, 1e-9);
+    EXPECT_NEAR(ball.bounding_box().x.max, 5.0, 1e-9);
+    EXPECT_NEAR(ball.bounding_box_at(0.5).x.min, 1.0, 1e-9);
+
+    hit_record rec;
+    EXPECT_FALSE(ball.hit(ray(point3(4, 0, -5), vec3(0, 0, 1), 0.0), interval(0.001, infinity), rec));
+    ASSERT_TRUE(ball.hit(ray(point3(4, 0, -5), vec3(0, 0, 1), 1.0), interval(0.001, infinity), rec));
+    EXPECT_NEAR(rec.normal.z(), -1.0, 1e-9);
+
+    quad panel(point3(0, 0, 0), point3(0, 2, 0), vec3(1, 0, 0), vec3(0, 1, 0), 0);
+    EXPECT_FALSE(panel.hit(ray(point3(0.5, 2.5, -1), vec3(0, 0, 1), 0.0), interval(0.001, infinity), rec));
+    ASSERT_TRUE(panel.hit(ray(point3(0.5, 2.5, -1), vec3(0, 0, 1), 1.0), interval(0.001, infinity), rec));
+    EXPECT_NEAR(rec.v, 0.5, 1e-9);
+}
+
+TEST(MotionBlurTest, BVHInterpolatesNodeBounds) {
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0, 0, 0), point3(10, 0, 0), 1.0, 0));
+    world.add(make_shared<sphere>(point3(0, 3, 0), point3(10, 3, 0), 1.0, 0));
+    world.add(make_shared<sphere>(point3(0, -3, 0), 1.0, 0));
+
+    bvh_node bvh(world, 0.0, 1.0);
+    EXPECT_NEAR(bvh.bounding_box().x.max, 11.0, 1e-3);
+    EXPECT_NEAR(bvh.bounding_box_at(0.0).x.max, 1.0, 1e-3);
+
+    // Every ray time finds the moving spheres where they are at that time.
+    hit_record rec;
+    for (double time : {0.0, 0.25, 0.5, 1.0}) {
+        EXPECT_TRUE(bvh.hit(ray(point3(10 * time, 3, -5), vec3(0, 0, 1), time), interval(0.001, infinity), rec));
+        EXPECT_FALSE(bvh.hit(ray(point3(10 * time + 5, 0, -5), vec3(0, 0, 1), time), interval(0.001, infinity), rec));
+    }
+
+    // A static tree built at time 1 holds the spheres at their end positions.
+    bvh_node late(world, 1.0, 1.0);
+    EXPECT_NEAR(late.bounding_box().x.max, 11.0, 1e-3);
+    EXPECT_TRUE(late.hit(ray(point3(10, 0, -5), vec3(0, 0, 1), 1.0), interval(0.001, infinity), rec));
+}
+
+TEST(MotionBlurTest, AnimatedBoundsCoverShutterInterval) {
+    auto ball = make_shared<sphere>(point3(1, 0, 0), 0.5, 0);
+    animated moving(ball, {{0, vec3(0, 0, 0), 0}, {1, vec3(0, 0, 0), 180}});
+    moving.set_time(0.0, 1.0);
+
+    // The sphere swings from x = 1 round to x = -1 through z = -1.
+    hit_record rec;
+    EXPECT_TRUE(moving.hit(ray(point3(0, 0, -5), vec3(0, 0, 1), 0.5), interval(0.001, infinity), rec));
+    EXPECT_LE(moving.bounding_box().z.min, -1.5);
+    EXPECT_LE(moving.bounding_box().x.min, -1.5);
+}
+
+TEST(DenoiserTest, SmoothsNoiseButKeepsGeometricEdges) {
+    const int width = 32, height = 32;
+    std::vector<color> image(width * height);
+    std::vector<pixel_features> features(width * height);
+    seed_random(7);
+
+    // Left half faces +Z and is lit at 0.5, right half faces +X and is lit at 0.1.
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            bool left = x < width / 2;
+            auto& f = features[y * width + x];
+            f.albedo = color(1, 1, 1);
+            f.normal = left ? vec3(0, 0, 1) : vec3(1, 0, 0);
+            f.depth = 5;
+            f.variance = 0.01;
+            auto value = (left ? 0.5 : 0.1) + random_double(-0.2, 0.2);
+            image[y * width + x] = color(value, value, value);
+        }
+    }
+
+    auto filtered = denoiser().apply(image, features, width, height, 1);
+
+    double noisy_error = 0, filtered_error = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            auto expected = (x < width / 2) ? 0.5 : 0.1;
+            noisy_error += fabs(image[y * width + x].x() - expected);
+            filtered_error += fabs(filtered[y * width + x].x() - expected);
+        }
+    }
+    EXPECT_LT(filtered_error, 0.25 * noisy_error);
+
+    // Pixels right next to the edge keep their own side's level.
+    EXPECT_NEAR(filtered[10 * width + width / 2 - 1].x(), 0.5, 0.1);
+    EXPECT_NEAR(filtered[10 * width + width / 2].x(), 0.1, 0.1);
+}
+
+TEST(DenoiserTest, RenderRegionProducesFeatures) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+    cam.initialize();
+
+    int width = cam.image_width, height = cam.height();
+    std::vector<color> image(width * height);
+    std::vector<pixel_features> features(width * height);
+    cam.render_region(world, materials, 0, 0, width, height, image.data(), width, features.data());
+
+    int hits = 0;
+    for (const auto& f : features) {
+        if (f.normal.length_squared() > 0) {
+            hits++;
+            EXPECT_NEAR(f.normal.length(), 1.0, 1e-9);
+            EXPECT_GT(f.depth, 0);
+        }
+        EXPECT_GE(f.variance, 0);
+    }
+    EXPECT_GT(hits, 0);
+
+    // Asking for features must not change the rendered samples.
+    std::vector<color> plain(width * height);
+    cam.render_region(world, materials, 0, 0, width, height, plain.data(), width);
+    expect_same_image(image, plain);
+}
+
+TEST(FramebufferTest, StoresFeatureChannelsAsPlanes) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+    cam.initialize();
+
+    int width = cam.image_width, height = cam.height();
+    std::vector<color> image(width * height);
+    std::vector<pixel_features> features(width * height);
+    cam.render_region(world, materials, 0, 0, width, height, image.data(), width, features.data());
+
+    framebuffer fb(width, height);
+    fb.store(features);
+    EXPECT_EQ(fb.channel_count(), static_cast<int>(feature_channels().size()));
+
+    const float* red = fb.channel(fb.find("R"));
+    const float* direct = fb.channel(fb.find("direct.R"));
+    const float* indirect = fb.channel(fb.find("indirect.R"));
+    const float* samples = fb.channel(fb.find("sample_count"));
+    const float* ids = fb.channel(fb.find("material_id"));
+    for (int i = 0; i < width * height; i++) {
+        EXPECT_NEAR(red[i], image[i].x() / cam.samples_per_pixel, 1e-5);
+        EXPECT_NEAR(direct[i] + indirect[i], red[i], 1e-4);
+        EXPECT_EQ(samples[i], cam.samples_per_pixel);
+        EXPECT_GE(ids[i], -1);
+        EXPECT_LT(ids[i], static_cast<float>(materials.size()));
+    }
+}
+
+TEST(FramebufferTest, WritesUncompressedExr) {
+    framebuffer fb(3, 2);
+    fb.channel(fb.add_channel("Z"))[4] = 2.5f;
+    fb.channel(fb.add_channel("A"))[0] = 1.0f;
+
+    std::stringstream out;
+    fb.write_exr(out);
+    std::string file = out.str();
+
+    auto read_int = [&](size_t offset) {
+        int32_t value;
+        std::memcpy(&value, &file[offset], sizeof(value));
+        return value;
+    };
+    EXPECT_EQ(read_int(0), 20000630);
+    EXPECT_EQ(read_int(4), 2);
+
+    // Channels are listed alphabetically, so each scanline holds A then Z.
+    auto channels = file.find("channels");
+    ASSERT_NE(channels, std::string::npos);
+    EXPECT_LT(file.find("A", channels + 20), file.find("Z", channels + 20));
+
+    size_t line_size = 2 * sizeof(int32_t) + 2 * 3 * sizeof(float);
+    size_t second_line = file.size() - line_size;
+    uint64_t offset;
+    std::memcpy(&offset, &file[file.size() - 2 * line_size - 2 * sizeof(uint64_t) + sizeof(uint64_t)], sizeof(offset));
+    EXPECT_EQ(offset, second_line);
+    EXPECT_EQ(read_int(second_line), 1);
+
+    float z;
+    std::memcpy(&z, &file[second_line + 2 * sizeof(int32_t) + 3 * sizeof(float) + sizeof(float)], sizeof(z));
+    EXPECT_EQ(z, 2.5f);
+}
+
+TEST(OutputTest, DefaultSettingsMatchWriteColor) {
+    seed_random(3);
+    int width = 37, height = 70;
+    std::vector<color> image(size_t(width) * height);
+    for (auto& pixel : image)
+        pixel = color(random_double(-1, 12), random_double(0, 9), random_double(0, 8.5));
+    image[0] = color(0, 8, 7.992);
+
+    std::ostringstream expected, mapped;
+    for (const auto& pixel : image)
+        write_color(expected, pixel, 8);
+    tone_mapper(output_settings(), 1.0 / 8).write_pixels(image, width, height, mapped);
+    EXPECT_EQ(mapped.str(), expected.str());
+}
+
+TEST(OutputTest, CurvesEncodingAndDither) {
+    output_settings settings;
+    std::vector<color> ramp(256);
+    for (int i = 0; i < 256; i++)
+        ramp[i] = color(i / 16.0, i / 16.0, i / 16.0);
+
+    // Every curve keeps the ramp in range and in order; the filmic ones still
+    // separate values far past 1.
+    for (auto curve : {tone_curve::clip, tone_curve::reinhard, tone_curve::aces}) {
+        settings.curve = curve;
+        std::vector<uint16_t> values(3 * ramp.size());
+        tone_mapper(settings, 1).map_row(ramp.data(), 256, 0, 0, values.data());
+        for (size_t k = 3; k < values.size(); k++)
+            EXPECT_GE(values[k], values[k - 3]);
+        EXPECT_EQ(values[0], 0);
+        EXPECT_LE(values.back(), 255);
+        if (curve != tone_curve::clip) {
+            EXPECT_LT(values[3 * 64], values[3 * 255]);
+        }
+    }
+
+    // The sRGB table follows the curve to well under a level, and an exposure
+    // stop doubles the linear value.
+    settings = output_settings();
+    settings.srgb = true;
+    settings.exposure = 1;
+    settings.bits = 16;
+    std::vector<color> greys(100);
+    for (int i = 0; i < 100; i++)
+        greys[i] = color(i / 200.0, i / 200.0, i / 200.0);
+    std::vector<uint16_t> encoded(300);
+    tone_mapper(settings, 1).map_row(greys.data(), 100, 0, 0, encoded.data());
+    for (int i = 0; i < 100; i++)
+        EXPECT_NEAR(encoded[3 * i], 65536 * tone_mapper::srgb_encode(i / 100.0), 2.0);
+
+    // Dithering a flat field between two levels keeps its mean.
+    settings = output_settings();
+    settings.dither = true;
+    std::vector<color> flat(64, color(0.3 / 255 + 100.0 / 256, 0, 0));
+    double sum = 0;
+    for (int y = 0; y < 4; y++) {
+        std::vector<uint8_t> row(3 * flat.size());
+        tone_mapper(settings, 1).map_row(flat.data(), 64, 0, y, row.data());
+        for (size_t i = 0; i < flat.size(); i++)
+            sum += row[3 * i];
+    }
+    EXPECT_NEAR(sum / (4 * flat.size()), 100.3, 0.1);
+
+    // 16-bit P6 stores big-endian words.
+    settings = output_settings();
+    settings.binary = true;
+    settings.bits = 16;
+    std::vector<color> pixel{color(1, 0.5, 0)};
+    std::ostringstream out;
+    tone_mapper(settings, 1).write_pixels(pixel, 1, 1, out);
+    EXPECT_EQ(out.str(), std::string("\xff\xff\x80\x00\x00\x00", 6));
+}
+
+TEST(ServerTest, ThreadPoolRunsEveryTask) {
+    std::atomic<int> done(0);
+    std::vector<std::future<int>> results;
+    {
+        thread_pool pool(3);
+        EXPECT_EQ(pool.size(), 3);
+        for (int i = 0; i < 50; i++)
+            results.push_back(pool.submit([i, &done] { done++; return i * i; }));
+        EXPECT_EQ(results[7].get(), 49);
+    }
+    EXPECT_EQ(done.load(), 50);
+}
+
+TEST(ServerTest, WorkStealingPoolRunsNestedTasks) {
+    std::atomic<int> leaves(0);
+    std::function<void(int)> split;
+    {
+        work_stealing_pool pool(4);
+        EXPECT_EQ(pool.size(), 4);
+        split = [&](int depth) {
+            if (depth == 0) {
+                leaves++;
+                return;
+            }
+            pool.post([&split, depth] { split(depth - 1); });
+            split(depth - 1);
+        };
+        for (int i = 0; i < 4; i++)
+            pool.post([&split] { split(8); });
+    }
+    EXPECT_EQ(leaves.load(), 4 * 256);
+}
+
+TEST(ServerTest, CacheEvictsLeastRecentlyUsed) {
+    lru_cache<std::string, int> cache(2);
+    int builds = 0;
+    auto make = [&](int value) {
+        return [&builds, value] { builds++; return std::make_shared<const int>(value); };
+    };
+
+    bool hit;
+    EXPECT_EQ(*cache.get("a", make(1), &hit), 1);
+    EXPECT_FALSE(hit);
+    cache.get("b", make(2));
+    EXPECT_EQ(*cache.get("a", make(10), &hit), 1);
+    EXPECT_TRUE(hit);
+
+    // "b" is now the least recently used and makes way for "c".
+    cache.get("c", make(3));
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_EQ(*cache.get("b", make(20), &hit), 20);
+    EXPECT_FALSE(hit);
+    EXPECT_EQ(builds, 4);
+
+    EXPECT_THROW(cache.get("d", []() -> std::shared_ptr<const int> { throw std::runtime_error("bad scene"); }),
+                 std::runtime_error);
+    EXPECT_EQ(*cache.get("d", make(4), &hit), 4);
+    EXPECT_FALSE(hit);
+}
+
+TEST(ServerTest, ConcurrentMissesBuildOnce) {
+    lru_cache<int, int> cache(4);
+    std::atomic<int> builds(0);
+    thread_pool pool(4);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 8; i++) {
+        results.push_back(pool.submit([&] {
+            return *cache.get(1, [&] {
+                builds++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                return std::make_shared<const int>(42);
+            });
+        }));
+    }
+    for (auto& result : results)
+        EXPECT_EQ(result.get(), 42);
+    EXPECT_EQ(builds.load(), 1);
+}
+
+TEST(CropTest, TileBandsPartitionTheFrame) {
+    camera cam;
+    cam.image_width = 100;
+    cam.aspect_ratio = 1.0;
+
+    int next_row = 0;
+    for (int i = 0; i < 3; i++) {
+        cam.tile_index = i;
+        cam.tile_count = 3;
+        cam.initialize();
+        EXPECT_EQ(cam.window_x(), 0);
+        EXPECT_EQ(cam.window_width(), 100);
+        EXPECT_EQ(cam.window_y(), next_row);
+        EXPECT_EQ(cam.window_y() % camera::tile_rows, 0);
+        next_row = cam.window_y() + cam.window_height();
+    }
+    EXPECT_EQ(next_row, 100);
+
+    cam.tile_count = 1;
+    cam.crop_x0 = 10;
+    cam.crop_y0 = 20;
+    cam.crop_x1 = 300;
+    cam.initialize();
+    EXPECT_EQ(cam.window_x(), 10);
+    EXPECT_EQ(cam.window_y(), 20);
+    EXPECT_EQ(cam.window_width(), 90);
+    EXPECT_EQ(cam.window_height(), 80);
+    EXPECT_FALSE(cam.full_frame());
+}
+
+TEST(CropTest, PartialImagesStitchIntoFullRender) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+    cam.output.dither = true;
+    cam.output.bits = 16;
+    cam.initialize();
+    int width = cam.image_width, height = cam.height();
+
+    std::vector<color> full(size_t(width) * height);
+    cam.render_region(world, materials, 0, 0, width, height, full.data(), width);
+    std::stringstream expected;
+    cam.write_image(full, expected);
+
+    // Crops split at an odd column and an odd row render, and dither, the same
+    // pixels as the full frame.
+    std::vector<std::string> parts;
+    struct crop { int x0, y0, x1, y1; };
+    for (auto c : {crop{0, 0, 13, height}, crop{13, 0, width, 7}, crop{13, 7, width, height}}) {
+        cam.crop_x0 = c.x0;
+        cam.crop_y0 = c.y0;
+        cam.crop_x1 = c.x1;
+        cam.crop_y1 = c.y1;
+        cam.initialize();
+        std::vector<color> image(size_t(cam.window_width()) * cam.window_height());
+        cam.render_region(world, materials, c.x0, c.y0, c.x1, c.y1, image.data(), cam.window_width());
+
+        std::stringstream out;
+        cam.write_image(image, out);
+        partial_image part;
+        ASSERT_TRUE(read_partial_image(out, part));
+        EXPECT_EQ(part.x, c.x0);
+        EXPECT_EQ(part.y, c.y0);
+        EXPECT_EQ(part.full_width, width);
+        EXPECT_EQ(part.max_value, 65535);
+
+        parts.push_back(testing::TempDir() + "part" + std::to_string(c.x0) + "_" + std::to_string(c.y0) + ".ppm");
+        std::ofstream(parts.back()) << out.str();
+    }
+
+    auto stitched = testing::TempDir() + "stitched.ppm";
+    ASSERT_EQ(stitch_images(stitched, parts), 0);
+    std::ifstream in(stitched);
+    std::stringstream result;
+    result << in.rdbuf();
+    EXPECT_EQ(result.str(), expected.str());
+
+    EXPECT_NE(stitch_images(stitched, {parts[0]}), 0);
+    EXPECT_NE(stitch_images(stitched, {}), 0);
+
+    // A part placed partly outside the frame is refused.
+    auto outside = testing::TempDir() + "outside.ppm";
+    std::ofstream(outside) << "P3\n# offset -1 0 full " << width << ' ' << height << "\n1 1\n65535\n0 0 0\n";
+    EXPECT_NE(stitch_images(stitched, {outside, parts[0], parts[1], parts[2]}), 0);
+
+    // Parts of different bit depths do not mix.
+    cam.output.bits = 8;
+    cam.initialize();
+    std::vector<color> image(size_t(cam.window_width()) * cam.window_height());
+    std::stringstream eight_bit;
+    cam.write_image(image, eight_bit);
+    std::ofstream(parts.back()) << eight_bit.str();
+    EXPECT_NE(stitch_images(stitched, parts), 0);
+}
+
+TEST(NumaTest, NodePlacementRendersTheSameImage) {
+    auto topology = numa_topology::simulated(3);
+    ASSERT_EQ(topology.nodes(), 3);
+    for (const auto& node_cpus : topology.cpus)
+        EXPECT_FALSE(node_cpus.empty());
+    EXPECT_EQ(topology.node_of(0, 16), 0);
+    EXPECT_EQ(topology.node_of(15, 16), 2);
+
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+    cam.threads = 4;
+    bvh_node bvh(world);
+
+    // The replica is a separate tree of the same shape.
+    auto replica = std::dynamic_pointer_cast<bvh_node>(bvh.replicate());
+    ASSERT_TRUE(replica);
+    EXPECT_EQ(replica->sah_cost(), bvh.sah_cost());
+    std::stringstream original_dump, replica_dump;
+    bvh.dump(original_dump);
+    replica->dump(replica_dump);
+    EXPECT_EQ(replica_dump.str(), original_dump.str());
+
+    std::stringstream expected;
+    cam.render(bvh, materials, expected);
+    for (bool replicate : {false, true}) {
+        cam.numa = make_shared<numa_topology>(topology);
+        cam.numa_replicate = replicate;
+        std::stringstream out;
+        cam.render(bvh, materials, out);
+        EXPECT_EQ(out.str(), expected.str());
+    }
+}
+
+TEST(RenderJobTest, TileEventsCoverTheImageRenderMakes) {
+    camera cam;
+    auto world = make_shared<hittable_list>();
+    auto materials = make_shared<material_table>();
+    build_test_scene(cam, *world, *materials);
+    cam.threads = 2;
+    std::stringstream expected;
+    cam.render(*world, *materials, expected);
+
+    work_stealing_pool pool(3);
+    std::vector<int> covered;
+    int events = 0, last_progress = 0;
+    render_callbacks callbacks;
+    callbacks.on_tile = [&](const tile_event& event) {
+        covered.resize(size_t(cam.image_width) * cam.height());
+        for (int y = event.rect.y0; y < event.rect.y1; y++)
+            for (int x = event.rect.x0; x < event.rect.x1; x++)
+                covered[size_t(y) * cam.image_width + x]++;
+        events++;
+    };
+    callbacks.on_progress = [&](int completed, int total) {
+        EXPECT_EQ(completed, last_progress + 1);
+        EXPECT_EQ(total, camera::render_tile_count);
+        last_progress = completed;
+    };
+    auto job = render_job::start(pool, cam, world, materials, callbacks);
+    ASSERT_EQ(job->wait(), render_job::finished);
+    EXPECT_EQ(last_progress, camera::render_tile_count);
+    EXPECT_GT(events, 0);
+    for (auto count : covered)
+        EXPECT_EQ(count, 1);
+
+    std::stringstream out;
+    job->write(out);
+    EXPECT_EQ(out.str(), expected.str());
+}
+
+TEST(RenderJobTest, CancelledJobStopsWhileAnotherFinishes) {
+    camera cam;
+    auto world = make_shared<hittable_list>();
+    auto materials = make_shared<material_table>();
+    build_test_scene(cam, *world, *materials);
+
+    work_stealing_pool pool(2);
+    auto finishing = render_job::start(pool, cam, world, materials);
+    shared_ptr<render_job> cancelled;
+    std::mutex started;
+    render_callbacks callbacks;
+    callbacks.on_tile = [&](const tile_event&) {
+        std::lock_guard<std::mutex> lock(started);
+        cancelled->cancel();
+    };
+    {
+        std::lock_guard<std::mutex> lock(started);
+        cancelled = render_job::start(pool, cam, world, materials, callbacks);
+    }
+
+    EXPECT_EQ(cancelled->wait(), render_job::cancelled);
+    EXPECT_EQ(cancelled->tiles_done(), camera::render_tile_count);
+    EXPECT_EQ(finishing->wait(), render_job::finished);
+    EXPECT_EQ(finishing->progress(), 1.0);
+}
+
+TEST(PreviewTest, CoarsePassFillsBlocks) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+
+    progressive_render preview(cam, 8);
+    preview.step(world, materials);
+    EXPECT_EQ(preview.samples(), 0);
+
+    const auto& frame = preview.frame();
+    int width = cam.image_width;
+    for (size_t i = 0; i < frame.size(); i++) {
+        int x = int(i % width), y = int(i / width);
+        auto corner = frame[size_t(y / 8 * 8) * width + x / 8 * 8];
+        EXPECT_EQ(frame[i].x(), corner.x());
+        EXPECT_EQ(frame[i].y(), corner.y());
+        EXPECT_EQ(frame[i].z(), corner.z());
+    }
+}
+
+TEST(PreviewTest, RefinementConvergesToFullRender) {
+    camera cam;
+    hittable_list world;
+    material_table materials;
+    build_test_scene(cam, world, materials);
+    cam.samples_per_pixel = 7;
+
+    // Small steps, so passes are split over many calls.
+    progressive_render preview(cam, 4, 300);
+    int steps = 0, last_samples = 0;
+    while (!preview.done()) {
+        preview.step(world, materials);
+        EXPECT_GE(preview.samples(), last_samples);
+        last_samples = preview.samples();
+        steps++;
+    }
+    EXPECT_GT(steps, 10);
+    EXPECT_EQ(preview.samples(), 7);
+    expect_same_image(preview.image(), render_single_process(cam, world, materials));
+}
+
+TEST(PrimitiveFileTest, StreamsChunksAcrossLineBreaks) {
+    auto path = testing::TempDir() + "primitives.txt";
+    {
+        std::ofstream out(path);
+        out << "# generated\n\n";
+        for (int i = 0; i < 50; i++)
+            out << "sphere " << i << " 0 -5.5 0.25" << (i % 2 ? " red" : "") << '\n';
+        out << "quad 0 0 0  1 0 0  0 1 0 # trailing comment\n";
+        out << "sphere 1 2\n";
+        out << "sphere 0 0 0 1 missing\n";
+        out << "cone 0 0 0 1\n";
+        out << "quad -1 -1 2 2 0 0 0 2 0 red";      // No final line break
+    }
+    std::map<std::string, int> materials = {{"white", 3}, {"red", 7}};
+
+    // A chunk smaller than a line forces lines to be carried between chunks.
+    for (size_t chunk : {size_t(7), size_t(1) << 20}) {
+        hittable_list world;
+        auto stats = load_primitives(path, 3, materials, world, chunk);
+        EXPECT_EQ(stats.spheres, 50u);
+        EXPECT_EQ(stats.quads, 2u);
+        EXPECT_EQ(stats.skipped, 3u);
+        ASSERT_EQ(world.objects.size(), 52u);
+
+        hit_record rec;
+        ASSERT_TRUE(world.hit(ray(point3(7, 0, 0), vec3(0, 0, -1)), interval(0.001, infinity), rec));
+        EXPECT_NEAR(rec.t, 5.25, 1e-9);
+        EXPECT_EQ(rec.mat_id, 7);
+        ASSERT_TRUE(world.hit(ray(point3(8, 0, 0), vec3(0, 0, -1)), interval(0.001, infinity), rec));
+        EXPECT_EQ(rec.mat_id, 3);
+        ASSERT_TRUE(world.hit(ray(point3(0.5, 0.5, 5), vec3(0, 0, -1)), interval(0.001, infinity), rec));
+        EXPECT_NEAR(rec.t, 3, 1e-9);
+        EXPECT_EQ(rec.mat_id, 7);
+    }
+}
+
+TEST(PrimitiveFileTest, PagedGeometryMatchesLoadedGeometry) {
+    auto path = testing::TempDir() + "paged_primitives.txt";
+    seed_random(11);
+    {
+        std::ofstream out(path);
+        for (int i = 0; i < 2000; i++)
+            out << "sphere " << random_double(-20, 20) << ' ' << random_double(-20, 20) << ' ' << random_double(-20, 20)
+                << ' ' << random_double(0.1, 0.6) << (i % 3 ? "" : " red") << '\n';
+        for (int i = 0; i < 200; i++)
+            out << "quad " << random_double(-20, 20) << ' ' << random_double(-20, 20) << ' ' << random_double(-20, 20)
+                << " 1 0 0 0 1 0.5\n";
+        out << "sphere 1 2\n";
+    }
+    std::map<std::string, int> materials = {{"white", 3}, {"red", 7}};
+
+    hittable_list loaded;
+    load_primitives(path, 3, materials, loaded);
+    bvh_node loaded_bvh(loaded);
+
+    // A budget of a few pages forces pages out and back in while tracing.
+    geometry_cache cache(0);
+    paged_geometry_stats stats;
+    auto paged = paged_geometry::build(path, testing::TempDir() + "paged_primitives.pages", 3, materials, 64, &stats, cache);
+    ASSERT_TRUE(paged);
+    EXPECT_EQ(stats.spheres, 2000u);
+    EXPECT_EQ(stats.quads, 200u);
+    EXPECT_EQ(stats.skipped, 1u);
+    EXPECT_GE(stats.pages, 35u);
+    hittable_list proxies;
+    paged->add_pages(proxies);
+    ASSERT_EQ(proxies.objects.size(), stats.pages);
+    cache.set_budget(4 * paged->page(0).bytes);
+    bvh_node paged_bvh(proxies);
+
+    // Pages fill cells of their own: their bounds barely overlap, where pages in
+    // file order would each span the scene.
+    double page_volume = 0;
+    for (size_t p = 0; p < paged->page_count(); p++) {
+        auto box = paged->page_bounds(p);
+        page_volume += box.x.size() * box.y.size() * box.z.size();
+    }
+    EXPECT_LT(page_volume, 3 * 41 * 41 * 41);
+
+    int hits = 0;
+    for (int i = 0; i < 1000; i++) {
+        ray r(point3(random_double(-30, 30), random_double(-30, 30), -40), vec3(random_double(-0.3, 0.3), random_double(-0.3, 0.3), 1));
+        hit_record expected, actual;
+        bool hit = loaded_bvh.hit(r, interval(0.001, infinity), expected);
+        ASSERT_EQ(paged_bvh.hit(r, interval(0.001, infinity), actual), hit);
+        if (hit) {
+            hits++;
+            EXPECT_EQ(actual.t, expected.t);
+            EXPECT_EQ(actual.mat_id, expected.mat_id);
+        }
+    }
+    EXPECT_GT(hits, 50);
+    EXPECT_GT(cache.page_loads(), paged->page_count());
+    EXPECT_LE(cache.resident_bytes(), 4 * paged->page(0).bytes + 64 * sizeof(sphere) * 4);
+}
+
+TEST(PrimitiveFileTest, UnreadablePagesAreNotCached) {
+    geometry_cache cache;
+    int calls = 0;
+    auto load = [&] {
+        calls++;
+        auto page = make_shared<geometry_page>();
+        page->bvh = make_shared<hittable_list>();
+        page->complete = calls > 1;
+        return page;
+    };
+
+    // A page that failed to load is tried again on the next fetch; once read it is kept.
+    cache.fetch(1, load);
+    EXPECT_EQ(cache.resident_bytes(), 0u);
+    cache.fetch(1, load);
+    cache.fetch(1, load);
+    EXPECT_EQ(calls, 2);
+    EXPECT_EQ(cache.page_loads(), 2u);
+}
+
+TEST(AABBTest, Constructor) {
+  // Test the default constructor
+  aabb box1;
+  EXPECT_EQ(box1.x.min, std::numeric_limits<double>::infinity());
+  EXPECT_EQ(box1.x.max, -std::numeric_limits<double>::infinity());
+  EXPECT_EQ(box1.y.min, std::numeric_limits<double>::infinity());
+  EXPECT_EQ(box1.y.max, -std::numeric_limits<double>::infinity());
+  EXPECT_EQ(box1.z.min, std::numeric_limits<double>::infinity());
+  EXPECT_EQ(box1.z.max, -std::numeric_limits<double>::infinity());
+
+  // Test the constructor with intervals
+  interval ix(1.0, 2.0);
+  interval iy(3.0, 4.0);
+  interval iz(5.0, 6.0);
+  aabb box2(ix, iy, iz);
+  EXPECT_EQ(box2.x.min, 1.0);
+  EXPECT_EQ(box2.x.max, 2.0);
+  EXPECT_EQ(box2.y.min, 3.0);
+  EXPECT_EQ(box2.y.max, 4.0);
+  EXPECT_EQ(box2.z.min, 5.0);
+  EXPECT_EQ(box2.z.max, 6.0);
+
+  // Test the constructor with points
+  point3 a(1.0, 2.0, 3.0);
+  point3 b(4.0, 5.0, 6.0);
+  aabb box3(a, b);
+  EXPECT_EQ(box3.x.min, 1.0);
+  EXPECT_EQ(box3.x.max, 4.0);
+  EXPECT_EQ(box3.y.min, 2.0);
+  EXPECT_EQ(box3.y.max, 5.0);
+  EXPECT_EQ(box3.z.min, 3.0);
+  EXPECT_EQ(box3.z.max, 6.0);
+
+  // Test the constructor with two boxes
+  aabb box4(box2, box3);
+  EXPECT_EQ(box4.x.min, 1.0);
+  EXPECT_EQ(box4.x.max, 4.0);
+  EXPECT_EQ(box4.y.min, 2.0);
+  EXPECT_EQ(box4.y.max, 5.0);
+  EXPECT_EQ(box4.z.min, 3.0);
+  EXPECT_EQ(box4.z.max, 6.0);
+}
+
+TEST(AABBTest, Pad) {
+  // Test the pad method
+  aabb box(interval(1.0, 2.0), interval(3.0, 4.0), interval(5.0, 6.0));
+  aabb paddedBox = box.pad();
+  EXPECT_NEAR(paddedBox.x.min, 0.9999, 0.0002);
+  EXPECT_NEAR(paddedBox.x.max, 2.0001, 0.0002);
+  EXPECT_NEAR(paddedBox.y.min, 2.9999, 0.0002);
+  EXPECT_NEAR(paddedBox.y.max, 4.0001, 0.0002);
+  EXPECT_NEAR(paddedBox.z.min, 4.9999, 0.0002);
+  EXPECT_NEAR(paddedBox.z.max, 6.0001, 0.0002);
+}
+
+TEST(AABBTest, Axis) {
+  // Test the axis method
+  aabb box(interval(1.0, 2.0), interval(3.0, 4.0), interval(5.0, 6.0));
+  EXPECT_EQ(box.axis(0).min, 1.0);
+  EXPECT_EQ(box.axis(0).max, 2.0);
+  EXPECT_EQ(box.axis(1).min, 3.0);
+  EXPECT_EQ(box.axis(1).max, 4.0);
+  EXPECT_EQ(box.axis(2).min, 5.0);
+  EXPECT_EQ(box.axis(2).max, 6.0);
+}
+TEST(AABBTest, HitHandlesAxisAlignedRays) {
+  aabb box(point3(0, 0, 0), point3(1, 1, 1));
+
+  // Parallel to two slabs, inside them
+  EXPECT_TRUE(box.hit(ray(point3(0.5, 0.5, -2), vec3(0, 0, 1)), interval(0, infinity)));
+  EXPECT_TRUE(box.hit(ray(point3(0.5, 0.5, 3), vec3(0, 0, -1)), interval(0, infinity)));
+  // Parallel to a slab, outside it
+  EXPECT_FALSE(box.hit(ray(point3(1.5, 0.5, -2), vec3(0, 0, 1)), interval(0, infinity)));
+  // Starting on a slab's plane gives 0 * infinity; the slab must be ignored, not poison the test
+  EXPECT_TRUE(box.hit(ray(point3(0, 0.5, -2), vec3(0, 0, 1)), interval(0, infinity)));
+  EXPECT_TRUE(box.hit(ray(point3(1, 1, -2), vec3(-0.0, -0.0, 1)), interval(0, infinity)));
+  // Pointing away
+  EXPECT_FALSE(box.hit(ray(point3(0.5, 0.5, -2), vec3(0, 0, -1)), interval(0, infinity)));
+
+  ray r(point3(1, 2, 3), vec3(0, -2, 4));
+  EXPECT_EQ(r.length_squared(), 20);
+  EXPECT_EQ(r.inv_direction().y(), -0.5);
+  EXPECT_TRUE(std::isinf(r.inv_direction().x()));
+  EXPECT_FALSE(r.is_negative(0));
+  EXPECT_TRUE(r.is_negative(1));
+}
@@ -0,0 +1,96 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "./../headers/common.h"
+#include "./../headers/distribution.h"
+#include "image.h"
+
+#include <string>
+#include <vector>
+
+// Equirectangular (latitude-longitude) environment light with +Y up. Lookups are
+// nearest-texel so radiance is piecewise constant over texels, matching the 2D
+// distribution built over texel luminance for importance sampling.
+class environment_map {
+  public:
+    environment_map(const std::string& filename, double _intensity = 1.0, double rotation_degrees = 0.0)
+      : intensity(_intensity), rotation(degrees_to_radians(rotation_degrees)) {
+        image_file img(filename);
+        if (!img.valid())
+            return;
+
+        width = img.width();
+        height = img.height();
+        pixels.resize(size_t(width) * height * 3);
+        img.read_block(0, 0, width, height, pixels.data());
+
+        // Texels near the poles cover less solid angle, so weight each row by sin(theta).
+        std::vector<double> weights(size_t(width) * height);
+        for (int y = 0; y < height; y++) {
+            auto sin_theta = sin(pi * (y + 0.5) / height);
+            for (int x = 0; x < width; x++)
+                weights[size_t(y) * width + x] = luminance(texel(x, y)) * sin_theta;
+        }
+        distribution = std::make_unique<distribution_2d>(weights.data(), width, height);
+    }
+
+    bool valid() const { return distribution != nullptr; }
+
+    color value(const vec3& direction) const {
+        double u, v;
+        direction_to_uv(direction, u, v);
+        return intensity * texel(column(u), row(v));
+    }
+
+    // Picks a direction proportionally to radiance; pdf is with respect to solid angle.
+    color sample(double u1, double u2, vec3& direction, double& pdf) const {
+        double u, v, uv_pdf;
+        distribution->sample(u1, u2, u, v, uv_pdf);
+
+        auto theta = v * pi;
+        auto phi = u * 2 * pi - pi + rotation;
+        auto sin_theta = sin(theta);
+        direction = vec3(sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+
+        pdf = (sin_theta > 0) ? uv_pdf / (2 * pi * pi * sin_theta) : 0;
+        return intensity * texel(column(u), row(v));
+    }
+
+    double pdf(const vec3& direction) const {
+        double u, v;
+        direction_to_uv(direction, u, v);
+
+        auto sin_theta = sin(v * pi);
+        return (sin_theta > 0) ? distribution->pdf(u, v) / (2 * pi * pi * sin_theta) : 0;
+    }
+
+  private:
+    double intensity;
+    double rotation;
+    int width = 0;
+    int height = 0;
+    std::vector<float> pixels;
+    std::unique_ptr<distribution_2d> distribution;
+
+    static double luminance(const color& c) {
+        return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+    }
+
+    color texel(int x, int y) const {
+        const float* c = &pixels[3 * (size_t(y) * width + x)];
+        return color(c[0], c[1], c[2]);
+    }
+
+    int column(double u) const { return std::clamp(static_cast<int>(u * width), 0, width - 1); }
+    int row(double v) const    { return std::clamp(static_cast<int>(v * height), 0, height - 1); }
+
+    void direction_to_uv(const vec3& direction, double& u, double& v) const {
+        auto d = unit_vector(direction);
+        auto phi = atan2(d.z(), d.x()) - rotation;
+        u = (phi + pi) / (2 * pi);
+        u -= floor(u);
+        v = acos(std::clamp(d.y(), -1.0, 1.0)) / pi;
+    }
+};
+
+#endif
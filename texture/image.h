@@ -0,0 +1,215 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "./../headers/common.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Reads rectangles of linear RGB out of PPM (P3/P6), PFM and Radiance HDR files.
+// Binary P6 and PFM rasters are uncompressed, so rows are read straight from disk
+// on demand; P3 and HDR have to be decoded front to back and are kept resident.
+class image_file {
+  public:
+    image_file(const std::string& _filename) : filename(_filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.good()) {
+            std::cerr << "Error: Image '" << filename << "' does not exist or cannot be opened." << std::endl;
+            return;
+        }
+
+        std::string magic;
+        file >> magic;
+        if (magic == "P3" || magic == "P6") {
+            format = (magic == "P3") ? ascii_ppm : binary_ppm;
+            image_width = read_header_int(file);
+            image_height = read_header_int(file);
+            maxval = read_header_int(file);
+            file.get();
+        } else if (magic == "PF") {
+            format = pfm;
+            double scale;
+            file >> image_width >> image_height >> scale;
+            file.get();
+            little_endian = scale < 0;
+        } else if (magic.rfind("#?", 0) == 0) {
+            format = radiance;
+            if (!read_radiance_header(file)) {
+                std::cerr << "Error: Unsupported Radiance header in '" << filename << "'." << std::endl;
+                return;
+            }
+        } else {
+            std::cerr << "Error: Unsupported image format in '" << filename << "'." << std::endl;
+            return;
+        }
+
+        data_offset = file.tellg();
+        loaded = file.good() && image_width > 0 && image_height > 0;
+    }
+
+    bool valid() const { return loaded; }
+    int width() const  { return image_width; }
+    int height() const { return image_height; }
+
+    // Copies the w x h block at (x0, y0) into out as packed RGB floats. Row 0 is the
+    // top of the image; the block must lie inside the image.
+    void read_block(int x0, int y0, int w, int h, float* out) const {
+        if (format == binary_ppm || format == pfm) {
+            read_block_from_disk(x0, y0, w, h, out);
+            return;
+        }
+
+        std::call_once(decoded, [this] { decode_all(); });
+        for (int y = 0; y < h; y++) {
+            const float* row = &pixels[3 * (size_t(y0 + y) * image_width + x0)];
+            std::memcpy(out + 3 * size_t(y) * w, row, 3 * size_t(w) * sizeof(float));
+        }
+    }
+
+  private:
+    enum file_format { ascii_ppm, binary_ppm, pfm, radiance };
+
+    std::string filename;
+    file_format format = ascii_ppm;
+    int image_width = 0;
+    int image_height = 0;
+    int maxval = 255;
+    bool little_endian = true;
+    bool flip_x = false;
+    std::streamoff data_offset = 0;
+    bool loaded = false;
+
+    mutable std::once_flag decoded;
+    mutable std::vector<float> pixels;
+
+    // PPM samples of any depth, 8 or 16 bit, are stored with the same gamma 2 curve
+    // write_color applies.
+    static float decode_ppm(double value, double max) {
+        auto c = value / max;
+        return static_cast<float>(c * c);
+    }
+
+    bool read_radiance_header(std::ifstream& file) {
+        std::string line;
+        std::getline(file, line);
+        while (std::getline(file, line) && !line.empty()) {
+            if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+                return false;
+        }
+
+        std::getline(file, line);
+        char ys[4], xs[4];
+        if (sscanf(line.c_str(), "%3s %d %3s %d", ys, &image_height, xs, &image_width) != 4)
+            return false;
+        flip_x = std::string(xs) == "-X";
+        return std::string(ys) == "-Y";
+    }
+
+    static int read_header_int(std::ifstream& file) {
+        std::string token;
+        while (file >> token && token[0] == '#')
+            std::getline(file, token);
+        return std::atoi(token.c_str());
+    }
+
+    void read_block_from_disk(int x0, int y0, int w, int h, float* out) const {
+        std::ifstream file(filename, std::ios::binary);
+        int bytes_per_channel = (format == pfm) ? 4 : (maxval < 256 ? 1 : 2);
+        size_t row_bytes = size_t(image_width) * 3 * bytes_per_channel;
+        std::vector<unsigned char> buffer(size_t(w) * 3 * bytes_per_channel);
+
+        for (int y = 0; y < h; y++) {
+            // PFM stores its rows bottom to top.
+            int file_row = (format == pfm) ? image_height - 1 - (y0 + y) : y0 + y;
+            file.seekg(data_offset + std::streamoff(file_row * row_bytes + size_t(x0) * 3 * bytes_per_channel));
+            file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+            float* dst = out + 3 * size_t(y) * w;
+            for (int i = 0; i < 3 * w; i++) {
+                const unsigned char* b = &buffer[size_t(i) * bytes_per_channel];
+                if (format == pfm) {
+                    uint32_t bits = little_endian
+                        ? uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24
+                        : uint32_t(b[3]) | uint32_t(b[2]) << 8 | uint32_t(b[1]) << 16 | uint32_t(b[0]) << 24;
+                    std::memcpy(&dst[i], &bits, sizeof(float));
+                } else if (bytes_per_channel == 1) {
+                    dst[i] = decode_ppm(b[0], maxval);
+                } else {
+                    dst[i] = decode_ppm((b[0] << 8) | b[1], maxval);
+                }
+            }
+        }
+    }
+
+    void decode_all() const {
+        pixels.assign(size_t(image_width) * image_height * 3, 0.0f);
+        std::ifstream file(filename, std::ios::binary);
+        file.seekg(data_offset);
+
+        if (format == ascii_ppm) {
+            for (auto& c : pixels) {
+                int value = 0;
+                file >> value;
+                c = decode_ppm(value, maxval);
+            }
+            return;
+        }
+
+        std::vector<unsigned char> scanline(size_t(image_width) * 4);
+        for (int y = 0; y < image_height; y++) {
+            if (!read_rgbe_scanline(file, scanline))
+                break;
+            for (int x = 0; x < image_width; x++) {
+                const unsigned char* rgbe = &scanline[size_t(x) * 4];
+                float* dst = &pixels[3 * (size_t(y) * image_width + (flip_x ? image_width - 1 - x : x))];
+                if (rgbe[3] == 0)
+                    continue;
+                auto f = static_cast<float>(ldexp(1.0, rgbe[3] - (128 + 8)));
+                dst[0] = rgbe[0] * f;
+                dst[1] = rgbe[1] * f;
+                dst[2] = rgbe[2] * f;
+            }
+        }
+    }
+
+    bool read_rgbe_scanline(std::ifstream& file, std::vector<unsigned char>& scanline) const {
+        unsigned char head[4];
+        if (!file.read(reinterpret_cast<char*>(head), 4))
+            return false;
+
+        bool run_length = head[0] == 2 && head[1] == 2 && !(head[2] & 0x80)
+                       && ((head[2] << 8) | head[3]) == image_width && image_width >= 8 && image_width < 32768;
+        if (!run_length) {
+            std::memcpy(scanline.data(), head, 4);
+            return bool(file.read(reinterpret_cast<char*>(scanline.data()) + 4, scanline.size() - 4));
+        }
+
+        // Adaptive RLE stores each of the four components as its own run-length coded plane.
+        for (int c = 0; c < 4; c++) {
+            int x = 0;
+            while (x < image_width) {
+                int count = file.get();
+                if (count == EOF)
+                    return false;
+                if (count > 128) {
+                    count -= 128;
+                    int value = file.get();
+                    for (int i = 0; i < count && x < image_width; i++)
+                        scanline[size_t(x++) * 4 + c] = static_cast<unsigned char>(value);
+                } else {
+                    for (int i = 0; i < count && x < image_width; i++)
+                        scanline[size_t(x++) * 4 + c] = static_cast<unsigned char>(file.get());
+                }
+            }
+        }
+        return file.good();
+    }
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef PERLIN_H
+#define PERLIN_H
+
+#include "./../headers/common.h"
+
+// Improved Perlin noise. The permutation is Perlin's reference table, stored twice
+// so lattice hashing never has to mask, and gradients are looked up from small
+// arrays rather than selected with branches. Every corner runs the same straight
+// line code, which lets the compiler unroll and vectorize the eight corner
+// evaluations.
+class perlin {
+  public:
+    perlin() {
+        for (int i = 0; i < 512; i++)
+            perm[i] = permutation[i & 255];
+    }
+
+    double noise(const point3& p) const {
+        return noise(p.x(), p.y(), p.z());
+    }
+
+    double noise(double px, double py, double pz) const {
+        auto fx = floor(px);
+        auto fy = floor(py);
+        auto fz = floor(pz);
+
+        int X = static_cast<int>(fx) & 255;
+        int Y = static_cast<int>(fy) & 255;
+        int Z = static_cast<int>(fz) & 255;
+
+        auto x = px - fx;
+        auto y = py - fy;
+        auto z = pz - fz;
+
+        double u[2] = {1 - fade(x), fade(x)};
+        double v[2] = {1 - fade(y), fade(y)};
+        double w[2] = {1 - fade(z), fade(z)};
+
+        double accum = 0;
+        for (int c = 0; c < 8; c++) {
+            int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+            int h = perm[perm[perm[X + dx] + Y + dy] + Z + dz] & 15;
+
+            auto g = grad_x[h] * (x - dx) + grad_y[h] * (y - dy) + grad_z[h] * (z - dz);
+            accum += u[dx] * v[dy] * w[dz] * g;
+        }
+        return accum;
+    }
+
+    double turb(const point3& p, int depth = 7) const {
+        auto accum = 0.0;
+        auto temp_p = p;
+        auto weight = 1.0;
+
+        for (int i = 0; i < depth; i++) {
+            accum += weight * noise(temp_p);
+            weight *= 0.5;
+            temp_p *= 2;
+        }
+
+        return fabs(accum);
+    }
+
+  private:
+    int perm[512];
+
+    static double fade(double t) {
+        return t * t * t * (t * (t * 6 - 15) + 10);
+    }
+
+    // The twelve cube edge directions, padded to sixteen so a hash maps with & 15.
+    static constexpr double grad_x[16] = {1,-1, 1,-1, 1,-1, 1,-1, 0, 0, 0, 0, 1, 0,-1, 0};
+    static constexpr double grad_y[16] = {1, 1,-1,-1, 0, 0, 0, 0, 1,-1, 1,-1, 1,-1, 1,-1};
+    static constexpr double grad_z[16] = {0, 0, 0, 0, 1, 1,-1,-1, 1, 1,-1,-1, 0, 1, 0,-1};
+
+    static constexpr int permutation[256] = {
+        151, 160, 137,  91,  90,  15, 131,  13, 201,  95,  96,  53, 194, 233,   7, 225,
+        140,  36, 103,  30,  69, 142,   8,  99,  37, 240,  21,  10,  23, 190,   6, 148,
+        247, 120, 234,  75,   0,  26, 197,  62,  94, 252, 219, 203, 117,  35,  11,  32,
+         57, 177,  33,  88, 237, 149,  56,  87, 174,  20, 125, 136, 171, 168,  68, 175,
+         74, 165,  71, 134, 139,  48,  27, 166,  77, 146, 158, 231,  83, 111, 229, 122,
+         60, 211, 133, 230, 220, 105,  92,  41,  55,  46, 245,  40, 244, 102, 143,  54,
+         65,  25,  63, 161,   1, 216,  80,  73, 209,  76, 132, 187, 208,  89,  18, 169,
+        200, 196, 135, 130, 116, 188, 159,  86, 164, 100, 109, 198, 173, 186,   3,  64,
+         52, 217, 226, 250, 124, 123,   5, 202,  38, 147, 118, 126, 255,  82,  85, 212,
+        207, 206,  59, 227,  47,  16,  58,  17, 182, 189,  28,  42, 223, 183, 170, 213,
+        119, 248, 152,   2,  44, 154, 163,  70, 221, 153, 101, 155, 167,  43, 172,   9,
+        129,  22,  39, 253,  19,  98, 108, 110,  79, 113, 224, 232, 178, 185, 112, 104,
+        218, 246,  97, 228, 251,  34, 242, 193, 238, 210, 144,  12, 191, 179, 162, 241,
+         81,  51, 145, 235, 249,  14, 239, 107,  49, 192, 214,  31, 181, 199, 106, 157,
+        184,  84, 204, 176, 115, 121,  50,  45, 127,   4, 150, 254, 138, 236, 205,  93,
+        222, 114,  67,  29,  24,  72, 243, 141, 128, 195,  78,  66, 215,  61, 156, 180,
+    };
+};
+
+#endif
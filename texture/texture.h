@@ -1,27 +1,173 @@
-#ifndef TEXTURE_H
-#define TEXTURE_H
-
-#include "./../headers/common.h"
-
-class texture {
-  public:
-    virtual ~texture() = default;
-
-    virtual color value(double u, double v, const point3& p) const = 0;
-};
-
-class solid_color : public texture {
-  public:
-    solid_color(color c) : color_value(c) {}
-
-    solid_color(double red, double green, double blue) : solid_color(color(red,green,blue)) {}
-
-    color value(double u, double v, const point3& p) const override {
-        return color_value;
-    }
-
-  private:
-    color color_value;
-};
-
-#endif
\ No newline at end of file
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "./../headers/common.h"
+#include "perlin.h"
+#include "texture_cache.h"
+
+#include <string>
+
+class texture {
+  public:
+    virtual ~texture() = default;
+
+    virtual color value(double u, double v, const point3& p) const = 0;
+
+    // footprint is the width of the ray's footprint in uv units, used to pick a
+    // prefiltered level; textures without levels ignore it.
+    virtual color value(double u, double v, const point3& p, double footprint) const {
+        return value(u, v, p);
+    }
+};
+
+class solid_color : public texture {
+  public:
+    solid_color(color c) : color_value(c) {}
+
+    solid_color(double red, double green, double blue) : solid_color(color(red,green,blue)) {}
+
+    using texture::value;
+
+    color value(double u, double v, const point3& p) const override {
+        return color_value;
+    }
+
+  private:
+    color color_value;
+};
+
+class image_texture : public texture {
+  public:
+    image_texture(const std::string& filename, texture_cache& _cache = texture_cache::global())
+      : cache(_cache) {
+        auto img = make_shared<image_file>(filename);
+        if (!img->valid())
+            return;
+
+        width = img->width();
+        height = img->height();
+        levels = texture_cache::level_count(width, height);
+        id = cache.add_image(img);
+    }
+
+    color value(double u, double v, const point3& p) const override {
+        return value(u, v, p, 0);
+    }
+
+    color value(double u, double v, const point3& p, double footprint) const override {
+        // Missing images render cyan so they stand out.
+        if (id < 0)
+            return color(0,1,1);
+
+        u = u - floor(u);
+        v = 1.0 - (v - floor(v));
+
+        auto texels = footprint * std::max(width, height);
+        auto lod = (texels > 1) ? fmin(log2(texels), levels - 1) : 0.0;
+        int level = static_cast<int>(lod);
+        auto blend = lod - level;
+
+        color c = bilinear(u, v, level);
+        if (blend > 0)
+            c = (1 - blend) * c + blend * bilinear(u, v, level + 1);
+        return c;
+    }
+
+  private:
+    texture_cache& cache;
+    int id = -1;
+    int width = 0;
+    int height = 0;
+    int levels = 0;
+
+    color bilinear(double u, double v, int level) const {
+        int w = texture_cache::level_size(width, level);
+        int h = texture_cache::level_size(height, level);
+
+        auto x = u * w - 0.5;
+        auto y = v * h - 0.5;
+        auto x0 = floor(x);
+        auto y0 = floor(y);
+        auto fx = x - x0;
+        auto fy = y - y0;
+
+        int i0 = wrap(static_cast<int>(x0), w), i1 = wrap(static_cast<int>(x0) + 1, w);
+        int j0 = wrap(static_cast<int>(y0), h), j1 = wrap(static_cast<int>(y0) + 1, h);
+
+        return (1 - fy) * ((1 - fx) * cache.texel(id, level, i0, j0) + fx * cache.texel(id, level, i1, j0))
+             +      fy  * ((1 - fx) * cache.texel(id, level, i0, j1) + fx * cache.texel(id, level, i1, j1));
+    }
+
+    static int wrap(int i, int n) {
+        i %= n;
+        return (i < 0) ? i + n : i;
+    }
+};
+
+// A material color that is either constant or looked up in a texture. Constant
+// colors are stored inline so the common case skips the virtual texture call.
+class color_source {
+  public:
+    color_source(const color& c) : constant(c) {}
+    color_source(shared_ptr<texture> t) : tex(t) {}
+
+    color value(double u, double v, const point3& p, double footprint = 0) const {
+        return tex ? tex->value(u, v, p, footprint) : constant;
+    }
+
+  private:
+    color constant;
+    shared_ptr<texture> tex;
+};
+
+class checker_texture : public texture {
+  public:
+    checker_texture(double _scale, const color_source& _even, const color_source& _odd)
+      : inv_scale(1.0 / _scale), even(_even), odd(_odd) {}
+
+    color value(double u, double v, const point3& p) const override {
+        return value(u, v, p, 0);
+    }
+
+    color value(double u, double v, const point3& p, double footprint) const override {
+        auto x = static_cast<int>(std::floor(inv_scale * p.x()));
+        auto y = static_cast<int>(std::floor(inv_scale * p.y()));
+        auto z = static_cast<int>(std::floor(inv_scale * p.z()));
+
+        bool is_even = (x + y + z) % 2 == 0;
+        return is_even ? even.value(u, v, p, footprint) : odd.value(u, v, p, footprint);
+    }
+
+  private:
+    double inv_scale;
+    color_source even;
+    color_source odd;
+};
+
+class noise_texture : public texture {
+  public:
+    enum pattern { smooth, turbulence, marble };
+
+    noise_texture(pattern _style, double _scale, const color& _tint = color(1,1,1), int _octaves = 7)
+      : style(_style), scale(_scale), tint(_tint), octaves(_octaves) {}
+
+    using texture::value;
+
+    color value(double u, double v, const point3& p) const override {
+        auto s = scale * p;
+        switch (style) {
+            case turbulence: return tint * noise.turb(s, octaves);
+            case marble:     return tint * 0.5 * (1 + sin(s.z() + 10 * noise.turb(s, octaves)));
+            default:         return tint * 0.5 * (1 + noise.noise(s));
+        }
+    }
+
+  private:
+    perlin noise;
+    pattern style;
+    double scale;
+    color tint;
+    int octaves;
+};
+
+#endif
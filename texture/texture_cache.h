@@ -0,0 +1,189 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "./../headers/common.h"
+#include "image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Every mip level of every registered image is split into fixed size tiles that are
+// read from disk (level 0) or box filtered from the level below on first use. Tiles
+// live in one LRU shared by all render threads and bounded by a byte budget; each
+// thread also keeps the tile it used last, so runs of lookups in one tile never take
+// the lock. That tile stays alive after the LRU evicts it, so memory in use can
+// exceed the budget by one tile (12 KB) per render thread.
+class texture_cache {
+  public:
+    static constexpr int tile_size = 32;
+
+    struct tile {
+        float rgb[3 * tile_size * tile_size] = {};
+    };
+
+    texture_cache(size_t budget_bytes = size_t(256) << 20)
+      : budget(budget_bytes), serial(next_serial()) {}
+
+    static texture_cache& global() {
+        static texture_cache cache;
+        return cache;
+    }
+
+    void set_budget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    size_t resident_bytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size() * sizeof(tile);
+    }
+
+    size_t tile_loads() const { return loads; }
+
+    int add_image(shared_ptr<const image_file> img) {
+        std::lock_guard<std::mutex> lock(mutex);
+        images.push_back(img);
+        return static_cast<int>(images.size()) - 1;
+    }
+
+    static int level_count(int width, int height) {
+        int levels = 1;
+        while ((width >> levels) > 0 || (height >> levels) > 0)
+            levels++;
+        return levels;
+    }
+
+    static int level_size(int size, int level) {
+        return std::max(1, size >> level);
+    }
+
+    // Texel (x, y) of the given mip level; coordinates must lie inside the level.
+    color texel(int id, int level, int x, int y) const {
+        const tile* t = fetch(id, level, x / tile_size, y / tile_size);
+        const float* c = &t->rgb[3 * ((y % tile_size) * tile_size + (x % tile_size))];
+        return color(c[0], c[1], c[2]);
+    }
+
+  private:
+    struct entry {
+        shared_ptr<const tile> data;
+        std::list<uint64_t>::iterator position;
+    };
+
+    struct thread_slot {
+        uint64_t owner = 0;
+        uint64_t key = 0;
+        shared_ptr<const tile> data;
+    };
+
+    mutable std::mutex mutex;
+    mutable std::unordered_map<uint64_t, entry> entries;
+    mutable std::list<uint64_t> recency;
+    mutable std::atomic<size_t> loads{0};
+    std::vector<shared_ptr<const image_file>> images;
+    size_t budget;
+    uint64_t serial;
+
+    static uint64_t next_serial() {
+        static std::atomic<uint64_t> counter{1};
+        return counter++;
+    }
+
+    static uint64_t make_key(int id, int level, int tx, int ty) {
+        return (uint64_t(id) << 48) | (uint64_t(level) << 42) | (uint64_t(ty) << 21) | uint64_t(tx);
+    }
+
+    // The returned tile stays alive until this thread fetches another tile, so
+    // callers copy what they need before the next fetch.
+    const tile* fetch(int id, int level, int tx, int ty) const {
+        static thread_local thread_slot slot;
+
+        uint64_t key = make_key(id, level, tx, ty);
+        if (slot.owner != serial || slot.key != key) {
+            slot.data = lookup(id, level, tx, ty, key);
+            slot.owner = serial;
+            slot.key = key;
+        }
+        return slot.data.get();
+    }
+
+    shared_ptr<const tile> lookup(int id, int level, int tx, int ty, uint64_t key) const {
+        shared_ptr<const image_file> img;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = entries.find(key);
+            if (found != entries.end()) {
+                recency.splice(recency.begin(), recency, found->second.position);
+                return found->second.data;
+            }
+            img = images[id];
+        }
+
+        // Build outside the lock so other threads keep shading while this tile loads.
+        auto built = (level == 0) ? read_tile(*img, tx, ty) : filter_tile(*img, id, level, tx, ty);
+        loads++;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = entries.find(key);
+        if (found != entries.end())
+            return found->second.data;
+
+        recency.push_front(key);
+        entries[key] = entry{built, recency.begin()};
+        evict();
+        return built;
+    }
+
+    void evict() const {
+        while (entries.size() * sizeof(tile) > budget && entries.size() > 1) {
+            entries.erase(recency.back());
+            recency.pop_back();
+        }
+    }
+
+    static shared_ptr<const tile> read_tile(const image_file& img, int tx, int ty) {
+        auto t = make_shared<tile>();
+        int x0 = tx * tile_size;
+        int y0 = ty * tile_size;
+        int w = std::min(tile_size, img.width() - x0);
+        int h = std::min(tile_size, img.height() - y0);
+
+        std::vector<float> block(size_t(w) * h * 3);
+        img.read_block(x0, y0, w, h, block.data());
+        for (int y = 0; y < h; y++)
+            std::copy(&block[3 * size_t(y) * w], &block[3 * size_t(y + 1) * w], &t->rgb[3 * y * tile_size]);
+        return t;
+    }
+
+    shared_ptr<const tile> filter_tile(const image_file& img, int id, int level, int tx, int ty) const {
+        auto t = make_shared<tile>();
+        int w = level_size(img.width(), level);
+        int h = level_size(img.height(), level);
+        int src_w = level_size(img.width(), level - 1);
+        int src_h = level_size(img.height(), level - 1);
+
+        for (int y = ty * tile_size; y < std::min(h, (ty + 1) * tile_size); y++) {
+            for (int x = tx * tile_size; x < std::min(w, (tx + 1) * tile_size); x++) {
+                int sx0 = std::min(2 * x, src_w - 1), sx1 = std::min(2 * x + 1, src_w - 1);
+                int sy0 = std::min(2 * y, src_h - 1), sy1 = std::min(2 * y + 1, src_h - 1);
+                color sum = texel(id, level - 1, sx0, sy0) + texel(id, level - 1, sx1, sy0)
+                          + texel(id, level - 1, sx0, sy1) + texel(id, level - 1, sx1, sy1);
+
+                float* c = &t->rgb[3 * ((y % tile_size) * tile_size + (x % tile_size))];
+                c[0] = static_cast<float>(sum.x() / 4);
+                c[1] = static_cast<float>(sum.y() / 4);
+                c[2] = static_cast<float>(sum.z() / 4);
+            }
+        }
+        return t;
+    }
+};
+
+#endif